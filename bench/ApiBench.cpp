@@ -0,0 +1,217 @@
+#include "Bench.hpp"
+#include "Daemon.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <random>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+namespace ntmd {
+
+void benchApi(uint16_t port, int clients)
+{
+    /* Requests sent by every client, one connection each like any other API client. */
+    constexpr int REQUESTS_PER_CLIENT = 20;
+
+    /* Each with its own latencies. traffic-between asks for a random range so it usually has to
+     * read the database, traffic-daily is usually cached and snapshot only reads memory. */
+    const std::vector<std::string> commands = {"traffic-between", "traffic-daily", "snapshot"};
+
+    struct Connection
+    {
+        int fd{-1};
+        std::size_t command{0};
+        std::string request;
+        std::size_t sent{0};
+        bool rejected{false}; /* The server answered with an error. */
+        std::chrono::steady_clock::time_point start;
+    };
+
+    const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0)
+    {
+        std::cerr << ntmd::logerror << "Could not create epoll instance. Error: " << strerror(errno)
+                  << "\n";
+        return;
+    }
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+
+    std::mt19937 rng(1);
+    const time_t now = std::time(nullptr);
+
+    std::vector<Connection> connections(std::max(clients, 1));
+    std::vector<std::vector<double>> latencies(commands.size());
+    const int total = static_cast<int>(connections.size()) * REQUESTS_PER_CLIENT;
+    int started = 0;
+    int failed = 0;
+
+    /* Start the next request on a connection slot, returns false once every request was sent. */
+    auto next = [&](std::size_t slot) {
+        Connection& connection = connections[slot];
+        while (started < total)
+        {
+            started++;
+            connection.command = started % commands.size();
+            connection.request = commands[connection.command];
+            if (connection.command == 0)
+            {
+                const time_t from = now - rng() % (30 * 24 * 60 * 60);
+                connection.request += " " + std::to_string(from) + " " + std::to_string(now);
+            }
+            connection.request += "\n";
+            connection.sent = 0;
+            connection.rejected = false;
+            connection.start = std::chrono::steady_clock::now();
+
+            connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (connect(connection.fd, (sockaddr*)&address, sizeof(address)) < 0 &&
+                errno != EINPROGRESS)
+            {
+                close(connection.fd);
+                failed++;
+                continue;
+            }
+
+            epoll_event event{};
+            event.events = EPOLLOUT;
+            event.data.u64 = slot;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, connection.fd, &event);
+            return true;
+        }
+
+        connection.fd = -1;
+        return false;
+    };
+
+    std::cout << "Sending " << total << " requests from " << connections.size()
+              << " concurrent clients to port " << port << "\n";
+
+    const auto start = std::chrono::steady_clock::now();
+    int active = 0;
+    for (std::size_t slot = 0; slot < connections.size(); slot++)
+    {
+        if (next(slot))
+            active++;
+    }
+
+    epoll_event events[64];
+    while (active > 0)
+    {
+        const int ready = epoll_wait(epollFd, events, 64, -1);
+        for (int i = 0; i < ready; i++)
+        {
+            const std::size_t slot = events[i].data.u64;
+            Connection& connection = connections[slot];
+
+            bool done = false;
+            bool error = (events[i].events & EPOLLERR) != 0;
+
+            if (!error && connection.sent < connection.request.size())
+            {
+                const ssize_t count =
+                    send(connection.fd, connection.request.data() + connection.sent,
+                         connection.request.size() - connection.sent, MSG_NOSIGNAL);
+                if (count < 0 && errno != EAGAIN)
+                    error = true;
+                else if (count > 0)
+                    connection.sent += count;
+
+                if (connection.sent == connection.request.size())
+                {
+                    epoll_event event{};
+                    event.events = EPOLLIN;
+                    event.data.u64 = slot;
+                    epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+                }
+            }
+            else if (!error)
+            {
+                /* The server closes the connection once the whole response is written. */
+                char buffer[65536];
+                while (true)
+                {
+                    const ssize_t count = read(connection.fd, buffer, sizeof(buffer));
+                    if (count == 0)
+                    {
+                        done = true;
+                        break;
+                    }
+
+                    if (count < 0)
+                    {
+                        error = errno != EAGAIN;
+                        break;
+                    }
+
+                    /* Errors are short enough to arrive in one piece. */
+                    if (std::string_view(buffer, count).find("\"result\":\"error\"") !=
+                        std::string_view::npos)
+                        connection.rejected = true;
+                }
+            }
+
+            if (!done && !error)
+                continue;
+
+            if (done && !connection.rejected)
+            {
+                latencies[connection.command].push_back(
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                              connection.start)
+                        .count());
+            }
+            else
+            {
+                failed++;
+            }
+
+            close(connection.fd);
+            if (!next(slot))
+                active--;
+        }
+    }
+
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    close(epollFd);
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Finished in " << seconds << " s, " << (started - failed) / seconds
+              << " requests per second, " << failed << " failed or refused\n";
+
+    for (std::size_t i = 0; i < commands.size(); i++)
+    {
+        std::vector<double>& times = latencies[i];
+        if (times.empty())
+            continue;
+
+        std::sort(times.begin(), times.end());
+        auto percentile = [&times](double fraction) {
+            const auto index = static_cast<std::size_t>(fraction * times.size());
+            return times[std::min(times.size() - 1, index)];
+        };
+
+        std::cout << "  " << std::left << std::setw(16) << commands[i] << std::right
+                  << times.size() << " requests, p50 " << percentile(0.5) << " ms, p99 "
+                  << percentile(0.99) << " ms, max " << times.back() << " ms\n";
+    }
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+namespace ntmd {
+
+/* Time refreshing the socket index through sock_diag and /proc/net with the given number of extra
+ * udp sockets open, exact sock_diag lookups, then the socket map against std::unordered_map. */
+void benchSockets(int extraSockets);
+
+/* Write the given number of 10 second intervals of synthetic traffic to each storage engine in a
+ * temporary directory and query them back, printing the time, bytes written and disk use. 0
+ * writes a day of intervals. */
+void benchStorage(int intervals);
+
+/* Load test the API server of a running daemon on the given port with this many concurrent
+ * clients, printing throughput and per command latency percentiles. */
+void benchApi(uint16_t port, int clients);
+
+/* Time writing and decoding a traffic response with the given number of applications in every
+ * encoding, and its size in each. */
+void benchEncoding(int applications);
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,117 @@
+#include "Bench.hpp"
+#include "Daemon.hpp"
+#include "api/Encoding.hpp"
+#include "api/ResponseWriter.hpp"
+#include "traffic/TrafficStore.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+namespace ntmd {
+
+void benchEncoding(int applications)
+{
+    /* Enough runs of each encoding for the timings to settle. */
+    const int runs = std::max(1, 200000 / std::max(applications, 1));
+
+    /* Byte counts spread over several orders of magnitude like real traffic, so the binary
+     * encodings don't get to use their smallest integers for every field. */
+    std::mt19937_64 rng(1);
+    std::unordered_map<std::string, TrafficLine> traffic;
+    for (int i = 0; i < applications; i++)
+    {
+        const uint64_t scale = uint64_t{1} << (rng() % 32);
+        TrafficLine line;
+        line.bytesRx = rng() % scale;
+        line.bytesTx = rng() % scale / 4;
+        line.pktRxCount = line.bytesRx / 900 + 1;
+        line.pktTxCount = line.bytesTx / 300 + 1;
+        traffic["application-" + std::to_string(i)] = line;
+    }
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Encoding traffic of " << traffic.size() << " applications, " << runs
+              << " runs each\n";
+
+    /* What the responses were built as before ResponseWriter, for comparison. */
+    auto document = [&traffic](Encoding encoding) {
+        json payload;
+        payload["length"] = traffic.size();
+        for (const auto& [name, line] : traffic)
+        {
+            if (encoding != Encoding::Json)
+                payload["data"][name] = {line.bytesRx, line.bytesTx, line.pktRxCount,
+                                         line.pktTxCount};
+            else
+                payload["data"][name] = {{"bytesRx", line.bytesRx},
+                                         {"bytesTx", line.bytesTx},
+                                         {"pktRxCount", line.pktRxCount},
+                                         {"pktTxCount", line.pktTxCount}};
+        }
+        payload["result"] = "success";
+        return encode(payload, encoding);
+    };
+
+    std::size_t jsonSize = 0;
+    for (Encoding encoding : {Encoding::Json, Encoding::Cbor, Encoding::MessagePack})
+    {
+        std::string buffer;
+        std::shared_ptr<const std::string> response;
+
+        const auto writeStart = std::chrono::steady_clock::now();
+        for (int i = 0; i < runs; i++)
+        {
+            buffer.clear();
+            ResponseWriter writer(buffer, encoding);
+            writer.beginObject(3);
+            writer.traffic(traffic);
+            writer.key("result");
+            writer.string("success");
+            writer.endObject();
+            response = std::make_shared<const std::string>(buffer);
+        }
+        const auto writeEnd = std::chrono::steady_clock::now();
+
+        std::string built;
+        for (int i = 0; i < runs; i++)
+        {
+            built = document(encoding);
+        }
+        const auto documentEnd = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < runs; i++)
+        {
+            decode(*response, encoding);
+        }
+        const auto decodeEnd = std::chrono::steady_clock::now();
+
+        if (encoding == Encoding::Json)
+            jsonSize = response->size();
+
+        auto perRun = [runs](auto start, auto end) {
+            return std::chrono::duration<double, std::milli>(end - start).count() / runs;
+        };
+
+        std::cout << "  " << std::left << std::setw(8) << encodingName(encoding) << std::right
+                  << std::setw(10) << response->size() << " bytes (" << std::setprecision(1)
+                  << 100.0 * response->size() / jsonSize << "% of json), write "
+                  << std::setprecision(3) << perRun(writeStart, writeEnd) << " ms, as document "
+                  << perRun(writeEnd, documentEnd) << " ms, decode "
+                  << perRun(documentEnd, decodeEnd) << " ms\n";
+
+        if (decode(*response, encoding) != decode(built, encoding))
+        {
+            std::cerr << ntmd::logwarn << "The " << encodingName(encoding)
+                      << " response differs from the one built as a document.\n";
+        }
+    }
+}
+
+} // namespace ntmd
\ No newline at end of file
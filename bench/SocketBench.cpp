@@ -0,0 +1,273 @@
+#include "Bench.hpp"
+#include "Daemon.hpp"
+#include "net/PacketHash.hpp"
+#include "proc/SockDiag.hpp"
+#include "proc/SocketIndex.hpp"
+#include "util/FlatHashMap.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <malloc.h>
+#include <netinet/in.h>
+#include <random>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace ntmd {
+
+/* The hash sockets used to be stored with, kept to compare against in the benchmark. */
+struct XorPacketHash
+{
+    std::size_t operator()(const PacketHash& p) const
+    {
+        return ((std::hash<uint32_t>()(p.ip1) ^ (std::hash<uint16_t>()(p.port1) << 1)) >> 1) ^
+               (std::hash<uint32_t>()(p.ip2) << 1) ^ (std::hash<uint16_t>()(p.port2) << 1) >> 1;
+    }
+};
+
+/* The hash sockets were stored with before it was keyed, its collisions can be searched for
+ * offline. */
+struct UnkeyedPacketHash
+{
+    std::size_t operator()(const PacketHash& p) const
+    {
+        const uint64_t ips = (static_cast<uint64_t>(p.ip1) << 32) | p.ip2;
+        const uint64_t ports = (static_cast<uint64_t>(p.port1) << 16) | p.port2;
+
+        const unsigned __int128 product =
+            static_cast<unsigned __int128>(ips ^ 0xa0761d6478bd642fULL) *
+            (ports ^ 0xe7037ed1a0b428dbULL);
+        return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+    }
+};
+
+/* Time lookups of every key, in a random order, and of keys that aren't in the map, then print
+ * them along with the memory allocated to build the map. */
+template <class Map>
+static void benchmarkMap(const char* name, const std::vector<PacketHash>& keys,
+                         const std::vector<PacketHash>& missing)
+{
+    constexpr int lookups = 4000000;
+
+    /* Large allocations are mapped separately from the heap and counted apart from it. */
+    auto allocated = [] {
+        const struct mallinfo2 info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+    };
+
+    const std::size_t before = allocated();
+    Map map;
+    for (std::size_t i = 0; i < keys.size(); i++)
+    {
+        map[keys[i]] = i + 1;
+    }
+    const std::size_t memory = allocated() - before;
+
+    auto time = [&](const std::vector<PacketHash>& search) {
+        uint64_t sum = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0, key = 0; i < lookups; i++)
+        {
+            const auto found = map.find(search[key]);
+            if (found != map.end())
+                sum += found->second;
+
+            if (++key == static_cast<int>(search.size()))
+                key = 0;
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        /* Keep the lookups from being optimized away. */
+        volatile uint64_t sink = sum;
+        (void)sink;
+
+        return std::chrono::duration<double, std::nano>(end - start).count() / lookups;
+    };
+
+    const double hit = time(keys);
+    const double miss = time(missing);
+
+    std::cout << std::fixed << std::setprecision(1) << "  " << std::left << std::setw(30) << name
+              << std::right << hit << " ns per hit, " << miss << " ns per miss, "
+              << memory / 1024.0 / 1024.0 << " MB\n";
+}
+
+/* Compare the socket map against std::unordered_map for tables of a few sizes. The keys look like
+ * a busy host's sockets: a few local addresses, sequential ephemeral ports and remote ends on the
+ * usual service ports. */
+static void benchmarkMaps()
+{
+    std::mt19937_64 random(1);
+    const uint16_t services[] = {443, 80, 53, 22};
+
+    for (const int count : {1000, 10000, 100000, 1000000})
+    {
+        std::vector<PacketHash> keys, missing;
+        for (int i = 0; i < count; i++)
+        {
+            const uint32_t localIP = htonl(0x0a000001 + i / 28232);
+            const uint16_t localPort = 32768 + i % 28232;
+            const uint32_t remoteIP = static_cast<uint32_t>(random());
+
+            keys.emplace_back(localIP, localPort, remoteIP, services[random() % 4]);
+            missing.emplace_back(localIP, localPort, remoteIP, 8443);
+        }
+        std::shuffle(keys.begin(), keys.end(), random);
+
+        std::cout << "Looking up " << count << " sockets\n";
+        benchmarkMap<std::unordered_map<PacketHash, uint64_t, XorPacketHash>>(
+            "unordered_map, xor hash", keys, missing);
+        benchmarkMap<std::unordered_map<PacketHash, uint64_t>>("unordered_map", keys, missing);
+        benchmarkMap<SocketMap>("FlatHashMap", keys, missing);
+    }
+
+    /* What a remote host sending to closed ports could do to the list of packets without a
+     * socket: tuples picked so that their hashes share the top bits FlatHashMap places them by. */
+    constexpr int COLLIDING = 256;
+    constexpr unsigned SHARED_BITS = 12;
+    const uint32_t localIP = htonl(0x0a000001);
+    std::vector<PacketHash> colliding;
+    while (colliding.size() < 2 * COLLIDING)
+    {
+        const PacketHash hash(localIP, 443, static_cast<uint32_t>(random()),
+                              static_cast<uint16_t>(random()));
+        const uint64_t home = UnkeyedPacketHash()(hash) * 0x9e3779b97f4a7c15ULL;
+        if (home >> (64 - SHARED_BITS) == 0)
+            colliding.push_back(hash);
+    }
+    const std::vector<PacketHash> keys(colliding.begin(), colliding.begin() + COLLIDING);
+    const std::vector<PacketHash> missing(colliding.begin() + COLLIDING, colliding.end());
+
+    std::cout << "Looking up " << COLLIDING << " sockets whose unkeyed hashes share their top "
+              << SHARED_BITS << " bits\n";
+    benchmarkMap<FlatHashMap<PacketHash, uint64_t, UnkeyedPacketHash>>("FlatHashMap, unkeyed hash",
+                                                                    keys, missing);
+    benchmarkMap<SocketMap>("FlatHashMap", keys, missing);
+}
+
+void benchSockets(int extraSockets)
+{
+    std::vector<int> sockets;
+    if (extraSockets > 0)
+    {
+        rlimit limit;
+        getrlimit(RLIMIT_NOFILE, &limit);
+        limit.rlim_cur = std::max<rlim_t>(limit.rlim_cur, extraSockets + 1024);
+        limit.rlim_max = std::max(limit.rlim_max, limit.rlim_cur);
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+        {
+            std::cerr << ntmd::logwarn << "Could not raise the open file limit to "
+                      << limit.rlim_cur << ". Error: " << strerror(errno) << "\n";
+        }
+
+        /* Leave descriptors for the netlink socket and /proc tables. */
+        getrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur < static_cast<rlim_t>(extraSockets) + 64)
+            extraSockets = limit.rlim_cur > 64 ? limit.rlim_cur - 64 : 0;
+
+        /* Every address in 127.0.0.0/8 has its own range of ephemeral ports, spread the sockets
+         * between them so they don't run out. */
+        for (int i = 0; i < extraSockets; i++)
+        {
+            const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            if (fd < 0)
+            {
+                std::cerr << ntmd::logwarn << "Could only open " << sockets.size()
+                          << " extra sockets. Error: " << strerror(errno) << "\n";
+                break;
+            }
+            sockets.push_back(fd);
+
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(0x7f000001 + ((i / 16384) << 8));
+            bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        }
+    }
+
+    constexpr int rounds = 5;
+
+    /* Every round refreshes an empty offline index, which never reads the tables on its own. */
+    auto measure = [&](const char* name, const std::function<void(SocketIndex&)>& refresh) {
+        double total = 0;
+        std::size_t indexed = 0;
+        for (int i = 0; i < rounds; i++)
+        {
+            SocketIndex index(SocketMap{});
+
+            const auto start = std::chrono::steady_clock::now();
+            refresh(index);
+            const auto end = std::chrono::steady_clock::now();
+
+            total += std::chrono::duration<double, std::milli>(end - start).count();
+            indexed = index.sockets().size();
+        }
+
+        std::cout << std::fixed << std::setprecision(2) << "  " << name << ": " << indexed
+                  << " sockets, " << total / rounds << " ms per refresh\n";
+    };
+
+    std::cout << "Refreshing the tcp and udp tables " << rounds << " times with "
+              << sockets.size() << " extra sockets open\n";
+
+    measure("sock_diag", [](SocketIndex& index) {
+        index.dump(IPPROTO_TCP);
+        index.dump(IPPROTO_UDP);
+    });
+    measure("/proc/net", [](SocketIndex& index) {
+        index.refresh({"/proc/net/tcp", "/proc/net/tcp6", "/proc/net/udp"});
+    });
+
+    /* What a miss costs with exact lookups instead of a refresh. */
+    SocketIndex index(SocketMap{});
+    SockDiag sockDiag;
+    index.dump(IPPROTO_TCP);
+    index.dump(IPPROTO_UDP);
+
+    int lookups = 0, found = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& [hash, inode] : index.sockets())
+    {
+        if (lookups == 1000)
+            break;
+
+        /* Udp sockets are indexed by local port only, most of ours are bound on 127.0.0.1. */
+        const uint8_t protocol = hash.port2 != 0 ? IPPROTO_TCP : IPPROTO_UDP;
+        const uint32_t localIP = protocol == IPPROTO_UDP ? htonl(INADDR_LOOPBACK) : hash.ip1;
+        const uint32_t local[4] = {localIP, 0, 0, 0};
+        const uint32_t remote[4] = {hash.ip2, 0, 0, 0};
+
+        inet_diag_msg msg;
+        if (sockDiag.lookup(AF_INET, protocol, local, htons(hash.port1), remote, htons(hash.port2),
+                            msg))
+            found++;
+        lookups++;
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    if (lookups > 0)
+    {
+        std::cout << "  exact lookup: "
+                  << std::chrono::duration<double, std::micro>(end - start).count() / lookups
+                  << " us per lookup (" << found << "/" << lookups << " found)\n";
+    }
+
+    for (const int fd : sockets)
+    {
+        close(fd);
+    }
+
+    benchmarkMaps();
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "Bench.hpp"
+#include "Daemon.hpp"
+#include "traffic/DBController.hpp"
+#include "traffic/TrafficStore.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace ntmd {
+
+/* Bytes this process has handed to write calls so far, including what sqlite writes to its
+ * journal and checkpoints. */
+static uint64_t bytesWritten()
+{
+    std::ifstream io("/proc/self/io");
+    std::string key;
+    uint64_t value;
+    while (io >> key >> value)
+    {
+        if (key == "wchar:")
+            return value;
+    }
+
+    return 0;
+}
+
+static uint64_t diskUsage(const std::filesystem::path& directory)
+{
+    uint64_t bytes = 0;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(directory))
+    {
+        if (entry.is_regular_file())
+            bytes += entry.file_size();
+    }
+
+    return bytes;
+}
+
+void benchStorage(int intervals)
+{
+    /* A day of 10 second intervals from 100 applications, each active three quarters of the
+     * time, committed once a minute like the default flush interval. */
+    constexpr int APPLICATIONS = 100;
+    constexpr int INTERVAL = 10;
+    constexpr int INTERVALS_PER_COMMIT = 6;
+    if (intervals <= 0)
+        intervals = 24 * 60 * 60 / INTERVAL;
+
+    const time_t base = 1700000000;
+    std::mt19937_64 rng(1);
+    std::vector<std::shared_ptr<const TrafficInterval>> traffic;
+    uint64_t rows = 0;
+    for (int i = 0; i < intervals; i++)
+    {
+        auto interval = std::make_shared<TrafficInterval>();
+        interval->timestamp = base + static_cast<time_t>(i) * INTERVAL;
+
+        for (int app = 0; app < APPLICATIONS; app++)
+        {
+            if (rng() % 4 == 0)
+                continue;
+
+            /* Most applications move little traffic, a few move a lot. */
+            TrafficLine& line = interval->traffic["app" + std::to_string(app)];
+            line.bytesRx = rng() % (1000u << (app % 16));
+            line.bytesTx = rng() % (100u << (app % 16));
+            line.pktRxCount = line.bytesRx / 1000 + 1;
+            line.pktTxCount = line.bytesTx / 1000 + 1;
+            rows++;
+        }
+
+        traffic.push_back(std::move(interval));
+    }
+
+    const time_t last = base + static_cast<time_t>(intervals - 1) * INTERVAL;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Writing " << intervals << " intervals (" << rows
+              << " rows) of synthetic traffic, a commit every " << INTERVALS_PER_COMMIT
+              << " intervals\n";
+
+    for (const std::string engine : {"sqlite", "segments"})
+    {
+        std::string directory =
+            (std::filesystem::temp_directory_path() / "ntmd-bench-XXXXXX").string();
+        if (mkdtemp(directory.data()) == nullptr)
+        {
+            std::cerr << ntmd::logerror << "Could not create a temporary directory. Error: "
+                      << strerror(errno) << "\n";
+            return;
+        }
+
+        double writeSeconds;
+        uint64_t written;
+        double wholeMillis;
+        double hourMicros = 0;
+        {
+            /* Only flush commits, the interval is never reached. */
+            DBController db(std::filesystem::path(directory) / "bench.db", 24 * 60 * 60, 0, engine);
+
+            const uint64_t writtenBefore = bytesWritten();
+            const auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < intervals; i++)
+            {
+                db.insertApplicationTraffic(traffic[i]);
+                if ((i + 1) % INTERVALS_PER_COMMIT == 0)
+                    db.flush();
+            }
+            db.flush();
+            writeSeconds =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            written = bytesWritten() - writtenBefore;
+
+            auto timed = [&db](time_t from, time_t to) {
+                const auto start = std::chrono::steady_clock::now();
+                db.fetchTrafficBetween(from, to);
+                return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+                    .count();
+            };
+
+            wholeMillis = timed(base, last) * 1e3;
+
+            constexpr int HOUR_QUERIES = 100;
+            for (int i = 0; i < HOUR_QUERIES; i++)
+            {
+                const time_t from = base + rng() % std::max<time_t>(last - base - 3600, 1);
+                hourMicros += timed(from, from + 3599) * 1e6 / HOUR_QUERIES;
+            }
+        }
+
+        const uint64_t disk = diskUsage(directory);
+        std::filesystem::remove_all(directory);
+
+        std::cout << engine << ":\n";
+        std::cout << "  write " << writeSeconds * 1e3 << " ms, "
+                  << writeSeconds * 1e6 * INTERVALS_PER_COMMIT / intervals << " us per commit\n";
+        std::cout << "  " << written << " bytes written (" << double(written) / rows
+                  << " per row), " << disk << " bytes on disk (" << double(disk) / rows
+                  << " per row)\n";
+        std::cout << "  whole range query " << wholeMillis << " ms, random hour query "
+                  << hourMicros << " us\n";
+    }
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include "Bench.hpp"
+#include "Daemon.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace ntmd;
+
+static const char* USAGE = R"(Usage: ntmd-bench <benchmark> [count] [port]
+
+Benchmarks:
+  sockets   Time socket table refreshes through netlink and /proc/net and socket map lookups at
+            several table sizes.
+            Optionally followed by a number of extra sockets to open first (e.g. 100000).
+  storage   Write synthetic traffic through the sqlite and segment storage engines and compare
+            time taken, bytes written, disk used and query times.
+            Optionally followed by a number of 10 second intervals (default a day).
+  api       Load test the API of the ntmd running on this host with concurrent clients and print
+            the latency of each command.
+            Optionally followed by a number of clients (default 200) and the API port (default
+            13889).
+  encoding  Compare the size of traffic responses in every API encoding and the time taken to
+            encode and decode them.
+            Optionally followed by a number of applications (default 1000).
+)";
+
+/* Parse a positional number, exiting if it isn't one between min and max. */
+static int number(const char* arg, const char* name, int min, int max)
+{
+    long long value;
+    try
+    {
+        std::size_t end;
+        value = std::stoll(arg, &end);
+        if (arg[end] != '\0')
+            throw std::invalid_argument(arg);
+    }
+    catch (const std::invalid_argument&)
+    {
+        std::cerr << ntmd::logerror << "The " << name << " \"" << arg << "\" is not a number.\n";
+        std::exit(2);
+    }
+    catch (const std::out_of_range&)
+    {
+        value = static_cast<long long>(max) + 1; /* Reported like any other value past max. */
+    }
+
+    if (value < min || value > max)
+    {
+        std::cerr << ntmd::logerror << "The " << name << " must be between " << min << " and "
+                  << max << ".\n";
+        std::exit(2);
+    }
+
+    return static_cast<int>(value);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 4 || std::strcmp(argv[1], "-h") == 0 ||
+        std::strcmp(argv[1], "--help") == 0)
+    {
+        std::cout << USAGE;
+        return argc < 2 ? 2 : 0;
+    }
+
+    const std::string benchmark = argv[1];
+    auto count = [&](int fallback, int min, int max) {
+        return argc > 2 ? number(argv[2], "count", min, max) : fallback;
+    };
+
+    if (benchmark == "sockets" && argc <= 3)
+        benchSockets(count(0, 0, 1000000));
+    else if (benchmark == "storage" && argc <= 3)
+        benchStorage(count(0, 0, 10000000));
+    else if (benchmark == "api")
+        benchApi(argc > 3 ? number(argv[3], "port", 1, 65535) : 13889, count(200, 1, 10000));
+    else if (benchmark == "encoding" && argc <= 3)
+        benchEncoding(count(1000, 1, 1000000));
+    else
+    {
+        std::cerr << USAGE;
+        return 2;
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -8,14 +8,24 @@
 
 #include <nlohmann/json.hpp>
 
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
 #include <netinet/in.h>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <thread>
 #include <unistd.h>
 #include <unordered_map>
@@ -25,21 +35,64 @@ using json = nlohmann::json;
 namespace ntmd {
 
 APIController::APIController(TrafficStorage& trafficStorage, const DBController& db,
-                             uint16_t port) :
+                             const Sniffer& sniffer, uint16_t port, int workers) :
     mTrafficStorage(trafficStorage),
-    mDB(db), mPort(port)
+    mDB(db), mSniffer(sniffer), mPort(port),
+    mResponseCache(
+        trafficStorage,
+        [](const TrafficMap& traffic, Encoding encoding) {
+            /* Each worker writes every response it serializes into the same buffer. */
+            thread_local std::string buffer;
+            buffer.clear();
+
+            ResponseWriter writer(buffer, encoding);
+            writer.beginObject(3);
+            writer.traffic(traffic);
+            writer.key("result");
+            writer.string("success");
+            writer.endObject();
+
+            return takeResponse(buffer);
+        },
+        RESPONSE_CACHE_ENTRIES),
+    mWorkers(workers, MAX_QUEUED_QUERIES)
 {
     this->startSocketServer();
 }
 
+APIController::~APIController()
+{
+    if (mDepositListener >= 0)
+        mTrafficStorage.removeDepositListener(mDepositListener);
+
+    if (mLoop.joinable())
+    {
+        mRunning = false;
+        this->wake();
+        mLoop.join();
+    }
+
+    /* Queries still running hand their responses to a loop that is gone, which is harmless. */
+    mWorkers.stop();
+
+    for (const auto& [id, client] : mClients)
+    {
+        close(client.fd);
+    }
+
+    for (int fd : {mServerFd, mEpollFd, mWakeFd})
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
 void APIController::startSocketServer()
 {
-    int serverFd;
     sockaddr_in address;
     int opt = 1;
-    int addrlen = sizeof(address);
 
-    if ((serverFd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    if ((mServerFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
     {
         std::cerr << ntmd::logerror
                   << "Failed to create the server's socket file descriptor for API. Proceeding "
@@ -47,7 +100,7 @@ void APIController::startSocketServer()
         return;
     }
 
-    if (setsockopt(serverFd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)))
+    if (setsockopt(mServerFd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)))
     {
         std::cerr << ntmd::logerror << "Failed to attach the server's socket to the port " << mPort
                   << " for API. Proceeding "
@@ -58,7 +111,7 @@ void APIController::startSocketServer()
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(mPort);
 
-    if (bind(serverFd, (sockaddr*)&address, sizeof(address)) < 0)
+    if (bind(mServerFd, (sockaddr*)&address, sizeof(address)) < 0)
     {
         std::cerr << ntmd::logerror << "Failed to bind the server's socket to the port " << mPort
                   << " for API. Proceeding "
@@ -66,282 +119,697 @@ void APIController::startSocketServer()
         return;
     }
 
-    std::thread loop([&] {
-        int newSocket, valread;
-        char buffer[1024] = {0};
+    if (listen(mServerFd, SOMAXCONN) < 0)
+    {
+        std::cerr << ntmd::logerror << "Failed to listen on the server's socket on the port "
+                  << mPort << " for API. Proceeding without API functionality.\n";
+        return;
+    }
+
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mEpollFd < 0 || mWakeFd < 0)
+    {
+        std::cerr << ntmd::logerror
+                  << "Could not create the API server's epoll instance. Error: " << strerror(errno)
+                  << ". Proceeding without API functionality.\n";
+        return;
+    }
 
-        while (true)
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = LISTENER_ID;
+    epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mServerFd, &event);
+
+    event.data.u64 = WAKE_ID;
+    epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &event);
+
+    /* Live streams are fed every deposit by the loop, the deposit only hands over a reference
+     * to its interval so a slow stream can never hold it up. */
+    mDepositListener = mTrafficStorage.addDepositListener(
+        [this](const std::shared_ptr<const TrafficInterval>& interval) {
+            {
+                std::unique_lock<std::mutex> lock(mHandoffMutex);
+                mLiveTraffic.push_back(interval);
+            }
+            this->wake();
+        });
+
+    mLoop = std::thread(&APIController::run, this);
+}
+
+void APIController::run()
+{
+    epoll_event events[64];
+    int timeout = -1;
+
+    while (mRunning)
+    {
+        const int ready = epoll_wait(mEpollFd, events, 64, timeout);
+        if (ready < 0 && errno != EINTR)
         {
-            if (listen(serverFd, 5) < 0)
+            std::cerr << ntmd::logerror << "Error while waiting on API sockets. Error: "
+                      << strerror(errno) << ". Stopping the API server.\n";
+            return;
+        }
+
+        for (int i = 0; i < ready; i++)
+        {
+            const uint64_t id = events[i].data.u64;
+
+            if (id == LISTENER_ID)
             {
-                std::cerr
-                    << ntmd::logwarn
-                    << "Error while attempting to listen onto server socket file descriptor. \n";
-                /* TODO: don't break here, handle errors */
+                this->acceptClients();
                 continue;
             }
 
-            if ((newSocket = accept(serverFd, (sockaddr*)&address, (socklen_t*)&addrlen)) < 0)
+            if (id == WAKE_ID)
             {
-                std::cerr << ntmd::logwarn << "Error accepting new incoming socket request.\n";
+                uint64_t count;
+                while (read(mWakeFd, &count, sizeof(count)) > 0)
+                    ;
+
+                this->drainHandoffs();
                 continue;
             }
 
-            valread = read(newSocket, buffer, sizeof(buffer));
-            buffer[valread] = '\0';
+            /* Closed by an earlier event in this batch. */
+            auto it = mClients.find(id);
+            if (it == mClients.end())
+                continue;
 
-            std::string strbuf = std::string(buffer);
-            std::vector<std::string> request = util::split(strbuf);
+            Client& client = it->second;
 
-            const std::string& cmd = util::trim(request[0]);
+            /* Nobody is left to read anything we would write. */
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                this->closeClient(id);
+                continue;
+            }
+
+            if (events[i].events & EPOLLIN)
+                this->readClient(client);
+
+            if (!this->service(client))
+                this->closeClient(id);
+        }
+
+        timeout = this->expireRequests();
+    }
+}
 
-            /* Handle API requests.
-             * API Handlers are responsible for closing the socket belonging to the requester. */
-            if (cmd == "live-text")
+void APIController::acceptClients()
+{
+    while (true)
+    {
+        const int fd = accept4(mServerFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
             {
-                this->liveText(newSocket);
+                std::cerr << ntmd::logwarn << "Error accepting new incoming socket request.\n";
             }
-            else if (cmd == "live")
+
+            return;
+        }
+
+        const uint64_t id = mNextClient++;
+        Client& client = mClients[id];
+        client.id = id;
+        client.fd = fd;
+        client.events = EPOLLIN | EPOLLRDHUP;
+
+        epoll_event event{};
+        event.events = client.events;
+        event.data.u64 = id;
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            close(fd);
+            mClients.erase(id);
+        }
+    }
+}
+
+void APIController::readClient(Client& client)
+{
+    char buffer[4096];
+
+    while (!client.peerClosed)
+    {
+        const ssize_t count = read(client.fd, buffer, sizeof(buffer));
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            /* Either nothing more to read for now or the connection is broken, in which case
+             * writing the response will fail too. */
+            break;
+        }
+
+        if (count == 0)
+        {
+            client.peerClosed = true;
+            break;
+        }
+
+        /* One request per connection, the rest is ignored. */
+        if (client.handled)
+            continue;
+
+        client.request.append(buffer, count);
+        client.lastRead = std::chrono::steady_clock::now();
+
+        if (client.request.find('\n') != std::string::npos)
+            break;
+
+        if (client.request.size() > MAX_REQUEST_SIZE)
+        {
+            mPartialRequests.erase(client.id);
+            client.handled = true;
+            this->respondError(client, "Request too long.");
+            return;
+        }
+    }
+
+    if (client.handled)
+        return;
+
+    /* A whole line, or everything the client is ever going to send. */
+    const std::size_t newline = client.request.find('\n');
+    if (newline != std::string::npos || (client.peerClosed && !client.request.empty()))
+    {
+        if (newline != std::string::npos)
+            client.request.resize(newline);
+
+        mPartialRequests.erase(client.id);
+        client.handled = true;
+        this->handleRequest(client);
+    }
+    else if (!client.request.empty())
+    {
+        mPartialRequests.insert(client.id);
+    }
+}
+
+bool APIController::service(Client& client)
+{
+    while (!client.output.empty())
+    {
+        /* Every waiting message goes out in one call, straight from the shared buffers. */
+        iovec iov[MAX_WRITE_MESSAGES];
+        int count = 0;
+        for (const auto& msg : client.output)
+        {
+            if (count == MAX_WRITE_MESSAGES)
+                break;
+
+            const std::size_t offset = count == 0 ? client.written : 0;
+            iov[count].iov_base = const_cast<char*>(msg->data() + offset);
+            iov[count].iov_len = msg->size() - offset;
+            count++;
+        }
+
+        msghdr header{};
+        header.msg_iov = iov;
+        header.msg_iovlen = count;
+
+        ssize_t sent = sendmsg(client.fd, &header, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            return false;
+        }
+
+        while (sent > 0)
+        {
+            const std::size_t left = client.output.front()->size() - client.written;
+            if (static_cast<std::size_t>(sent) < left)
             {
-                this->live(newSocket);
+                client.written += sent;
+                break;
             }
-            else if (cmd == "snapshot")
+
+            sent -= left;
+            client.output.pop_front();
+            client.written = 0;
+        }
+    }
+
+    if (client.output.empty())
+    {
+        client.dropping = false;
+
+        if (client.closeWhenWritten)
+            return false;
+    }
+
+    /* A client that closed without ever sending a request is done with. */
+    if (client.peerClosed && !client.handled)
+        return false;
+
+    /* Only wait for output to drain while there is some, and stop reading once the peer can't
+     * send anything more or the level triggered EPOLLIN would never stop firing. */
+    uint32_t events = 0;
+    if (!client.peerClosed)
+        events |= EPOLLIN | EPOLLRDHUP;
+    if (!client.output.empty())
+        events |= EPOLLOUT;
+
+    if (events != client.events)
+    {
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = client.id;
+        epoll_ctl(mEpollFd, EPOLL_CTL_MOD, client.fd, &event);
+        client.events = events;
+    }
+
+    return true;
+}
+
+void APIController::closeClient(uint64_t id)
+{
+    auto it = mClients.find(id);
+    if (it == mClients.end())
+        return;
+
+    /* Closing the descriptor also takes it out of the epoll set. */
+    close(it->second.fd);
+    mPartialRequests.erase(id);
+    mStreams.erase(id);
+    mClients.erase(it);
+}
+
+int APIController::expireRequests()
+{
+    if (mPartialRequests.empty())
+        return -1;
+
+    const auto now = std::chrono::steady_clock::now();
+    auto next = std::chrono::steady_clock::time_point::max();
+
+    std::vector<uint64_t> expired;
+    for (uint64_t id : mPartialRequests)
+    {
+        const auto deadline = mClients[id].lastRead + REQUEST_TIMEOUT;
+        if (deadline <= now)
+            expired.push_back(id);
+        else
+            next = std::min(next, deadline);
+    }
+
+    for (uint64_t id : expired)
+    {
+        mPartialRequests.erase(id);
+
+        Client& client = mClients[id];
+        client.handled = true;
+        this->handleRequest(client);
+
+        if (!this->service(client))
+            this->closeClient(id);
+    }
+
+    if (mPartialRequests.empty())
+        return -1;
+
+    /* Rounded up so the loop doesn't wake just before the deadline. */
+    return std::chrono::ceil<std::chrono::milliseconds>(next - now).count();
+}
+
+void APIController::handleRequest(Client& client)
+{
+    std::vector<std::string> request = util::split(util::trim(client.request));
+    client.request.clear();
+
+    /* A request may start with the encoding the client wants its responses in. */
+    if (!request.empty() && request[0].rfind("encoding=", 0) == 0)
+    {
+        const std::string name = request[0].substr(9);
+        if (!parseEncoding(name, client.encoding))
+        {
+            this->respondError(client, "Unknown encoding \"" + name +
+                                           "\", expected json, cbor or msgpack.");
+            return;
+        }
+
+        request.erase(request.begin());
+    }
+
+    const std::string cmd = request.empty() ? "" : util::trim(request[0]);
+
+    /* Handle API requests.
+     * API Handlers are responsible for responding to the requester, the loop closes the socket
+     * once the response is written. */
+    if (cmd == "live-text")
+    {
+        this->liveText(client, {request.begin() + 1, request.end()});
+    }
+    else if (cmd == "live")
+    {
+        this->live(client, {request.begin() + 1, request.end()});
+    }
+    else if (cmd == "snapshot")
+    {
+        this->snapshot(client);
+    }
+    else if (cmd == "capture-stats")
+    {
+        this->captureStats(client);
+    }
+    else if (cmd == "cache-stats")
+    {
+        this->cacheStats(client);
+    }
+    else if (cmd == "traffic-daily")
+    {
+        this->trafficDaily(client);
+    }
+    else if (cmd == "traffic-since")
+    {
+        if (request.size() >= 2)
+        {
+            /* Expected Parameters: time_t ts */
+            time_t ts;
+
+            try
             {
-                this->snapshot(newSocket);
+                ts = std::stoi(request[1]);
             }
-            else if (cmd == "traffic-daily")
+            catch (const std::invalid_argument& ia)
             {
-                this->trafficDaily(newSocket);
+                this->respondError(client, "Invalid timestamp parameter for traffic-since.");
+                return;
             }
-            else if (cmd == "traffic-since")
+            catch (const std::out_of_range& oor)
             {
-                if (request.size() >= 2)
-                {
-                    /* Expected Parameters: time_t ts */
-                    time_t ts;
-
-                    try
-                    {
-                        ts = std::stoi(request[1]);
-                    }
-                    catch (const std::invalid_argument& ia)
-                    {
-                        json err;
-                        err["result"] = "error";
-                        err["errmsg"] = "Invalid timestamp parameter for traffic-since.";
-                        std::string msg = err.dump();
-
-                        send(newSocket, msg.c_str(), msg.size(), 0);
-                        close(newSocket);
-                        continue;
-                    }
-                    catch (const std::out_of_range& oor)
-                    {
-                        json err;
-                        err["result"] = "error";
-                        err["errmsg"] = "Timestamp parameter value too large for traffic-since.";
-                        std::string msg = err.dump();
-
-                        send(newSocket, msg.c_str(), msg.size(), 0);
-                        close(newSocket);
-                        continue;
-                    }
-
-                    this->trafficSince(newSocket, ts);
-                }
-                else
-                {
-                    json err;
-                    err["result"] = "error";
-                    err["errmsg"] = "Missing timestamp parameter for traffic-since.";
-                    std::string msg = err.dump();
+                this->respondError(client,
+                                   "Timestamp parameter value too large for traffic-since.");
+                return;
+            }
 
-                    send(newSocket, msg.c_str(), msg.size(), 0);
-                    close(newSocket);
-                }
+            this->trafficSince(client, ts);
+        }
+        else
+        {
+            this->respondError(client, "Missing timestamp parameter for traffic-since.");
+        }
+    }
+    else if (cmd == "traffic-between")
+    {
+        if (request.size() >= 3)
+        {
+            /* Expected Parameters: time_t start, end */
+            time_t start, end;
+
+            try
+            {
+                start = std::stoi(request[1]);
+                end = std::stoi(request[2]);
             }
-            else if (cmd == "traffic-between")
+            catch (const std::invalid_argument& ia)
             {
-                if (request.size() >= 3)
-                {
-                    /* Expected Parameters: time_t start, end */
-                    time_t start, end;
-
-                    try
-                    {
-                        start = std::stoi(request[1]);
-                        end = std::stoi(request[2]);
-                    }
-                    catch (const std::invalid_argument& ia)
-                    {
-                        json err;
-                        err["result"] = "error";
-                        err["errmsg"] = "Invalid timestamp parameter(s) for traffic-between.";
-                        std::string msg = err.dump();
-
-                        send(newSocket, msg.c_str(), msg.size(), 0);
-                        close(newSocket);
-                        continue;
-                    }
-                    catch (const std::out_of_range& oor)
-                    {
-                        json err;
-                        err["result"] = "error";
-                        err["errmsg"] =
-                            "Timestamp parameter value(s) too large for traffic-between.";
-                        std::string msg = err.dump();
-
-                        send(newSocket, msg.c_str(), msg.size(), 0);
-                        close(newSocket);
-                        continue;
-                    }
-
-                    this->trafficBetween(newSocket, start, end);
-                }
-                else
-                {
-                    json err;
-                    err["result"] = "error";
-                    err["errmsg"] = "Missing timestamp parameter(s) for traffic-between.";
-                    std::string msg = err.dump();
-
-                    send(newSocket, msg.c_str(), msg.size(), 0);
-                    close(newSocket);
-                }
+                this->respondError(client, "Invalid timestamp parameter(s) for traffic-between.");
+                return;
             }
-            else
+            catch (const std::out_of_range& oor)
             {
-                json err;
-                err["result"] = "error";
-                err["errmsg"] = "Unknown command.";
-                std::string msg = err.dump();
-
-                send(newSocket, msg.c_str(), msg.size(), 0);
-                close(newSocket);
+                this->respondError(client,
+                                   "Timestamp parameter value(s) too large for traffic-between.");
+                return;
             }
+
+            this->trafficBetween(client, start, end);
         }
+        else
+        {
+            this->respondError(client, "Missing timestamp parameter(s) for traffic-between.");
+        }
+    }
+    else
+    {
+        this->respondError(client, "Unknown command.");
+    }
+}
 
-        shutdown(serverFd, SHUT_RDWR);
-    });
-    loop.detach();
+void APIController::respond(Client& client, std::string msg)
+{
+    this->respond(client, std::make_shared<const std::string>(std::move(msg)));
 }
 
-void APIController::liveText(int socketfd)
+void APIController::respond(Client& client, std::shared_ptr<const std::string> msg)
 {
-    std::thread updates([this, socketfd] {
-        const char* welcomeMsg =
-            "Connected to ntmd live traffic update stream, awaiting first traffic interval.\n";
+    client.output.push_back(std::move(msg));
+    client.closeWhenWritten = true;
+}
 
-        /* If remote peer closes connection, return. */
-        if (send(socketfd, welcomeMsg, strlen(welcomeMsg), MSG_NOSIGNAL) < 0)
-        {
-            return;
-        }
+void APIController::respondError(Client& client, const std::string& errmsg)
+{
+    json err;
+    err["result"] = "error";
+    err["errmsg"] = errmsg;
+
+    this->respond(client, encode(err, client.encoding));
+}
 
-        while (true)
+void APIController::wake()
+{
+    const uint64_t one = 1;
+    if (write(mWakeFd, &one, sizeof(one)) < 0)
+    {
+        /* The counter is only full if the loop already has plenty of wakeups waiting. */
+    }
+}
+
+void APIController::drainHandoffs()
+{
+    std::vector<Completion> completions;
+    std::deque<std::shared_ptr<const TrafficInterval>> liveTraffic;
+    {
+        std::unique_lock<std::mutex> lock(mHandoffMutex);
+        completions.swap(mCompletions);
+        liveTraffic.swap(mLiveTraffic);
+    }
+
+    for (Completion& completion : completions)
+    {
+        /* The client may have given up on the query. */
+        auto it = mClients.find(completion.client);
+        if (it == mClients.end())
+            continue;
+
+        Client& client = it->second;
+        client.querying = false;
+        this->respond(client, std::move(completion.response));
+
+        if (!this->service(client))
+            this->closeClient(completion.client);
+    }
+
+    for (const auto& interval : liveTraffic)
+    {
+        this->publishLive(*interval);
+    }
+}
+
+void APIController::publishLive(const TrafficInterval& deposited)
+{
+    if (mStreams.empty())
+        return;
+
+    const int interval = mTrafficStorage.interval();
+
+    /* Messages of streams that aren't in delta mode, by format, encoding and filter. Serialized
+     * the first time a stream needs one, every other stream asking for the same gets it too. */
+    std::unordered_map<std::string, std::shared_ptr<const std::string>> shared;
+
+    std::vector<uint64_t> closed;
+    for (uint64_t id : mStreams)
+    {
+        Client& client = mClients[id];
+        const LiveFilter& filter = client.filter;
+
+        TrafficMap selected;
+        const TrafficMap* view = &deposited.traffic;
+
+        if (!filter.delta())
         {
-            TrafficMap trafficMap;
-            int interval;
-            std::mutex await;
-
-            /* Send pointers to our trafficMap and interval variables to the traffic storage so that
-             * it can set them with the updated values at the proper time. This will also lock the
-             * mutex sent in. */
-            if (!mTrafficStorage.awaitSnapshot(await, trafficMap, interval))
+            const std::string format =
+                client.stream == Stream::Json ? encodingName(client.encoding) : "text";
+            const std::string key = format + ":" + filter.key();
+
+            std::shared_ptr<const std::string>& msg = shared[key];
+            if (!msg)
             {
-                const char* msg = "Only one live API stream at a time is currently supported.";
-                send(socketfd, msg, strlen(msg), MSG_NOSIGNAL);
-                break;
-            }
+                if (!filter.selectsAll())
+                {
+                    selected = filter.select(deposited.traffic);
+                    view = &selected;
+                }
 
-            /* Wait until the traffic storage has set our variables and unlocked the mutex. */
-            await.lock();
+                msg = this->liveMessage(client.stream, client.encoding, *view, interval, false,
+                                        false);
+            }
 
-            std::stringstream ss;
-            ss << "Application Traffic:\n";
-            for (const auto& [name, line] : trafficMap)
+            this->queueLive(client, msg);
+        }
+        else
+        {
+            if (!filter.selectsAll())
             {
-                ss << "  ";
-                ss << name << " { rx: " << util::bytesToHumanOvertime(line.bytesRx, interval)
-                   << ", tx: " << util::bytesToHumanOvertime(line.bytesTx, interval)
-                   << ", rxc: " << line.pktRxCount << ", txc: " << line.pktTxCount << " }\n";
+                selected = filter.select(deposited.traffic);
+                view = &selected;
             }
 
-            std::string msg = ss.str();
+            /* Once a message is dropped the client can't keep track of the changes, so every
+             * message is sent whole while it is behind. */
+            const bool full = client.resync || client.output.size() >= MAX_STREAM_BACKLOG;
+            if (full)
+                client.lastSent.clear();
+            client.resync = false;
 
-            /* If remote peer closes connection, break. */
-            if (send(socketfd, msg.c_str(), msg.size(), MSG_NOSIGNAL) < 0)
-            {
-                break;
-            }
+            const TrafficMap changed = LiveFilter::changes(*view, client.lastSent);
+            this->queueLive(client, this->liveMessage(client.stream, client.encoding, changed,
+                                                      interval, true, full));
         }
-        close(socketfd);
-    });
-    updates.detach();
+
+        if (!this->service(client))
+            closed.push_back(id);
+    }
+
+    for (uint64_t id : closed)
+    {
+        this->closeClient(id);
+    }
 }
 
-void APIController::live(int socketfd)
+std::shared_ptr<const std::string> APIController::liveMessage(Stream stream, Encoding encoding,
+                                                              const TrafficMap& traffic,
+                                                              int interval, bool delta, bool full)
 {
-    std::thread updates([this, socketfd] {
-        while (true)
+    if (stream == Stream::Json)
+    {
+        mWriteBuffer.clear();
+
+        ResponseWriter writer(mWriteBuffer, encoding);
+        writer.beginObject(delta ? 6 : 4);
+        writer.traffic(traffic);
+
+        if (delta)
         {
-            TrafficMap trafficMap;
-            int interval;
-            std::mutex await;
-
-            /* Send pointers to our trafficMap and interval variables to the traffic storage so that
-             * it can set them with the updated values at the proper time. This will also lock the
-             * mutex sent in. */
-            if (!mTrafficStorage.awaitSnapshot(await, trafficMap, interval))
-            {
-                json err;
-                err["result"] = "error";
-                err["errmsg"] = "Only one live API stream at a time is currently supported.";
-                std::string msg = err.dump();
+            writer.key("delta");
+            writer.boolean(true);
+            writer.key("full");
+            writer.boolean(full);
+        }
 
-                send(socketfd, msg.c_str(), msg.size(), 0);
-                break;
-            }
+        writer.key("interval");
+        writer.number(interval);
+        writer.key("result");
+        writer.string("success");
+        writer.endObject();
 
-            /* Wait until the traffic storage has set our variables and unlocked the mutex. */
-            await.lock();
+        return takeResponse(mWriteBuffer);
+    }
 
-            json payload = trafficToJson(trafficMap);
-            payload["interval"] = interval;
-            payload["result"] = "success";
+    std::stringstream ss;
+    ss << "Application Traffic:\n";
+    for (const auto& [name, line] : traffic)
+    {
+        ss << "  ";
+        ss << name << " { rx: " << util::bytesToHumanOvertime(line.bytesRx, interval)
+           << ", tx: " << util::bytesToHumanOvertime(line.bytesTx, interval)
+           << ", rxc: " << line.pktRxCount << ", txc: " << line.pktTxCount << " }\n";
+    }
 
-            std::string msg = payload.dump();
+    return std::make_shared<const std::string>(ss.str());
+}
 
-            /* If remote peer closes connection, break. */
-            if (send(socketfd, msg.c_str(), msg.size(), MSG_NOSIGNAL) < 0)
-            {
-                break;
-            }
+void APIController::queueLive(Client& client, const std::shared_ptr<const std::string>& msg)
+{
+    if (client.output.size() >= MAX_STREAM_BACKLOG)
+    {
+        if (!client.dropping)
+        {
+            std::cerr << ntmd::logwarn << "A live API client has fallen " << MAX_STREAM_BACKLOG
+                      << " intervals behind, dropping its oldest intervals until it catches "
+                         "up.\n";
+            client.dropping = true;
         }
-        close(socketfd);
-    });
-    updates.detach();
+
+        /* A message that is partly written has to be finished or the stream would be cut off
+         * in the middle of it. */
+        client.output.erase(client.output.begin() + (client.written > 0 ? 1 : 0));
+    }
+
+    client.output.push_back(msg);
+}
+
+void APIController::liveText(Client& client, const std::vector<std::string>& options)
+{
+    if (client.encoding != Encoding::Json)
+    {
+        this->respondError(client, "live-text is only sent as text, use live for binary "
+                                   "encodings.");
+        return;
+    }
+
+    std::string errmsg;
+    if (!client.filter.parse(options, errmsg))
+    {
+        this->respondError(client, errmsg);
+        return;
+    }
+
+    static const auto welcome = std::make_shared<const std::string>(
+        "Connected to ntmd live traffic update stream, awaiting first traffic interval.\n");
+    client.output.push_back(welcome);
+
+    client.stream = Stream::Text;
+    mStreams.insert(client.id);
+}
+
+void APIController::live(Client& client, const std::vector<std::string>& options)
+{
+    std::string errmsg;
+    if (!client.filter.parse(options, errmsg))
+    {
+        this->respondError(client, errmsg);
+        return;
+    }
+
+    client.stream = Stream::Json;
+    mStreams.insert(client.id);
 }
 
-void APIController::snapshot(int socketfd)
+void APIController::snapshot(Client& client)
 {
     auto trafficSnapshot = mTrafficStorage.getLiveSnapshot();
 
     const TrafficMap& trafficMap = trafficSnapshot.first;
     const int& interval = trafficSnapshot.second;
 
-    json payload = trafficToJson(trafficMap);
-    payload["interval"] = interval;
-    payload["result"] = "success";
-
-    std::string msg = payload.dump();
+    mWriteBuffer.clear();
 
-    send(socketfd, msg.c_str(), msg.size(), MSG_NOSIGNAL);
+    ResponseWriter writer(mWriteBuffer, client.encoding);
+    writer.beginObject(4);
+    writer.traffic(trafficMap);
+    writer.key("interval");
+    writer.number(interval);
+    writer.key("result");
+    writer.string("success");
+    writer.endObject();
 
-    close(socketfd);
+    this->respond(client, takeResponse(mWriteBuffer));
 }
 
-void APIController::trafficDaily(int socketfd)
+void APIController::trafficDaily(Client& client)
 {
     time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
 
@@ -352,62 +820,107 @@ void APIController::trafficDaily(int socketfd)
 
     time_t startOfCurrentDay = std::mktime(day);
 
-    auto trafficMap = mDB.fetchTrafficSince(startOfCurrentDay);
-
-    json payload = trafficToJson(trafficMap);
-    payload["result"] = "success";
-
-    std::string msg = payload.dump();
-
-    send(socketfd, msg.c_str(), msg.size(), MSG_NOSIGNAL);
+    this->sendTraffic(client, startOfCurrentDay, std::numeric_limits<time_t>::max());
+}
 
-    close(socketfd);
+void APIController::trafficSince(Client& client, time_t ts)
+{
+    this->sendTraffic(client, ts, std::numeric_limits<time_t>::max());
 }
 
-void APIController::trafficSince(int socketfd, time_t ts)
+void APIController::trafficBetween(Client& client, time_t start, time_t end)
 {
-    auto trafficMap = mDB.fetchTrafficSince(ts);
+    this->sendTraffic(client, start, end);
+}
 
-    json payload = trafficToJson(trafficMap);
-    payload["result"] = "success";
+void APIController::captureStats(Client& client)
+{
+    const CaptureStats stats = mSniffer.stats();
 
-    std::string msg = payload.dump();
+    json payload;
+    payload["data"] = {
+        {"backend", stats.backend},
+        {"workers", stats.workers},
+        {"filterAccepted", stats.filterAccepted},
+        {"filterRejected", stats.filterRejected},
+        {"kernelDropped", stats.kernelDropped},
+        {"interfaceDropped", stats.interfaceDropped},
+        {"bufferSize", stats.bufferSize},
+    };
+
+    for (const InterfaceStats& iface : stats.interfaces)
+    {
+        payload["data"]["interfaces"][iface.name] = {
+            {"filterAccepted", iface.filterAccepted},
+            {"filterRejected", iface.filterRejected},
+            {"kernelDropped", iface.kernelDropped},
+            {"interfaceDropped", iface.interfaceDropped},
+            {"bufferSize", iface.bufferSize},
+        };
+    }
 
-    send(socketfd, msg.c_str(), msg.size(), MSG_NOSIGNAL);
+    payload["result"] = "success";
 
-    close(socketfd);
+    this->respond(client, encode(payload, client.encoding));
 }
 
-void APIController::trafficBetween(int socketfd, time_t start, time_t end)
+void APIController::cacheStats(Client& client)
 {
-    auto trafficMap = mDB.fetchTrafficBetween(start, end);
+    const ResponseCacheStats stats = mResponseCache.stats();
 
-    json payload = trafficToJson(trafficMap);
-    payload["result"] = "success";
-
-    std::string msg = payload.dump();
+    json payload;
+    payload["data"] = {
+        {"hits", stats.hits},
+        {"misses", stats.misses},
+        {"updates", stats.updates},
+        {"evictions", stats.evictions},
+        {"entries", stats.entries},
+    };
 
-    send(socketfd, msg.c_str(), msg.size(), MSG_NOSIGNAL);
+    payload["result"] = "success";
 
-    close(socketfd);
+    this->respond(client, encode(payload, client.encoding));
 }
 
-json APIController::trafficToJson(const TrafficMap& traffic)
+void APIController::sendTraffic(Client& client, time_t start, time_t end)
 {
-    json payload;
+    /* Polled ranges are usually cached, those never have to wait behind slow queries. Ranges
+     * that have to be serialized again after a deposit are left to a worker like any other. */
+    std::shared_ptr<const std::string> response;
+    if (mResponseCache.lookup(start, end, client.encoding, response))
+    {
+        this->respond(client, std::move(response));
+        return;
+    }
 
-    payload["length"] = traffic.size();
-    for (const auto& [name, line] : traffic)
+    const uint64_t id = client.id;
+    const Encoding encoding = client.encoding;
+    const bool posted = mWorkers.post([this, id, start, end, encoding] {
+        std::shared_ptr<const std::string> response = mResponseCache.fetch(start, end, encoding);
+        {
+            std::unique_lock<std::mutex> lock(mHandoffMutex);
+            mCompletions.push_back({id, std::move(response)});
+        }
+        this->wake();
+    });
+
+    if (!posted)
     {
-        payload["data"][name] = {
-            {"bytesRx", line.bytesRx},
-            {"bytesTx", line.bytesTx},
-            {"pktRxCount", line.pktRxCount},
-            {"pktTxCount", line.pktTxCount},
-        };
+        this->respondError(client, "Too many queries in progress, try again later.");
+        return;
     }
 
-    return payload;
+    client.querying = true;
+}
+
+std::shared_ptr<const std::string> APIController::takeResponse(std::string& buffer)
+{
+    auto response = std::make_shared<const std::string>(buffer);
+
+    if (buffer.capacity() > MAX_RETAINED_BUFFER)
+        std::string().swap(buffer);
+
+    return response;
 }
 
 } // namespace ntmd
\ No newline at end of file
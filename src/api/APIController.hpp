@@ -1,43 +1,226 @@
 #pragma once
 
+#include "Encoding.hpp"
+#include "LiveFilter.hpp"
+#include "ResponseCache.hpp"
+#include "ResponseWriter.hpp"
+#include "net/Sniffer.hpp"
 #include "traffic/DBController.hpp"
 #include "traffic/TrafficStorage.hpp"
+#include "util/WorkerPool.hpp"
 
 #include <nlohmann/json.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 using json = nlohmann::json;
 
 namespace ntmd {
 
+/* Socket API server. A single thread runs an epoll loop that owns every client socket, reading
+ * requests as they arrive and writing responses as fast as each client takes them, so a slow
+ * client never holds up the others. Commands answered from memory are handled by the loop itself,
+ * queries that may have to read the database are handed to a pool of worker threads and their
+ * responses passed back to the loop to be written. */
 class APIController
 {
     using TrafficMap = std::unordered_map<std::string, TrafficLine>;
 
   public:
-    APIController(TrafficStorage& trafficStorage, const DBController& db, uint16_t port);
-    ~APIController() = default;
+    /* Starts the server on its own thread, with the given number of threads for database
+     * queries. */
+    APIController(TrafficStorage& trafficStorage, const DBController& db, const Sniffer& sniffer,
+                  uint16_t port, int workers = 4);
+
+    /* Stops the server and closes every client. */
+    ~APIController();
 
   private:
-    /* Spawns a new thread to wait for and handle incoming socket API requests. */
+    /* Requests are a single line, a client sending more than this without one is refused. */
+    static constexpr std::size_t MAX_REQUEST_SIZE = 1024;
+
+    /* A request that doesn't end in a newline is handled once nothing more has arrived for this
+     * long, for clients that send the bare command. */
+    static constexpr std::chrono::milliseconds REQUEST_TIMEOUT{100};
+
+    /* Queries waiting for a worker before new ones are turned away. */
+    static constexpr std::size_t MAX_QUEUED_QUERIES = 256;
+
+    /* Messages a live stream can fall behind by. Once a client has this many waiting to be
+     * written the oldest is dropped for every new interval. */
+    static constexpr std::size_t MAX_STREAM_BACKLOG = 32;
+
+    /* Most messages handed to a single sendmsg. */
+    static constexpr int MAX_WRITE_MESSAGES = 16;
+
+    /* Most traffic range responses kept by mResponseCache. */
+    static constexpr std::size_t RESPONSE_CACHE_ENTRIES = 64;
+
+    /* Largest buffer kept for writing the next response once a response has been written. */
+    static constexpr std::size_t MAX_RETAINED_BUFFER = 1 << 20;
+
+    /* epoll data of the listening socket and mWakeFd, client ids start after them. */
+    static constexpr uint64_t LISTENER_ID = 0;
+    static constexpr uint64_t WAKE_ID = 1;
+
+    enum class Stream
+    {
+        None,
+        Json, /* live */
+        Text, /* live-text */
+    };
+
+    struct Client
+    {
+        uint64_t id;
+        int fd;
+
+        /* Bytes of the request read so far and when the last of them arrived. */
+        std::string request;
+        std::chrono::steady_clock::time_point lastRead;
+
+        bool handled{false};    /* The request was dispatched, anything else sent is ignored. */
+        bool querying{false};   /* A worker is answering the request. */
+        bool peerClosed{false}; /* The client shut down its side, nothing more can be read. */
+        bool closeWhenWritten{false};
+        Stream stream{Stream::None};
+        Encoding encoding{Encoding::Json}; /* Of every response sent to the client. */
+
+        /* Messages not fully written to the socket yet, the first from written on. Live intervals
+         * are shared between every stream they are sent to. */
+        std::deque<std::shared_ptr<const std::string>> output;
+        std::size_t written{0};
+        bool dropping{false}; /* A live stream has fallen MAX_STREAM_BACKLOG behind. */
+
+        /* Options of a live stream. In delta mode lastSent is what the client was last told
+         * about each application, and resync has the next message sent whole. */
+        LiveFilter filter;
+        TrafficMap lastSent;
+        bool resync{true};
+
+        uint32_t events{0}; /* Currently registered with epoll. */
+    };
+
+    /* Response to a query, finished by a worker. */
+    struct Completion
+    {
+        uint64_t client;
+        std::shared_ptr<const std::string> response;
+    };
+
+    /* Binds the server's socket and starts the event loop. */
     void startSocketServer();
 
+    /* Event loop, runs until the controller is destroyed. */
+    void run();
+
+    void acceptClients();
+
+    /* Read whatever the client has sent, handling its request once the whole line is in. */
+    void readClient(Client& client);
+
+    /* Write as much pending output as the socket takes and update the events the client is
+     * watched for. Returns false if the client is done with or gone and should be closed. */
+    bool service(Client& client);
+
+    void closeClient(uint64_t id);
+
+    /* Handle requests without a trailing newline that have waited out REQUEST_TIMEOUT. Returns
+     * the milliseconds until the next one would, or -1 if there are none. */
+    int expireRequests();
+
+    /* Parse the client's request and dispatch it to its command. */
+    void handleRequest(Client& client);
+
+    /* Queue a response, closing the client once it is written. */
+    void respond(Client& client, std::string msg);
+    void respond(Client& client, std::shared_ptr<const std::string> msg);
+    void respondError(Client& client, const std::string& errmsg);
+
+    /* Interrupt epoll_wait, called from other threads once they have something for the loop. */
+    void wake();
+
+    /* Write finished queries and live traffic handed over by other threads to their clients. */
+    void drainHandoffs();
+
+    /* Send an interval of deposited traffic to every live stream. Each format is only serialized
+     * once, every stream gets the same message. */
+    void publishLive(const TrafficInterval& interval);
+
+    /* A live interval of traffic in the stream's format. Delta messages say so and whether they
+     * hold every application the client selected or only the changes. */
+    std::shared_ptr<const std::string> liveMessage(Stream stream, Encoding encoding,
+                                                   const TrafficMap& traffic, int interval,
+                                                   bool delta, bool full);
+
+    /* Queue a live message, dropping the oldest one that hasn't started to be written if the
+     * client is too far behind. */
+    void queueLive(Client& client, const std::shared_ptr<const std::string>& msg);
+
     /* API Commands */
-    void liveText(int socketfd);
-    void live(int socketfd);
-    void snapshot(int socketfd);
+    void liveText(Client& client, const std::vector<std::string>& options);
+    void live(Client& client, const std::vector<std::string>& options);
+    void snapshot(Client& client);
 
-    void trafficDaily(int socketfd);
-    void trafficSince(int socketfd, time_t ts);
-    void trafficBetween(int socketfd, time_t start, time_t end);
+    void trafficDaily(Client& client);
+    void trafficSince(Client& client, time_t ts);
+    void trafficBetween(Client& client, time_t start, time_t end);
+
+    void captureStats(Client& client);
+    void cacheStats(Client& client);
 
     /* Helpers */
-    json trafficToJson(const TrafficMap& traffic);
+
+    /* A response written into a reusable buffer, copied out at its exact size. The buffer's
+     * memory is let go of if a large response grew it past MAX_RETAINED_BUFFER. */
+    static std::shared_ptr<const std::string> takeResponse(std::string& buffer);
+
+    /* Have a worker fetch the traffic between two timestamps (inclusive) from the response cache
+     * and send it to the client. */
+    void sendTraffic(Client& client, time_t start, time_t end);
 
     TrafficStorage& mTrafficStorage;
     const DBController& mDB;
+    const Sniffer& mSniffer;
     uint16_t mPort{13889};
+
+    /* Responses of traffic-daily, traffic-since and traffic-between, which clients tend to poll. */
+    ResponseCache mResponseCache;
+
+    int mServerFd{-1};
+    int mEpollFd{-1};
+    int mWakeFd{-1}; /* eventfd written to by wake. */
+
+    /* Only touched by the event loop. */
+    std::unordered_map<uint64_t, Client> mClients;
+    std::string mWriteBuffer; /* Reused for every response the loop writes itself. */
+    std::unordered_set<uint64_t> mPartialRequests; /* Clients with part of a request read. */
+    std::unordered_set<uint64_t> mStreams;         /* Clients receiving live or live-text. */
+    uint64_t mNextClient{WAKE_ID + 1};
+
+    /* Handed to the event loop by the workers and the deposit listener. */
+    std::mutex mHandoffMutex;
+    std::vector<Completion> mCompletions;
+    std::deque<std::shared_ptr<const TrafficInterval>> mLiveTraffic;
+
+    int mDepositListener{-1};
+
+    std::atomic<bool> mRunning{true};
+    std::thread mLoop;
+
+    WorkerPool mWorkers;
 };
 
-} // namespace ntmd
\ No newline at end of file
+} // namespace ntmd
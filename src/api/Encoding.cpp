@@ -0,0 +1,69 @@
+#include "Encoding.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <string>
+
+namespace ntmd {
+
+bool parseEncoding(const std::string& name, Encoding& encoding)
+{
+    if (name == "json")
+        encoding = Encoding::Json;
+    else if (name == "cbor")
+        encoding = Encoding::Cbor;
+    else if (name == "msgpack")
+        encoding = Encoding::MessagePack;
+    else
+        return false;
+
+    return true;
+}
+
+const char* encodingName(Encoding encoding)
+{
+    switch (encoding)
+    {
+    case Encoding::Cbor:
+        return "cbor";
+    case Encoding::MessagePack:
+        return "msgpack";
+    default:
+        return "json";
+    }
+}
+
+std::string encode(const json& payload, Encoding encoding)
+{
+    std::string out;
+
+    switch (encoding)
+    {
+    case Encoding::Cbor:
+        json::to_cbor(payload, out);
+        break;
+    case Encoding::MessagePack:
+        json::to_msgpack(payload, out);
+        break;
+    default:
+        out = payload.dump();
+        break;
+    }
+
+    return out;
+}
+
+json decode(const std::string& response, Encoding encoding)
+{
+    switch (encoding)
+    {
+    case Encoding::Cbor:
+        return json::from_cbor(response);
+    case Encoding::MessagePack:
+        return json::from_msgpack(response);
+    default:
+        return json::parse(response);
+    }
+}
+
+} // namespace ntmd
\ No newline at end of file
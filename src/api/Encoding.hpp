@@ -0,0 +1,34 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <cstddef>
+#include <string>
+
+using json = nlohmann::json;
+
+namespace ntmd {
+
+/* Encodings a client can ask for its responses in. The binary encodings are self delimiting, so
+ * the messages of a live stream can be decoded one after another straight off the socket. */
+enum class Encoding
+{
+    Json,
+    Cbor,
+    MessagePack,
+};
+
+constexpr std::size_t ENCODING_COUNT = 3;
+
+/* Parse the name of an encoding ("json", "cbor" or "msgpack"), returns false if it is unknown. */
+bool parseEncoding(const std::string& name, Encoding& encoding);
+
+const char* encodingName(Encoding encoding);
+
+/* Serialize a response in the given encoding. */
+std::string encode(const json& payload, Encoding encoding);
+
+/* Parse a response serialized by encode, throws json::parse_error if it is malformed. */
+json decode(const std::string& response, Encoding encoding);
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include "LiveFilter.hpp"
+
+#include "util/StringUtil.hpp"
+
+#include <fnmatch.h>
+#include <stdexcept>
+#include <string>
+
+namespace ntmd {
+
+using TrafficMap = std::unordered_map<std::string, TrafficLine>;
+
+bool LiveFilter::parse(const std::vector<std::string>& options, std::string& errmsg)
+{
+    for (const std::string& option : options)
+    {
+        if (option.empty())
+            continue;
+
+        if (option == "delta")
+        {
+            mDelta = true;
+        }
+        else if (option.rfind("apps=", 0) == 0)
+        {
+            for (const std::string& pattern : util::split(option.substr(5), ','))
+            {
+                if (!pattern.empty())
+                    mPatterns.push_back(pattern);
+            }
+        }
+        else if (option.rfind("minbytes=", 0) == 0)
+        {
+            const std::string value = option.substr(9);
+            if (!util::isNumber(value))
+            {
+                errmsg = "Invalid minbytes value \"" + value + "\", expected a number of bytes.";
+                return false;
+            }
+
+            try
+            {
+                mMinBytes = std::stoull(value);
+            }
+            catch (const std::out_of_range& oor)
+            {
+                errmsg = "minbytes value \"" + value + "\" is too large.";
+                return false;
+            }
+        }
+        else
+        {
+            errmsg = "Unknown live option \"" + option + "\".";
+            return false;
+        }
+    }
+
+    mKey = std::to_string(mMinBytes);
+    for (const std::string& pattern : mPatterns)
+    {
+        mKey += "," + pattern;
+    }
+
+    return true;
+}
+
+TrafficMap LiveFilter::select(const TrafficMap& traffic) const
+{
+    TrafficMap selected;
+    for (const auto& [name, line] : traffic)
+    {
+        if (this->matches(name, line))
+            selected.emplace(name, line);
+    }
+
+    return selected;
+}
+
+TrafficMap LiveFilter::changes(const TrafficMap& view, TrafficMap& previous)
+{
+    TrafficMap changed;
+    for (const auto& [name, line] : view)
+    {
+        auto it = previous.find(name);
+        if (it == previous.end() || it->second != line)
+            changed.emplace(name, line);
+    }
+
+    for (const auto& [name, line] : previous)
+    {
+        if (view.count(name) == 0)
+            changed.emplace(name, TrafficLine());
+    }
+
+    previous = view;
+    return changed;
+}
+
+bool LiveFilter::matches(const std::string& name, const TrafficLine& line) const
+{
+    if (line.bytesRx + line.bytesTx < mMinBytes)
+        return false;
+
+    if (mPatterns.empty())
+        return true;
+
+    for (const std::string& pattern : mPatterns)
+    {
+        if (fnmatch(pattern.c_str(), name.c_str(), 0) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "traffic/TrafficStore.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ntmd {
+
+/* Options a live or live-text client can give after the command, evaluated for every interval
+ * before it is serialized so nothing the client doesn't want is ever sent:
+ *   delta           Only send the applications whose traffic differs from the last interval sent.
+ *   apps=a,b*,...   Only applications matching one of the comma separated glob patterns.
+ *   minbytes=n      Only applications that received and transmitted n bytes or more together. */
+class LiveFilter
+{
+    using TrafficMap = std::unordered_map<std::string, TrafficLine>;
+
+  public:
+    /* Returns false and sets errmsg if an option is unknown or malformed. */
+    bool parse(const std::vector<std::string>& options, std::string& errmsg);
+
+    /* True if select would keep every application. */
+    bool selectsAll() const { return mPatterns.empty() && mMinBytes == 0; }
+
+    bool delta() const { return mDelta; }
+
+    /* Equal for filters that select the same applications, so streams can share a message. */
+    const std::string& key() const { return mKey; }
+
+    /* The applications of an interval that pass the filter. */
+    TrafficMap select(const TrafficMap& traffic) const;
+
+    /* Applications of view whose traffic differs from previous, plus an empty line for every
+     * application of previous that is no longer in view. previous is then set to view. */
+    static TrafficMap changes(const TrafficMap& view, TrafficMap& previous);
+
+  private:
+    bool matches(const std::string& name, const TrafficLine& line) const;
+
+    bool mDelta{false};
+    std::vector<std::string> mPatterns;
+    uint64_t mMinBytes{0};
+
+    std::string mKey;
+};
+
+} // namespace ntmd
\ No newline at end of file
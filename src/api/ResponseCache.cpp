@@ -0,0 +1,173 @@
+#include "ResponseCache.hpp"
+
+#include "traffic/TrafficStorage.hpp"
+
+#include <limits>
+#include <memory>
+#include <mutex>
+
+namespace ntmd {
+
+ResponseCache::ResponseCache(TrafficStorage& trafficStorage, Serializer serialize,
+                             std::size_t maxEntries) :
+    mTrafficStorage(trafficStorage),
+    mSerialize(std::move(serialize)), mMaxEntries(maxEntries)
+{
+    mListener = mTrafficStorage.addDepositListener(
+        [this](const std::shared_ptr<const TrafficInterval>& interval) {
+            this->deposited(*interval);
+        });
+}
+
+ResponseCache::~ResponseCache()
+{
+    mTrafficStorage.removeDepositListener(mListener);
+}
+
+ResponseCache::Response ResponseCache::fetch(time_t start, time_t end, Encoding encoding)
+{
+    const std::pair<time_t, time_t> range{start, end};
+
+    Response response;
+    if (this->lookup(start, end, encoding, response))
+        return response;
+
+    /* A cached range that a deposit has added to, or that was never asked for in this encoding,
+     * is serialized from a copy of its totals so lookups aren't held up by it. */
+    TrafficMap cached;
+    uint64_t version = 0;
+    bool found = false;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        auto it = mEntries.find(range);
+        if (it != mEntries.end())
+        {
+            cached = it->second.traffic;
+            version = it->second.version;
+            it->second.lastUsed = ++mClock;
+            mStats.hits++;
+            found = true;
+        }
+        else
+        {
+            mStats.misses++;
+        }
+    }
+
+    if (found)
+    {
+        response = mSerialize(cached, encoding);
+
+        /* Only kept if nothing was added to the range in the meantime. */
+        std::unique_lock<std::mutex> lock(mMutex);
+        auto it = mEntries.find(range);
+        if (it != mEntries.end() && it->second.version == version)
+            it->second.responses[static_cast<std::size_t>(encoding)] = response;
+
+        return response;
+    }
+
+    /* The fetch is only cached if no deposit was made while it ran, otherwise it can't be told
+     * whether the deposit is in it or still has to be added. */
+    const uint64_t sequence = mTrafficStorage.depositSequence();
+
+    TrafficMap traffic = end == std::numeric_limits<time_t>::max()
+                             ? mTrafficStorage.fetchTrafficSince(start)
+                             : mTrafficStorage.fetchTrafficBetween(start, end);
+    response = mSerialize(traffic, encoding);
+
+    if (mMaxEntries == 0 || sequence % 2 != 0)
+        return response;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    /* Checked under the lock, a deposit that starts after this is only passed to deposited once
+     * the entry is in place. */
+    if (mTrafficStorage.depositSequence() != sequence)
+        return response;
+
+    if (mEntries.count(range) == 0 && mEntries.size() >= mMaxEntries)
+        evict();
+
+    Entry& entry = mEntries[range];
+    entry.traffic = std::move(traffic);
+    entry.responses = {};
+    entry.responses[static_cast<std::size_t>(encoding)] = response;
+    entry.lastUsed = ++mClock;
+    entry.version = ++mVersion;
+
+    return response;
+}
+
+bool ResponseCache::lookup(time_t start, time_t end, Encoding encoding, Response& response)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    auto it = mEntries.find({start, end});
+    if (it == mEntries.end())
+        return false;
+
+    Entry& entry = it->second;
+    const Response& cached = entry.responses[static_cast<std::size_t>(encoding)];
+    if (!cached)
+        return false;
+
+    entry.lastUsed = ++mClock;
+    mStats.hits++;
+
+    response = cached;
+    return true;
+}
+
+ResponseCacheStats ResponseCache::stats() const
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    ResponseCacheStats stats = mStats;
+    stats.entries = mEntries.size();
+    return stats;
+}
+
+void ResponseCache::deposited(const TrafficInterval& interval)
+{
+    if (interval.traffic.empty())
+        return;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (auto& [range, entry] : mEntries)
+    {
+        if (interval.timestamp < range.first || interval.timestamp > range.second)
+            continue;
+
+        for (const auto& [name, line] : interval.traffic)
+        {
+            entry.traffic[name] += line;
+        }
+
+        for (Response& response : entry.responses)
+        {
+            response.reset();
+        }
+        entry.version = ++mVersion;
+        mStats.updates++;
+    }
+}
+
+void ResponseCache::evict()
+{
+    auto oldest = mEntries.begin();
+    for (auto it = mEntries.begin(); it != mEntries.end(); it++)
+    {
+        if (it->second.lastUsed < oldest->second.lastUsed)
+            oldest = it;
+    }
+
+    if (oldest != mEntries.end())
+    {
+        mEntries.erase(oldest);
+        mStats.evictions++;
+    }
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Encoding.hpp"
+#include "traffic/TrafficStorage.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace ntmd {
+
+struct ResponseCacheStats
+{
+    uint64_t hits{0};      /* Requests answered without reading any traffic. */
+    uint64_t misses{0};    /* Requests that had to fetch their range. */
+    uint64_t updates{0};   /* Deposits added to a cached range. */
+    uint64_t evictions{0}; /* Ranges dropped to make room for another. */
+    std::size_t entries{0};
+};
+
+/* Serialized responses of traffic range queries, keyed by their range, for clients that poll the
+ * same query every few seconds.
+ * Deposits only ever add traffic, so instead of dropping the ranges a deposit falls into its
+ * traffic is added to their totals and the response is serialized again the next time it is
+ * fetched, outside the lock. Each range keeps a response per encoding it has been asked for
+ * in. A cached response is always the same as fetching the range again would return.
+ * Responses are handed out by reference and never changed, so every client sent one is written
+ * straight from the cache's copy. */
+class ResponseCache
+{
+    using TrafficMap = std::unordered_map<std::string, TrafficLine>;
+
+  public:
+    using Response = std::shared_ptr<const std::string>;
+    using Serializer = std::function<Response(const TrafficMap&, Encoding)>;
+
+    /* Keeps up to maxEntries ranges, dropping the least recently requested one when full. */
+    ResponseCache(TrafficStorage& trafficStorage, Serializer serialize, std::size_t maxEntries);
+    ~ResponseCache();
+
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    /* Traffic between two timestamps (inclusive) serialized in the given encoding, fetched from
+     * the traffic storage if the range isn't cached yet. */
+    Response fetch(time_t start, time_t end, Encoding encoding);
+
+    /* Set response to the cached response of the range and return true if it is cached and
+     * serialized in the encoding, without ever fetching or serializing anything. */
+    bool lookup(time_t start, time_t end, Encoding encoding, Response& response);
+
+    ResponseCacheStats stats() const;
+
+  private:
+    struct Entry
+    {
+        TrafficMap traffic;
+        /* By encoding, null until asked for and once a deposit has changed the traffic. */
+        std::array<Response, ENCODING_COUNT> responses;
+        uint64_t lastUsed{0};
+        uint64_t version{0}; /* From mVersion, whenever traffic was set or added to. */
+    };
+
+    /* Deposit listener, adds the traffic to every cached range holding its timestamp. */
+    void deposited(const TrafficInterval& interval);
+
+    /* Drop the least recently requested entry. */
+    void evict();
+
+    TrafficStorage& mTrafficStorage;
+    Serializer mSerialize;
+    std::size_t mMaxEntries;
+    int mListener;
+
+    mutable std::mutex mMutex;
+    std::map<std::pair<time_t, time_t>, Entry> mEntries;
+    uint64_t mClock{0};   /* Ticks once per request, for lastUsed. */
+    uint64_t mVersion{0}; /* Ticks whenever an entry's traffic changes, for version. */
+    ResponseCacheStats mStats;
+};
+
+} // namespace ntmd
\ No newline at end of file
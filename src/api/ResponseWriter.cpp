@@ -0,0 +1,331 @@
+#include "ResponseWriter.hpp"
+
+#include <charconv>
+#include <cstdio>
+#include <string>
+
+namespace ntmd {
+
+using TrafficMap = std::unordered_map<std::string, TrafficLine>;
+
+/* CBOR major types. */
+static constexpr uint8_t CBOR_UNSIGNED = 0;
+static constexpr uint8_t CBOR_TEXT = 3;
+static constexpr uint8_t CBOR_ARRAY = 4;
+static constexpr uint8_t CBOR_MAP = 5;
+
+ResponseWriter::ResponseWriter(std::string& out, Encoding encoding) :
+    mOut(out), mEncoding(encoding)
+{
+}
+
+void ResponseWriter::beginObject(std::size_t members)
+{
+    switch (mEncoding)
+    {
+    case Encoding::Cbor:
+        cborHead(CBOR_MAP, members);
+        break;
+    case Encoding::MessagePack:
+        msgpackHead(0x80, 15, 0xde, members);
+        break;
+    default:
+        separate();
+        mOut += '{';
+        mHasMembers.push_back(false);
+        break;
+    }
+}
+
+void ResponseWriter::endObject()
+{
+    if (mEncoding != Encoding::Json)
+        return;
+
+    mOut += '}';
+    mHasMembers.pop_back();
+}
+
+void ResponseWriter::beginArray(std::size_t elements)
+{
+    switch (mEncoding)
+    {
+    case Encoding::Cbor:
+        cborHead(CBOR_ARRAY, elements);
+        break;
+    case Encoding::MessagePack:
+        msgpackHead(0x90, 15, 0xdc, elements);
+        break;
+    default:
+        separate();
+        mOut += '[';
+        mHasMembers.push_back(false);
+        break;
+    }
+}
+
+void ResponseWriter::endArray()
+{
+    if (mEncoding != Encoding::Json)
+        return;
+
+    mOut += ']';
+    mHasMembers.pop_back();
+}
+
+void ResponseWriter::key(std::string_view name)
+{
+    this->string(name);
+
+    if (mEncoding == Encoding::Json)
+    {
+        mOut += ':';
+        mAfterKey = true;
+    }
+}
+
+void ResponseWriter::string(std::string_view str)
+{
+    switch (mEncoding)
+    {
+    case Encoding::Cbor:
+        cborHead(CBOR_TEXT, str.size());
+        mOut.append(str);
+        return;
+    case Encoding::MessagePack:
+        if (str.size() > 31 && str.size() <= 0xff)
+        {
+            mOut += static_cast<char>(0xd9);
+            bigEndian(str.size(), 1);
+        }
+        else
+        {
+            msgpackHead(0xa0, 31, 0xda, str.size());
+        }
+
+        mOut.append(str);
+        return;
+    default:
+        break;
+    }
+
+    separate();
+    mOut += '"';
+
+    /* Names are written as they are, only what JSON doesn't allow in a string is escaped. */
+    for (char c : str)
+    {
+        switch (c)
+        {
+        case '"':
+            mOut += "\\\"";
+            break;
+        case '\\':
+            mOut += "\\\\";
+            break;
+        case '\b':
+            mOut += "\\b";
+            break;
+        case '\f':
+            mOut += "\\f";
+            break;
+        case '\n':
+            mOut += "\\n";
+            break;
+        case '\r':
+            mOut += "\\r";
+            break;
+        case '\t':
+            mOut += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[7];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                mOut += escaped;
+            }
+            else
+            {
+                mOut += c;
+            }
+            break;
+        }
+    }
+
+    mOut += '"';
+}
+
+void ResponseWriter::number(uint64_t number)
+{
+    switch (mEncoding)
+    {
+    case Encoding::Cbor:
+        cborHead(CBOR_UNSIGNED, number);
+        return;
+    case Encoding::MessagePack:
+        if (number < 0x80)
+        {
+            mOut += static_cast<char>(number);
+        }
+        else if (number <= 0xff)
+        {
+            mOut += static_cast<char>(0xcc);
+            bigEndian(number, 1);
+        }
+        else if (number <= 0xffff)
+        {
+            mOut += static_cast<char>(0xcd);
+            bigEndian(number, 2);
+        }
+        else if (number <= 0xffffffff)
+        {
+            mOut += static_cast<char>(0xce);
+            bigEndian(number, 4);
+        }
+        else
+        {
+            mOut += static_cast<char>(0xcf);
+            bigEndian(number, 8);
+        }
+        return;
+    default:
+        break;
+    }
+
+    separate();
+
+    char digits[20];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), number);
+    mOut.append(digits, result.ptr);
+}
+
+void ResponseWriter::boolean(bool boolean)
+{
+    switch (mEncoding)
+    {
+    case Encoding::Cbor:
+        mOut += static_cast<char>(boolean ? 0xf5 : 0xf4);
+        return;
+    case Encoding::MessagePack:
+        mOut += static_cast<char>(boolean ? 0xc3 : 0xc2);
+        return;
+    default:
+        separate();
+        mOut += boolean ? "true" : "false";
+        return;
+    }
+}
+
+void ResponseWriter::traffic(const TrafficMap& traffic)
+{
+    this->key("data");
+    this->beginObject(traffic.size());
+
+    for (const auto& [name, line] : traffic)
+    {
+        this->key(name);
+
+        if (mEncoding != Encoding::Json)
+        {
+            this->beginArray(4);
+            this->number(line.bytesRx);
+            this->number(line.bytesTx);
+            this->number(line.pktRxCount);
+            this->number(line.pktTxCount);
+            this->endArray();
+            continue;
+        }
+
+        this->beginObject(4);
+        this->key("bytesRx");
+        this->number(line.bytesRx);
+        this->key("bytesTx");
+        this->number(line.bytesTx);
+        this->key("pktRxCount");
+        this->number(line.pktRxCount);
+        this->key("pktTxCount");
+        this->number(line.pktTxCount);
+        this->endObject();
+    }
+
+    this->endObject();
+
+    this->key("length");
+    this->number(traffic.size());
+}
+
+void ResponseWriter::separate()
+{
+    if (mAfterKey)
+    {
+        mAfterKey = false;
+        return;
+    }
+
+    if (mHasMembers.empty())
+        return;
+
+    if (mHasMembers.back())
+        mOut += ',';
+    mHasMembers.back() = true;
+}
+
+void ResponseWriter::cborHead(uint8_t major, uint64_t value)
+{
+    const uint8_t type = major << 5;
+
+    if (value < 24)
+    {
+        mOut += static_cast<char>(type | value);
+    }
+    else if (value <= 0xff)
+    {
+        mOut += static_cast<char>(type | 24);
+        bigEndian(value, 1);
+    }
+    else if (value <= 0xffff)
+    {
+        mOut += static_cast<char>(type | 25);
+        bigEndian(value, 2);
+    }
+    else if (value <= 0xffffffff)
+    {
+        mOut += static_cast<char>(type | 26);
+        bigEndian(value, 4);
+    }
+    else
+    {
+        mOut += static_cast<char>(type | 27);
+        bigEndian(value, 8);
+    }
+}
+
+void ResponseWriter::msgpackHead(uint8_t fixed, uint8_t fixedMax, uint8_t type16,
+                                 std::size_t size)
+{
+    if (size <= fixedMax)
+    {
+        mOut += static_cast<char>(fixed | size);
+    }
+    else if (size <= 0xffff)
+    {
+        mOut += static_cast<char>(type16);
+        bigEndian(size, 2);
+    }
+    else
+    {
+        mOut += static_cast<char>(type16 + 1);
+        bigEndian(size, 4);
+    }
+}
+
+void ResponseWriter::bigEndian(uint64_t value, int bytes)
+{
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8)
+    {
+        mOut += static_cast<char>((value >> shift) & 0xff);
+    }
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Encoding.hpp"
+#include "traffic/TrafficStore.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ntmd {
+
+/* Writes a response straight into a buffer in any Encoding, without building a json document
+ * first. Objects and arrays are given their number of members up front as the binary encodings
+ * need it before the members, nothing checks that the calls actually form a valid document.
+ * Decodes to the same document as encode would produce from the equivalent json. */
+class ResponseWriter
+{
+    using TrafficMap = std::unordered_map<std::string, TrafficLine>;
+
+  public:
+    /* Appends to out, which can be reused between responses to keep its capacity. */
+    ResponseWriter(std::string& out, Encoding encoding);
+
+    void beginObject(std::size_t members);
+    void endObject();
+
+    void beginArray(std::size_t elements);
+    void endArray();
+
+    /* Name of the next member of an object. */
+    void key(std::string_view name);
+
+    void string(std::string_view str);
+    void number(uint64_t number);
+    void boolean(bool boolean);
+
+    /* The "data" and "length" members of a traffic response, two members of the enclosing
+     * object. Each line is an object of named fields in JSON and the compact
+     * [bytesRx, bytesTx, pktRxCount, pktTxCount] in the binary encodings. */
+    void traffic(const TrafficMap& traffic);
+
+  private:
+    /* JSON only, writes the comma before every member or element but the first. */
+    void separate();
+
+    /* Type and length or value of a CBOR data item. */
+    void cborHead(uint8_t major, uint64_t value);
+
+    /* MessagePack type of a container or string, by its fixed type and the 16 and 32 bit
+     * types for longer ones. */
+    void msgpackHead(uint8_t fixed, uint8_t fixedMax, uint8_t type16, std::size_t size);
+
+    /* Big endian integer of the given width. */
+    void bigEndian(uint64_t value, int bytes);
+
+    std::string& mOut;
+    Encoding mEncoding;
+
+    /* JSON only. Whether each open object or array has a member yet, and whether the next value
+     * follows a key instead of starting a new member. */
+    std::vector<bool> mHasMembers;
+    bool mAfterKey{false};
+};
+
+} // namespace ntmd
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "ArgumentParser.hpp"
 #include "Daemon.hpp"
+#include "util/StringUtil.hpp"
 
 #include <iostream>
 #include <stdexcept>
@@ -19,9 +20,14 @@ Arguments:
   -i, --interval    Interval in seconds to update database with buffered traffic.
   -p, --port        Port for the socket server to be hosted on.
   -c, --config      Absolute path to search for the config file location rather than defaults.
-  --interface       Network interface for ntmd to monitor traffic on (example: eth0).
+  --interface       Network interface(s) for ntmd to monitor traffic on (example: eth0,tun0 or any).
   --db-path         Path to database file to be used for reading and writing traffic.
   --daemon          Used to launch initial daemon process to monitor traffic.
+  --replay          Replay a pcap file through the traffic pipeline as fast as possible and print
+                    throughput and process resolve rates, then exit. Does not require root.
+  --replay-table    Process table file recorded with --record-table to resolve replayed packets
+                    with. Without one every flow in the capture is given a synthetic process.
+  --record-table    Record the socket and process tables of this host to a file, then exit.
 )";
 
 ArgumentParser::ArgumentParser(int argc, char** argv)
@@ -174,6 +180,59 @@ ArgumentParser::ArgumentParser(int argc, char** argv)
             continue;
         }
 
+        if (arg == "--replay")
+        {
+            if (it + 1 != end)
+            {
+                this->replay = *(it + 1);
+            }
+            else
+            {
+                std::cerr << ntmd::logerror
+                          << "The replay argument (--replay) requires a path to a pcap file.\n";
+                std::exit(2);
+            }
+
+            it++;
+            continue;
+        }
+
+        if (arg == "--replay-table")
+        {
+            if (it + 1 != end)
+            {
+                this->replayTable = *(it + 1);
+            }
+            else
+            {
+                std::cerr << ntmd::logerror
+                          << "The replay table argument (--replay-table) requires a path to a "
+                             "process table file.\n";
+                std::exit(2);
+            }
+
+            it++;
+            continue;
+        }
+
+        if (arg == "--record-table")
+        {
+            if (it + 1 != end)
+            {
+                this->recordTable = *(it + 1);
+            }
+            else
+            {
+                std::cerr << ntmd::logerror
+                          << "The record table argument (--record-table) requires a path to "
+                             "write the process table to.\n";
+                std::exit(2);
+            }
+
+            it++;
+            continue;
+        }
+
         /* Provided arg doesn't match any actual arguments */
         std::cerr << ntmd::logerror << "Invalid argument: " << arg
                   << ". Use --help to view list of valid arguments.\n";
@@ -17,6 +17,11 @@ class ArgumentParser
     bool debug{false};
     std::filesystem::path configPath{};
 
+    /* Offline benchmarking, see net/Replay.hpp. */
+    std::optional<std::filesystem::path> replay;
+    std::optional<std::filesystem::path> replayTable;
+    std::optional<std::filesystem::path> recordTable;
+
     /* Command line arguments that have analogs to config file items.
      * Args set here will take precedence over the config file items. */
     std::optional<int> interval;
@@ -4,6 +4,7 @@
 #include "util/FilesystemUtil.hpp"
 #include "util/StringUtil.hpp"
 
+#include <climits>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -14,6 +15,9 @@
 
 namespace ntmd {
 
+/* Largest capture buffer in megabytes, libpcap takes the buffer size in bytes as an int. */
+static constexpr int MAX_BUFFER_MB = INT_MAX >> 20;
+
 Config::Config(std::filesystem::path overridedPath)
 {
     if (!overridedPath.empty())
@@ -89,6 +93,60 @@ Config::Config(std::filesystem::path overridedPath)
         }
     }
 
+    if (items.count("flushInterval"))
+    {
+        try
+        {
+            this->flushInterval = std::stoi(items["flushInterval"]);
+        }
+        catch (std::invalid_argument& ia)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"flushInterval\" is attempting to be set with a "
+                         "non-integer value (\""
+                      << items["flushInterval"] << "\"). Defaulting to " << this->flushInterval
+                      << "\n";
+        }
+        catch (std::out_of_range& oor)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"flushInterval\" is attempting to be set with an "
+                         "integer value too large (\""
+                      << items["flushInterval"] << "\"). Defaulting to " << this->flushInterval
+                      << "\n";
+        }
+
+        if (this->flushInterval < 0)
+            this->flushInterval = 0;
+    }
+
+    if (items.count("rawRetentionDays"))
+    {
+        try
+        {
+            this->rawRetentionDays = std::stoi(items["rawRetentionDays"]);
+        }
+        catch (std::invalid_argument& ia)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"rawRetentionDays\" is attempting to be set with a "
+                         "non-integer value (\""
+                      << items["rawRetentionDays"] << "\"). Defaulting to "
+                      << this->rawRetentionDays << "\n";
+        }
+        catch (std::out_of_range& oor)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"rawRetentionDays\" is attempting to be set with an "
+                         "integer value too large (\""
+                      << items["rawRetentionDays"] << "\"). Defaulting to "
+                      << this->rawRetentionDays << "\n";
+        }
+
+        if (this->rawRetentionDays < 0)
+            this->rawRetentionDays = 0;
+    }
+
     if (items.count("interface"))
     {
         this->interface = items["interface"];
@@ -127,6 +185,229 @@ Config::Config(std::filesystem::path overridedPath)
         }
     }
 
+    if (items.count("timeout"))
+    {
+        try
+        {
+            this->timeout = std::stoi(items["timeout"]);
+        }
+        catch (std::invalid_argument& ia)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"timeout\" is attempting to be set with a non-integer value "
+                         "(\""
+                      << items["timeout"] << "\"). Defaulting to " << this->timeout << "\n";
+        }
+        catch (std::out_of_range& oor)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"timeout\" is attempting to be set with an integer value "
+                         "too large (\""
+                      << items["timeout"] << "\"). Defaulting to " << this->timeout << "\n";
+        }
+
+        /* Capture workers wait on epoll for this long, 0 would have them poll without sleeping. */
+        if (this->timeout < 1)
+        {
+            std::cerr << ntmd::logwarn << "Config item \"timeout\" must be at least 1.\n";
+            this->timeout = 1;
+        }
+    }
+
+    if (items.count("headerOnly"))
+    {
+        const std::string& val = util::strToLower(items["headerOnly"]);
+        try
+        {
+            this->headerOnly = util::stringToBool(val);
+        }
+        catch (std::invalid_argument& ia)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"headerOnly\" is attempting to be set with a non-boolean "
+                         "value (\""
+                      << items["headerOnly"] << "\"). Defaulting to " << this->headerOnly << "\n";
+        }
+    }
+
+    if (items.count("bufferSize"))
+    {
+        try
+        {
+            this->bufferSize = std::stoi(items["bufferSize"]);
+        }
+        catch (std::invalid_argument& ia)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"bufferSize\" is attempting to be set with a "
+                         "non-integer value (\""
+                      << items["bufferSize"] << "\"). Defaulting to " << this->bufferSize
+                      << "\n";
+        }
+        catch (std::out_of_range& oor)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"bufferSize\" is attempting to be set with an "
+                         "integer value too large (\""
+                      << items["bufferSize"] << "\"). Defaulting to " << this->bufferSize
+                      << "\n";
+        }
+
+        if (this->bufferSize < 1)
+        {
+            std::cerr << ntmd::logwarn << "Config item \"bufferSize\" must be at least 1.\n";
+            this->bufferSize = 1;
+        }
+        else if (this->bufferSize > MAX_BUFFER_MB)
+        {
+            std::cerr << ntmd::logwarn << "Config item \"bufferSize\" must be at most "
+                      << MAX_BUFFER_MB << ".\n";
+            this->bufferSize = MAX_BUFFER_MB;
+        }
+    }
+
+    if (items.count("maxBufferSize"))
+    {
+        try
+        {
+            this->maxBufferSize = std::stoi(items["maxBufferSize"]);
+        }
+        catch (std::invalid_argument& ia)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"maxBufferSize\" is attempting to be set with a "
+                         "non-integer value (\""
+                      << items["maxBufferSize"] << "\"). Defaulting to " << this->maxBufferSize
+                      << "\n";
+        }
+        catch (std::out_of_range& oor)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"maxBufferSize\" is attempting to be set with an "
+                         "integer value too large (\""
+                      << items["maxBufferSize"] << "\"). Defaulting to " << this->maxBufferSize
+                      << "\n";
+        }
+
+        if (this->maxBufferSize < 1)
+        {
+            std::cerr << ntmd::logwarn << "Config item \"maxBufferSize\" must be at least 1.\n";
+            this->maxBufferSize = 1;
+        }
+        else if (this->maxBufferSize > MAX_BUFFER_MB)
+        {
+            std::cerr << ntmd::logwarn << "Config item \"maxBufferSize\" must be at most "
+                      << MAX_BUFFER_MB << ".\n";
+            this->maxBufferSize = MAX_BUFFER_MB;
+        }
+    }
+
+    if (items.count("backend"))
+    {
+        const std::string& val = util::strToLower(items["backend"]);
+        if (val == "libpcap" || val == "ring")
+        {
+            this->backend = val;
+        }
+        else
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"backend\" is attempting to be set with an unknown capture "
+                         "backend (\""
+                      << items["backend"] << "\"). Defaulting to " << this->backend << "\n";
+        }
+    }
+
+    if (items.count("ringBlockSize"))
+    {
+        try
+        {
+            this->ringBlockSize = std::stoi(items["ringBlockSize"]);
+        }
+        catch (std::invalid_argument& ia)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"ringBlockSize\" is attempting to be set with a "
+                         "non-integer value (\""
+                      << items["ringBlockSize"] << "\"). Defaulting to " << this->ringBlockSize
+                      << "\n";
+        }
+        catch (std::out_of_range& oor)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"ringBlockSize\" is attempting to be set with an integer "
+                         "value too large (\""
+                      << items["ringBlockSize"] << "\"). Defaulting to " << this->ringBlockSize
+                      << "\n";
+        }
+
+        const int pageSize = static_cast<int>(sysconf(_SC_PAGESIZE));
+        if (this->ringBlockSize < pageSize)
+        {
+            std::cerr << ntmd::logwarn << "Config item \"ringBlockSize\" must be at least the page "
+                      << "size (" << pageSize << ").\n";
+            this->ringBlockSize = pageSize;
+        }
+    }
+
+    if (items.count("ringBlockCount"))
+    {
+        try
+        {
+            this->ringBlockCount = std::stoi(items["ringBlockCount"]);
+        }
+        catch (std::invalid_argument& ia)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"ringBlockCount\" is attempting to be set with a "
+                         "non-integer value (\""
+                      << items["ringBlockCount"] << "\"). Defaulting to " << this->ringBlockCount
+                      << "\n";
+        }
+        catch (std::out_of_range& oor)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"ringBlockCount\" is attempting to be set with an integer "
+                         "value too large (\""
+                      << items["ringBlockCount"] << "\"). Defaulting to " << this->ringBlockCount
+                      << "\n";
+        }
+
+        if (this->ringBlockCount < 1)
+        {
+            std::cerr << ntmd::logwarn << "Config item \"ringBlockCount\" must be at least 1.\n";
+            this->ringBlockCount = 1;
+        }
+    }
+
+    if (items.count("workers"))
+    {
+        try
+        {
+            this->workers = std::stoi(items["workers"]);
+        }
+        catch (std::invalid_argument& ia)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"workers\" is attempting to be set with a non-integer value "
+                         "(\""
+                      << items["workers"] << "\"). Defaulting to " << this->workers << "\n";
+        }
+        catch (std::out_of_range& oor)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"workers\" is attempting to be set with an integer value "
+                         "too large (\""
+                      << items["workers"] << "\"). Defaulting to " << this->workers << "\n";
+        }
+
+        if (this->workers < 1)
+        {
+            std::cerr << ntmd::logwarn << "Config item \"workers\" must be at least 1.\n";
+            this->workers = 1;
+        }
+    }
+
     if (items.count("dbPath"))
     {
         this->dbPath = items["dbPath"];
@@ -137,6 +418,23 @@ Config::Config(std::filesystem::path overridedPath)
         }
     }
 
+    if (items.count("storageEngine"))
+    {
+        const std::string& val = util::strToLower(items["storageEngine"]);
+        if (val == "sqlite" || val == "segments")
+        {
+            this->storageEngine = val;
+        }
+        else
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"storageEngine\" is attempting to be set with an unknown "
+                         "storage engine (\""
+                      << items["storageEngine"] << "\"). Defaulting to " << this->storageEngine
+                      << "\n";
+        }
+    }
+
     if (items.count("port"))
     {
         try
@@ -158,6 +456,31 @@ Config::Config(std::filesystem::path overridedPath)
         }
     }
 
+    if (items.count("apiWorkers"))
+    {
+        try
+        {
+            this->apiWorkers = std::stoi(items["apiWorkers"]);
+        }
+        catch (std::invalid_argument& ia)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"apiWorkers\" is attempting to be set with a non-integer "
+                         "value (\""
+                      << items["apiWorkers"] << "\"). Defaulting to " << this->apiWorkers << "\n";
+        }
+        catch (std::out_of_range& oor)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"apiWorkers\" is attempting to be set with an integer "
+                         "value too large (\""
+                      << items["apiWorkers"] << "\"). Defaulting to " << this->apiWorkers << "\n";
+        }
+
+        if (this->apiWorkers < 1)
+            this->apiWorkers = 1;
+    }
+
     if (items.count("processCacheSize"))
     {
         try
@@ -182,6 +505,60 @@ Config::Config(std::filesystem::path overridedPath)
         }
     }
 
+    if (items.count("flowCacheSize"))
+    {
+        try
+        {
+            this->flowCacheSize = std::stoi(items["flowCacheSize"]);
+        }
+        catch (std::invalid_argument& ia)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"flowCacheSize\" is attempting to be set with a "
+                         "non-integer value (\""
+                      << items["flowCacheSize"] << "\"). Defaulting to " << this->flowCacheSize
+                      << "\n";
+        }
+        catch (std::out_of_range& oor)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"flowCacheSize\" is attempting to be set with an "
+                         "integer value too large (\""
+                      << items["flowCacheSize"] << "\"). Defaulting to " << this->flowCacheSize
+                      << "\n";
+        }
+
+        if (this->flowCacheSize < 0)
+            this->flowCacheSize = 0;
+    }
+
+    if (items.count("historyCacheSize"))
+    {
+        try
+        {
+            this->historyCacheSize = std::stoi(items["historyCacheSize"]);
+        }
+        catch (std::invalid_argument& ia)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"historyCacheSize\" is attempting to be set with a "
+                         "non-integer value (\""
+                      << items["historyCacheSize"] << "\"). Defaulting to "
+                      << this->historyCacheSize << "\n";
+        }
+        catch (std::out_of_range& oor)
+        {
+            std::cerr << ntmd::logwarn
+                      << "Config item \"historyCacheSize\" is attempting to be set with an "
+                         "integer value too large (\""
+                      << items["historyCacheSize"] << "\"). Defaulting to "
+                      << this->historyCacheSize << "\n";
+        }
+
+        if (this->historyCacheSize < 0)
+            this->historyCacheSize = 0;
+    }
+
     /* This will ensure the config is up to date after adding new config items.
      * Keeps current config values and adds new fields with their defaults. */
     this->writeConfig();
@@ -213,6 +590,16 @@ void Config::writeConfig()
            "database.\n";
     cfg << "#Must be an integer value.\n"
         << "interval = " << this->interval << "\n\n";
+    cfg << "#Seconds between database commits. Intervals deposited in between are committed "
+           "together, so the database is synced to disk once per flush instead of once per "
+           "interval.\n";
+    cfg << "#Traffic that isn't committed yet is still included in API queries. 0 commits every "
+           "interval as soon as it is deposited.\n"
+        << "flushInterval = " << this->flushInterval << "\n\n";
+    cfg << "#Days of per second traffic to keep in the database. Older traffic is only kept summed "
+           "per minute, hour and day, which is all queries over long ranges read anyway.\n";
+    cfg << "#0 keeps per second traffic forever.\n"
+        << "rawRetentionDays = " << this->rawRetentionDays << "\n\n";
     cfg << "#Size for the process index LRU cache, leave default if unsure.\n";
     cfg << "#If you expect for many longrunning programs to use sockets frequently, increase the "
            "cache size to include those programs.\n";
@@ -220,7 +607,13 @@ void Config::writeConfig()
            "second), you may "
            "want a lower cache size or none at all (0).\n";
     cfg << "#In most cases the default will be good for both situations.\n";
-    cfg << "processCacheSize = " << this->processCacheSize << "\n";
+    cfg << "processCacheSize = " << this->processCacheSize << "\n\n";
+    cfg << "#Number of network flows each capture thread remembers the process of, so that later "
+           "packets of a flow don't have to be looked up again. 0 disables the cache.\n";
+    cfg << "flowCacheSize = " << this->flowCacheSize << "\n\n";
+    cfg << "#Kilobytes of recent traffic to keep compressed in memory. Queries over ranges that "
+           "are still in memory are answered without reading the database. 0 disables it.\n";
+    cfg << "historyCacheSize = " << this->historyCacheSize << "\n";
 
     cfg << "\n";
 
@@ -228,6 +621,8 @@ void Config::writeConfig()
     cfg << "#Network interface to be search for for ntmd to monitor traffic on. If value left "
            "empty ntmd will use the first device found.\n";
     cfg << "#An example network interface could be eth0\n";
+    cfg << "#Multiple interfaces can be given as a comma separated list (eth0, docker0, tun0), or "
+           "use any to monitor every interface that is up.\n";
     cfg << "interface = " << this->interface << "\n";
 
     cfg << "\n";
@@ -238,20 +633,52 @@ void Config::writeConfig()
     cfg << "#Enable or disable immediate mode while sniffing packets.\n";
     cfg << "#Immediate mode turned on will greatly increase average CPU usage but may decrease the "
            "amount of unmatched packets.\n";
-    cfg << "immediate = " << (this->immediate ? "true" : "false") << "\n";
+    cfg << "immediate = " << (this->immediate ? "true" : "false") << "\n\n";
+    cfg << "#Milliseconds the kernel buffers packets before handing them to ntmd, at least 1.\n";
+    cfg << "timeout = " << this->timeout << "\n\n";
+    cfg << "#Only capture the headers of each packet instead of the full payload. Packet lengths "
+           "are still accounted in full.\n";
+    cfg << "headerOnly = " << (this->headerOnly ? "true" : "false") << "\n\n";
+    cfg << "#Initial kernel capture buffer size in megabytes (libpcap backend).\n";
+    cfg << "bufferSize = " << this->bufferSize << "\n\n";
+    cfg << "#Largest size in megabytes the capture buffer will grow to when the kernel drops "
+           "packets.\n";
+    cfg << "#Set equal to bufferSize to disable growing the buffer.\n";
+    cfg << "maxBufferSize = " << this->maxBufferSize << "\n\n";
+    cfg << "#Capture backend used to receive packets from the kernel, either libpcap or ring.\n";
+    cfg << "#The ring backend reads packets in place from a memory mapped TPACKET_V3 ring, "
+           "avoiding a copy per packet on busy hosts.\n";
+    cfg << "backend = " << this->backend << "\n\n";
+    cfg << "#Size in bytes of each block in the ring (ring backend only). Rounded up to the page "
+           "size.\n";
+    cfg << "ringBlockSize = " << this->ringBlockSize << "\n\n";
+    cfg << "#Number of blocks in the ring (ring backend only).\n";
+    cfg << "ringBlockCount = " << this->ringBlockCount << "\n\n";
+    cfg << "#Number of capture threads. With more than 1, traffic is spread between the threads by "
+           "flow using PACKET_FANOUT.\n";
+    cfg << "#Each thread keeps its own process resolution state, so use at most one per core.\n";
+    cfg << "workers = " << this->workers << "\n";
 
     cfg << "\n";
     cfg << "[database]\n\n";
     cfg << "#Path to the database file that will be used for reading and writing application "
            "network traffic.\n";
     cfg << "#If left empty the default for is /var/lib/ntmd.db\n";
-    cfg << "dbPath = " << this->dbPath.string() << "\n";
+    cfg << "dbPath = " << this->dbPath.string() << "\n\n";
+    cfg << "#Storage engine for traffic, either sqlite or segments.\n";
+    cfg << "#segments writes append only files of compressed traffic to a directory named after "
+           "dbPath with .segments appended, which writes and stores far less than sqlite on busy "
+           "hosts. It keeps no rollups, so rawRetentionDays only applies to sqlite.\n";
+    cfg << "storageEngine = " << this->storageEngine << "\n";
 
     cfg << "\n";
 
     cfg << "[api]\n\n";
     cfg << "#Port for socket server to be hosted on (16 bit unsigned).\n";
-    cfg << "port = " << static_cast<int>(this->serverPort) << "\n";
+    cfg << "port = " << static_cast<int>(this->serverPort) << "\n\n";
+    cfg << "#Number of threads answering traffic queries, which may have to read the database. "
+           "Other requests are answered straight away.\n";
+    cfg << "apiWorkers = " << this->apiWorkers << "\n";
 
     configFile << cfg.str();
 }
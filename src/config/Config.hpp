@@ -31,16 +31,44 @@ class Config
 
     /* Interval in seconds at which buffered network traffic in memory will be deposited to db. */
     int interval{10};
-    /* Network interface for pcap to use instead of the default. */
+    /* Seconds between database commits. Every interval deposited in between is committed
+     * together so the database is only synced to disk once. 0 commits each interval right away. */
+    int flushInterval{60};
+    /* Days of per second traffic to keep in the database. Older traffic is only kept summed per
+     * minute, hour and day. 0 keeps it forever. */
+    int rawRetentionDays{0};
+    /* Comma separated network interfaces for pcap to use instead of the default, or "any". */
     std::string interface {};
     /* PCAP promiscuous mode. */
     bool promiscuous{false};
     /* PCAP immediate mode (much higher CPU usage but will potentially match more packets). */
     bool immediate{false};
+    /* Milliseconds the kernel buffers packets before handing them to ntmd. */
+    int timeout{100};
+    /* Only capture the packet headers ntmd parses instead of the full payload. */
+    bool headerOnly{false};
+    /* Initial kernel capture buffer size in megabytes (libpcap backend). */
+    int bufferSize{2};
+    /* Largest the capture buffer is allowed to grow to in megabytes when the kernel is dropping
+     * packets. Set equal to the initial buffer size to disable growing. */
+    int maxBufferSize{64};
+    /* Packet capture backend, either "libpcap" or "ring" for a memory mapped TPACKET_V3 ring. */
+    std::string backend{"libpcap"};
+    /* Size in bytes of a single block in the TPACKET_V3 ring (rounded up to the page size). */
+    int ringBlockSize{1 << 20};
+    /* Number of blocks in the TPACKET_V3 ring.
+     * Total ring memory is ringBlockSize * ringBlockCount. */
+    int ringBlockCount{64};
+    /* Number of capture worker threads. More than one joins the capture sockets into a
+     * PACKET_FANOUT group with each worker owning its own resolve state and traffic counters. */
+    int workers{1};
     /* Database path for traffic reading and writing.
      * If we are root, default is /var/lib/ntmd.db
      * If we are not-root, default is ~/.ntmd.db */
     std::filesystem::path dbPath{};
+    /* Storage engine for traffic, either "sqlite" or "segments" for append only segment files
+     * in a directory next to dbPath. */
+    std::string storageEngine{"sqlite"};
 
     /* ProcessIndex mLRUCache size. The larger the size, the longer it will take for the
      * ProcessIndex to find processes not in cache. The smaller the size, the easier it will be to
@@ -48,9 +76,21 @@ class Config
      * is more typical). Default of 5 is a good middle ground for both. */
     int processCacheSize{5};
 
+    /* Number of flows each capture worker remembers the resolved process of, so later packets of a
+     * flow skip the socket and process index lookups. 0 disables the flow cache. */
+    int flowCacheSize{8192};
+
+    /* Kilobytes of recently deposited traffic to keep compressed in memory, so queries over
+     * recent ranges don't have to go through the database. 0 disables the history. */
+    int historyCacheSize{4096};
+
     /* Port for the API socket server to be hosted on. */
     uint16_t serverPort{13889};
 
+    /* Threads answering API queries that may read the database, so a slow query only holds up
+     * the clients waiting on the same thread. */
+    int apiWorkers{4};
+
   private:
     std::filesystem::path mFilePath{};
 };
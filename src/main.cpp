@@ -2,8 +2,10 @@
 #include "api/APIController.hpp"
 #include "config/ArgumentParser.hpp"
 #include "config/Config.hpp"
+#include "net/Replay.hpp"
 #include "net/Sniffer.hpp"
 #include "proc/ProcessIndex.hpp"
+#include "proc/ProcessTable.hpp"
 #include "traffic/DBController.hpp"
 #include "traffic/TrafficStorage.hpp"
 
@@ -14,35 +16,59 @@ using namespace ntmd;
 
 int main(int argc, char** argv)
 {
-    if (geteuid() != 0)
+    ArgumentParser args(argc, argv);
+
+    /* Replaying a capture file never sniffs or reads other processes' file descriptors. */
+    if (geteuid() != 0 && !args.replay.has_value())
     {
         std::cerr << ntmd::logerror
                   << "ntmd must be run as root to sniff packets. Consider using sudo.\n";
         std::exit(4);
     }
-    ArgumentParser args(argc, argv);
 
     Config cfg(args.configPath);
     cfg.mergeArgs(args);
 
+    if (args.recordTable.has_value())
+    {
+        ProcessTable::record().save(args.recordTable.value());
+        std::cerr << ntmd::lognotice << "Recorded process table to " << args.recordTable.value()
+                  << ".\n";
+        return 0;
+    }
+
+    if (args.replay.has_value())
+    {
+        /* Replayed traffic is kept out of the real database unless a path is given. */
+        Replay replay(cfg, args.replay.value(), args.replayTable);
+        replay.run(args.dbPath.value_or(":memory:"));
+        return 0;
+    }
+
     Daemon& daemon = Daemon::instance();
 
     /* Database controller that is the only object with direct access
      * in or out of the local database that stores all network traffic
-     * monitored from ntmd. */
-    auto db = DBController(cfg.dbPath);
+     * monitored from ntmd. Deposits are written by its own thread in batches. */
+    auto db = DBController(cfg.dbPath, cfg.flushInterval, cfg.rawRetentionDays,
+                           cfg.storageEngine);
 
     /* Traffic storage that stores the in-memory network traffic monitored from the sniffer before
      * it gets deposited into the database using the DBController. The in-memory traffic gets
-     * deposited into the database on a set interval from the config and then gets cleared. */
-    auto trafficStorage = TrafficStorage(cfg.interval, db);
+     * deposited into the database on a set interval from the config and then gets cleared.
+     * Each capture worker accumulates into its own shard which are merged at deposit time.
+     * Recently deposited traffic is also kept in memory for queries over recent ranges. */
+    auto trafficStorage = TrafficStorage(cfg.interval, db, cfg.workers, true,
+                                         static_cast<std::size_t>(cfg.historyCacheSize) * 1024);
+
+    Sniffer sniffer(cfg, trafficStorage);
 
     /* Socket API controller that manages the socket server to respond to incoming socket API
      * requests. Has a reference to both the traffic storage for peeking into a live view of
-     * in-memory traffic, and the db controller for easy access to historical traffic data. */
-    auto api = APIController(trafficStorage, db, cfg.serverPort);
+     * in-memory traffic and recent history, and the db controller for historical traffic data.
+     * The sniffer reference is only used to report capture statistics. */
+    auto api = APIController(trafficStorage, db, sniffer, cfg.serverPort, cfg.apiWorkers);
 
-    Sniffer sniffer(cfg, trafficStorage);
     while (daemon.running())
     {
         sniffer.dispatch();
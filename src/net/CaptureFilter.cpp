@@ -0,0 +1,112 @@
+#include "CaptureFilter.hpp"
+#include "Daemon.hpp"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <linux/filter.h>
+#include <sys/socket.h>
+
+#include <pcap.h>
+
+namespace ntmd {
+
+std::string CaptureFilter::expression(const IPList& ips)
+{
+    /* Mirrors the discard rules in Packet::Packet:
+     * IPv4 only, TCP/UDP/ICMP only, no DNS/MDNS, SSDP or NTP. */
+    std::string expr = "ip and (tcp or icmp or (udp"
+                       " and not port 53"
+                       " and not (src port 5353 and dst port 5353)"
+                       " and not port 1900"
+                       " and not (src port 123 and dst port 123)))";
+
+    /* Packets that aren't to or from one of our addresses have an unknown direction. Without any
+     * addresses every packet would be discarded in userspace, so leave the host check out rather
+     * than filtering everything and let Packet::Packet sort it out. */
+    if (ips.size() > 0)
+    {
+        expr += " and (";
+        for (int i = 0; i < ips.size(); i++)
+        {
+            in_addr addr;
+            addr.s_addr = ips[i];
+
+            char ipStr[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &addr, ipStr, INET_ADDRSTRLEN);
+
+            if (i > 0)
+                expr += " or ";
+
+            expr += "host ";
+            expr += ipStr;
+        }
+        expr += ")";
+    }
+
+    return expr;
+}
+
+bool CaptureFilter::install(pcap_t* handle, const std::string& expression)
+{
+    bpf_program program;
+    if (pcap_compile(handle, &program, expression.c_str(), 1, PCAP_NETMASK_UNKNOWN) < 0)
+    {
+        std::cerr << ntmd::logwarn << "Failed to compile kernel capture filter \"" << expression
+                  << "\". Error: " << pcap_geterr(handle) << "\n";
+        return false;
+    }
+
+    bool installed = true;
+    if (pcap_setfilter(handle, &program) < 0)
+    {
+        std::cerr << ntmd::logwarn
+                  << "Failed to install kernel capture filter. Error: " << pcap_geterr(handle)
+                  << "\n";
+        installed = false;
+    }
+
+    pcap_freecode(&program);
+    return installed;
+}
+
+bool CaptureFilter::install(int fd, const std::string& expression, int snaplen, int linkType)
+{
+    /* A dead handle is enough for libpcap to compile a filter for the link type. The snapshot
+     * length becomes the filter's return value which the kernel uses to truncate the packet. */
+    pcap_t* dead = pcap_open_dead(linkType, snaplen);
+    if (dead == nullptr)
+    {
+        std::cerr << ntmd::logwarn << "Failed to create pcap handle to compile capture filter.\n";
+        return false;
+    }
+
+    bpf_program program;
+    if (pcap_compile(dead, &program, expression.c_str(), 1, PCAP_NETMASK_UNKNOWN) < 0)
+    {
+        std::cerr << ntmd::logwarn << "Failed to compile kernel capture filter \"" << expression
+                  << "\". Error: " << pcap_geterr(dead) << "\n";
+        pcap_close(dead);
+        return false;
+    }
+
+    /* libpcap's bpf_insn has the same layout as the kernel's sock_filter. */
+    sock_fprog fprog;
+    fprog.len = program.bf_len;
+    fprog.filter = reinterpret_cast<sock_filter*>(program.bf_insns);
+
+    bool installed = true;
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+    {
+        std::cerr << ntmd::logwarn
+                  << "Failed to attach kernel capture filter. Error: " << strerror(errno) << "\n";
+        installed = false;
+    }
+
+    pcap_freecode(&program);
+    pcap_close(dead);
+    return installed;
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "IPList.hpp"
+
+#include <string>
+
+#include <pcap.h>
+
+namespace ntmd {
+
+/* Kernel side BPF filter built from the same discard rules Packet::Packet applies in userspace.
+ * Installing it on the capture socket means packets we would throw away after parsing (non IPv4,
+ * DNS, SSDP, NTP, unknown protocols and traffic not to or from a local address) are dropped by the
+ * kernel before they are ever copied to us. Any change to the discard rules in Packet::Packet
+ * must be mirrored in CaptureFilter::expression. */
+class CaptureFilter
+{
+  public:
+    /* Build the pcap filter expression for the given local addresses. */
+    static std::string expression(const IPList& ips);
+
+    /* Compile and install the filter expression on an activated libpcap handle.
+     * Returns false if the filter could not be compiled or installed. */
+    static bool install(pcap_t* handle, const std::string& expression);
+
+    /* Compile the filter expression for packets of the given link layer type (DLT_EN10MB,
+     * DLT_RAW, ...) and attach it to a raw packet socket with SO_ATTACH_FILTER. Accepted packets
+     * are truncated to snaplen bytes by the filter.
+     * Returns false if the filter could not be compiled or attached. */
+    static bool install(int fd, const std::string& expression, int snaplen, int linkType);
+};
+
+} // namespace ntmd
\ No newline at end of file
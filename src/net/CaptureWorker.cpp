@@ -0,0 +1,102 @@
+#include "CaptureWorker.hpp"
+#include "Daemon.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <pcap.h>
+
+namespace ntmd {
+
+CaptureWorker::CaptureWorker(const Config& cfg, const std::vector<const pcap_if*>& devices,
+                             TrafficStorage& trafficStorage, int shard) :
+    mResolver(cfg.processCacheSize, cfg.flowCacheSize, trafficStorage, shard),
+    mTimeout(cfg.timeout)
+{
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpollFd < 0)
+    {
+        std::cerr << ntmd::logerror
+                  << "Could not create epoll instance for capture. Error: " << strerror(errno)
+                  << "\n";
+        std::exit(1);
+    }
+
+    for (const pcap_if* device : devices)
+    {
+        mInterfaces.push_back(std::make_unique<InterfaceCapture>(cfg, device, *this));
+        watch(*mInterfaces.back());
+    }
+}
+
+void CaptureWorker::watch(InterfaceCapture& capture)
+{
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = &capture;
+
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, capture.selectableFd(), &event) < 0)
+    {
+        std::cerr << ntmd::logerror << "Could not watch capture on " << capture.name()
+                  << " with epoll. Error: " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+}
+
+void CaptureWorker::joinFanout(int baseGroup)
+{
+    for (std::size_t i = 0; i < mInterfaces.size(); i++)
+    {
+        mInterfaces[i]->joinFanout((baseGroup + i) & 0xffff);
+    }
+}
+
+int CaptureWorker::dispatch()
+{
+    epoll_event events[16];
+    const int ready = epoll_wait(mEpollFd, events, 16, mTimeout);
+
+    timespec start, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+
+    /* Only the interfaces that have packets waiting are touched. */
+    int count = 0;
+    for (int i = 0; i < ready; i++)
+    {
+        auto* capture = static_cast<InterfaceCapture*>(events[i].data.ptr);
+
+        const int processed = capture->dispatch();
+        if (processed > 0)
+            count += processed;
+    }
+
+    const std::time_t now = std::time(nullptr);
+    for (const auto& capture : mInterfaces)
+    {
+        /* A reopened capture has a new descriptor, the old one left the epoll set when it was
+         * closed. */
+        if (capture->maintenance(now))
+            watch(*capture);
+    }
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    mCaptureNanos += (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+    mPacketCount += count;
+
+    return count;
+}
+
+CaptureWorker::~CaptureWorker()
+{
+    /* Interfaces hold a reference to this worker, close them first. */
+    mInterfaces.clear();
+
+    if (mEpollFd >= 0)
+        close(mEpollFd);
+}
+
+} // namespace ntmd
\ No newline at end of file
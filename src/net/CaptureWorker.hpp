@@ -0,0 +1,73 @@
+#pragma once
+
+#include "InterfaceCapture.hpp"
+#include "config/Config.hpp"
+#include "proc/DeferredResolver.hpp"
+#include "traffic/TrafficStorage.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <pcap.h>
+
+namespace ntmd {
+
+struct SnifferLoop;
+
+/* A single capture pipeline. Every worker owns a capture socket per interface, its own
+ * parse/resolve state and TrafficStorage shard so that multiple workers never contend with each
+ * other on the packet path. All of a worker's interfaces are multiplexed on one epoll instance so
+ * the cost per packet doesn't grow with the number of interfaces.
+ * When more than one worker is configured their sockets are joined into one PACKET_FANOUT group
+ * per interface and the kernel spreads flows between them by hash, keeping both directions of a
+ * flow on the same worker. */
+class CaptureWorker
+{
+  public:
+    CaptureWorker(const Config& cfg, const std::vector<const pcap_if*>& devices,
+                  TrafficStorage& trafficStorage, int shard);
+    ~CaptureWorker();
+
+    CaptureWorker(const CaptureWorker&) = delete;
+    CaptureWorker& operator=(const CaptureWorker&) = delete;
+
+    /* Join each interface's capture socket to a PACKET_FANOUT group. Fanout groups can't span
+     * devices, so the interface at index i joins group baseGroup + i. */
+    void joinFanout(int baseGroup);
+
+    /* Wait up to the configured timeout for any interface to have packets ready and process
+     * them. Returns the number of packets processed. */
+    int dispatch();
+
+    /* Interfaces in the same order as the devices given to the constructor. */
+    const std::vector<std::unique_ptr<InterfaceCapture>>& interfaces() const
+    {
+        return mInterfaces;
+    }
+
+    const DeferredResolver& resolver() const { return mResolver; }
+
+    uint64_t packetCount() const { return mPacketCount; }
+    uint64_t captureNanos() const { return mCaptureNanos; }
+
+    friend struct SnifferLoop;
+
+  private:
+    /* Register the interface's current selectable descriptor with our epoll instance. */
+    void watch(InterfaceCapture& capture);
+
+    /* Resolves packets to processes and adds them to this worker's TrafficStorage shard, the
+     * capture thread never searches /proc itself. */
+    DeferredResolver mResolver;
+
+    std::vector<std::unique_ptr<InterfaceCapture>> mInterfaces;
+
+    int mEpollFd{-1};
+    int mTimeout;
+
+    uint64_t mPacketCount{0};
+    uint64_t mCaptureNanos{0}; /* Thread CPU time spent inside dispatch. */
+};
+
+} // namespace ntmd
\ No newline at end of file
@@ -12,6 +12,32 @@
 namespace ntmd {
 
 void IPList::init(const pcap_if* device)
+{
+    load(device);
+
+    for (int i = 0; i < mSize; i++)
+    {
+        in_addr ip;
+        ip.s_addr = mIPs[i];
+
+        std::cerr << ntmd::loginfo << "Local IP address found for device " << device->name << ": "
+                  << inet_ntoa(ip) << "\n";
+    }
+}
+
+bool IPList::reload(const pcap_if* device)
+{
+    IPList current;
+    current.load(device);
+
+    if (current == *this)
+        return false;
+
+    *this = current;
+    return true;
+}
+
+void IPList::load(const pcap_if* device)
 {
     ifaddrs *interfaces, *interface;
     if (getifaddrs(&interfaces) < 0)
@@ -25,7 +51,7 @@ void IPList::init(const pcap_if* device)
     std::vector<uint32_t> tmp;
     for (interface = interfaces; interface != nullptr; interface = interface->ifa_next)
     {
-        if (interface->ifa_addr == nullptr)
+        if (interface->ifa_addr == nullptr || interface->ifa_addr->sa_family != AF_INET)
             continue;
 
         if (strcmp(interface->ifa_name, device->name) != 0)
@@ -34,9 +60,6 @@ void IPList::init(const pcap_if* device)
         in_addr ip;
         ip.s_addr = ((sockaddr_in*)interface->ifa_addr)->sin_addr.s_addr;
 
-        std::cerr << ntmd::loginfo << "Local IP address found for device " << device->name << ": "
-                  << inet_ntoa(ip) << "\n";
-
         /* If address starts with 192.168.x.x push to the front of the list.
          * It will be assumed this will be the ip most searched for. */
         if (ip.s_addr >= 43200)
@@ -45,7 +68,8 @@ void IPList::init(const pcap_if* device)
             tmp.push_back(ip.s_addr);
     }
 
-    for (int i = 0; i < tmp.size(); i++)
+    mSize = 0;
+    for (int i = 0; i < tmp.size() && i < 64; i++)
     {
         mIPs[i] = tmp[i];
         mSize++;
@@ -54,6 +78,12 @@ void IPList::init(const pcap_if* device)
     freeifaddrs(interfaces);
 }
 
+void IPList::add(uint32_t ip)
+{
+    if (mSize < 64 && !contains(ip))
+        mIPs[mSize++] = ip;
+}
+
 bool IPList::contains(uint32_t ip) const
 {
     if (mIPs[0] == ip)
@@ -68,4 +98,18 @@ bool IPList::contains(uint32_t ip) const
     return false;
 }
 
+bool IPList::operator==(const IPList& other) const
+{
+    if (mSize != other.mSize)
+        return false;
+
+    for (int i = 0; i < mSize; i++)
+    {
+        if (mIPs[i] != other.mIPs[i])
+            return false;
+    }
+
+    return true;
+}
+
 } // namespace ntmd
\ No newline at end of file
@@ -21,10 +21,24 @@ class IPList
     /* Should only be called once. */
     void init(const pcap_if* device);
 
+    /* Reloads the addresses of the device, returns true if they changed since the last load. */
+    bool reload(const pcap_if* device);
+
+    /* Add an address to the list, for captures that don't come from a local device. */
+    void add(uint32_t ip);
+
     /* Searchs the list to determine if param ip is contained in it. */
     bool contains(uint32_t ip) const;
 
+    int size() const { return mSize; }
+    uint32_t operator[](int i) const { return mIPs[i]; }
+
+    bool operator==(const IPList& other) const;
+
   private:
+    /* Fill the list with the IPv4 addresses currently assigned to the device. */
+    void load(const pcap_if* device);
+
     /* For performance reasons this will be stack allocated with a set amount.
      * This is an arbitrary amount for the expected max of local ip interfaces a machine will have.
      */
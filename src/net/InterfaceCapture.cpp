@@ -0,0 +1,284 @@
+#include "InterfaceCapture.hpp"
+#include "CaptureFilter.hpp"
+#include "CaptureWorker.hpp"
+#include "Daemon.hpp"
+#include "Packet.hpp"
+#include "Sniffer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <linux/if_packet.h>
+#include <sys/socket.h>
+#include <utility>
+
+#include <pcap.h>
+
+namespace ntmd {
+
+InterfaceCapture::InterfaceCapture(const Config& cfg, const pcap_if* device,
+                                   CaptureWorker& worker) :
+    mCfg(cfg),
+    mDevice(device), mWorker(worker)
+{
+    /* ntmd only ever reads the ethernet, ip and transport headers. The full length of the packet
+     * is still known from the packet header so accounting is unaffected. */
+    mSnaplen = cfg.headerOnly ? HEADER_SNAPLEN : 262144;
+
+    if (cfg.backend == "ring")
+        mBufferSize = static_cast<uint64_t>(cfg.ringBlockSize) * cfg.ringBlockCount;
+    else
+        mBufferSize = static_cast<uint64_t>(cfg.bufferSize) << 20;
+
+    mIPList.init(device);
+
+    open();
+}
+
+void InterfaceCapture::open()
+{
+    const int promiscuous = mCfg.promiscuous ? 1 : 0;
+    const int immediate = mCfg.immediate ? 1 : 0;
+    char errorBuffer[PCAP_ERRBUF_SIZE];
+
+    if (mCfg.backend == "ring")
+    {
+        /* Grow the ring by adding blocks, the block size stays as configured. */
+        const int blockCount = std::max<uint64_t>(mBufferSize / mCfg.ringBlockSize, 1);
+        mRing = std::make_unique<PacketRing>(mDevice->name, mCfg.ringBlockSize, blockCount,
+                                             mCfg.timeout, mCfg.promiscuous);
+        mLinkType = mRing->linkType();
+    }
+    else
+    {
+        mHandle = pcap_create(mDevice->name, errorBuffer);
+        if (mHandle == nullptr)
+        {
+            std::cerr << ntmd::logerror << "Could not open network device interface "
+                      << mDevice->name << " for monitoring. Error: " << errorBuffer << "\n";
+            std::exit(1);
+        }
+
+        if (pcap_set_timeout(mHandle, mCfg.timeout))
+            std::cerr << ntmd::logwarn
+                      << "Error setting packet buffer timeout, proceeding with it as instant.\n";
+
+        if (pcap_set_immediate_mode(mHandle, immediate))
+            std::cerr << ntmd::logwarn
+                      << "Error setting handle into immediate mode, proceeding with it off.\n";
+
+        if (pcap_set_promisc(mHandle, promiscuous))
+            std::cerr << ntmd::logwarn
+                      << "Error setting handle into promiscuous mode, proceeding with it off.\n";
+
+        if (pcap_set_snaplen(mHandle, mSnaplen))
+            std::cerr << ntmd::logwarn
+                      << "Error setting snapshot length, proceeding with full packet capture.\n";
+
+        /* Config keeps the buffer sizes within an int. */
+        if (pcap_set_buffer_size(mHandle, static_cast<int>(mBufferSize)))
+            std::cerr << ntmd::logwarn
+                      << "Error setting kernel buffer size, proceeding with the default.\n";
+
+        // TODO: Handle all warnings?
+        if (pcap_activate(mHandle))
+        {
+            std::cerr << ntmd::logerror
+                      << "Error activating configured pcap handle, cannot proceed. Error: "
+                      << pcap_geterr(mHandle) << "\n";
+            std::exit(1);
+        }
+
+        /* Every interface of a worker is waited on together with epoll, so a single handle must
+         * never block the rest. */
+        if (pcap_setnonblock(mHandle, 1, errorBuffer) < 0)
+        {
+            std::cerr << ntmd::logerror << "Could not set capture on " << mDevice->name
+                      << " to non-blocking mode. Error: " << errorBuffer << "\n";
+            std::exit(1);
+        }
+
+        mLinkType = pcap_datalink(mHandle);
+        if (mLinkType != DLT_EN10MB && mLinkType != DLT_RAW && mLinkType != DLT_IPV4 &&
+            mLinkType != DLT_LINUX_SLL)
+        {
+            std::cerr << ntmd::logwarn << "Unsupported link layer type " << mLinkType
+                      << " on device " << mDevice->name
+                      << ", packets from it will not be accounted.\n";
+        }
+    }
+
+    installFilter();
+
+    if (mFanoutGroup >= 0)
+        joinFanout(mFanoutGroup);
+}
+
+void InterfaceCapture::close()
+{
+    uint64_t received, dropped;
+    sampleStats(received, dropped);
+    mClosedReceived += received;
+    mClosedDropped += dropped;
+
+    mRing.reset();
+
+    if (mHandle != nullptr)
+    {
+        pcap_close(mHandle);
+        mHandle = nullptr;
+    }
+}
+
+void InterfaceCapture::grow()
+{
+    /* The old socket keeps capturing until the new one has its filter and is in the fanout
+     * group, so nothing is missed while the new buffer is set up. Closing the old socket then
+     * moves the new one into its place in the group, flows keep going to the same workers. */
+    std::unique_ptr<PacketRing> ring = std::move(mRing);
+    pcap_t* handle = std::exchange(mHandle, nullptr);
+    open();
+
+    /* Whatever the old socket already holds is still processed before it is closed. */
+    std::swap(ring, mRing);
+    std::swap(handle, mHandle);
+    dispatch();
+    close();
+
+    mRing = std::move(ring);
+    mHandle = handle;
+}
+
+void InterfaceCapture::installFilter()
+{
+    const std::string expression = CaptureFilter::expression(mIPList);
+
+    bool installed;
+    if (mRing)
+        installed = CaptureFilter::install(mRing->fd(), expression, mSnaplen, mLinkType);
+    else
+        installed = CaptureFilter::install(mHandle, expression);
+
+    if (installed)
+        std::cerr << ntmd::logdebug << "Installed kernel capture filter on " << mDevice->name
+                  << ": " << expression << "\n";
+    else
+        std::cerr << ntmd::logwarn << "Proceeding without a kernel capture filter on "
+                  << mDevice->name
+                  << ", uninteresting packets will be discarded after being copied to "
+                     "userspace.\n";
+}
+
+void InterfaceCapture::joinFanout(int group)
+{
+    /* libpcap uses a packet socket on linux as well, so the fanout option can be set on its
+     * descriptor the same way as on our own ring socket. */
+    const int fd = mRing ? mRing->fd() : pcap_fileno(mHandle);
+
+    int arg = (group & 0xffff) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+    if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0)
+    {
+        std::cerr << ntmd::logerror << "Could not join capture socket on " << mDevice->name
+                  << " to PACKET_FANOUT group " << group << ". Error: " << strerror(errno)
+                  << "\n";
+        std::exit(1);
+    }
+
+    mFanoutGroup = group;
+}
+
+int InterfaceCapture::dispatch()
+{
+    if (mRing)
+        return mRing->dispatch(SnifferLoop::pktCallback, reinterpret_cast<u_char*>(this));
+    else
+        return pcap_dispatch(mHandle, -1, SnifferLoop::pktCallback,
+                             reinterpret_cast<u_char*>(this));
+}
+
+int InterfaceCapture::selectableFd() const
+{
+    return mRing ? mRing->fd() : pcap_get_selectable_fd(mHandle);
+}
+
+void InterfaceCapture::sampleStats(uint64_t& received, uint64_t& dropped)
+{
+    received = 0;
+    dropped = 0;
+
+    if (mRing)
+    {
+        mRing->stats(received, dropped);
+    }
+    else if (mHandle != nullptr)
+    {
+        pcap_stat st;
+        if (pcap_stats(mHandle, &st) == 0)
+        {
+            received = st.ps_recv;
+            dropped = st.ps_drop;
+        }
+    }
+}
+
+bool InterfaceCapture::maintenance(std::time_t now)
+{
+    bool reopened = false;
+
+    if (now >= mNextStatsSample)
+    {
+        mNextStatsSample = now + 1;
+
+        uint64_t received, dropped;
+        sampleStats(received, dropped);
+
+        const uint64_t previousDropped = mKernelDropped;
+        mFilterAccepted = mClosedReceived + received;
+        mKernelDropped = mClosedDropped + dropped;
+
+        /* Packets dropped because our buffer was full means we aren't keeping up with bursts,
+         * give the kernel more room. Interface drops (ps_ifdrop) happen before the packets reach
+         * our socket, a larger buffer can't help those so they are only reported.
+         * Neither libpcap nor the ring can be resized in place, see grow. Rate limited since
+         * both buffers are allocated while that happens. */
+        const uint64_t maxBufferSize = static_cast<uint64_t>(mCfg.maxBufferSize) << 20;
+        if (mKernelDropped > previousDropped && mBufferSize < maxBufferSize &&
+            now >= mNextBufferGrowth)
+        {
+            mNextBufferGrowth = now + 5;
+            mBufferSize = std::min<uint64_t>(mBufferSize * 2, maxBufferSize);
+
+            std::cerr << ntmd::lognotice << "Kernel dropped "
+                      << (mKernelDropped - previousDropped) << " packets on " << mDevice->name
+                      << ", growing capture buffer to " << (mBufferSize >> 20) << " MB.\n";
+
+            grow();
+            reopened = true;
+        }
+    }
+
+    /* Addresses changing (DHCP renewals, VPNs, ...) would leave the filter rejecting our own
+     * traffic, so regenerate it whenever they do. */
+    if (now >= mNextAddressCheck)
+    {
+        mNextAddressCheck = now + 30;
+
+        if (mIPList.reload(mDevice))
+        {
+            std::cerr << ntmd::loginfo << "Local addresses for device " << mDevice->name
+                      << " changed, regenerating kernel capture filter.\n";
+            installFilter();
+        }
+    }
+
+    return reopened;
+}
+
+InterfaceCapture::~InterfaceCapture()
+{
+    if (mHandle != nullptr)
+        pcap_close(mHandle);
+}
+
+} // namespace ntmd
\ No newline at end of file
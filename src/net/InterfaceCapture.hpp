@@ -0,0 +1,110 @@
+#pragma once
+
+#include "IPList.hpp"
+#include "PacketRing.hpp"
+#include "config/Config.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+
+#include <pcap.h>
+
+namespace ntmd {
+
+class CaptureWorker;
+struct SnifferLoop;
+
+/* Capture socket for a single network interface, owned by a CaptureWorker. Keeps everything that
+ * is specific to the interface: its local addresses, link layer type, kernel filter, capture
+ * buffer and statistics. */
+class InterfaceCapture
+{
+  public:
+    InterfaceCapture(const Config& cfg, const pcap_if* device, CaptureWorker& worker);
+    ~InterfaceCapture();
+
+    InterfaceCapture(const InterfaceCapture&) = delete;
+    InterfaceCapture& operator=(const InterfaceCapture&) = delete;
+
+    /* Join the capture socket to the PACKET_FANOUT group with the given id.
+     * Flows are distributed by their hash so every worker sees complete flows. */
+    void joinFanout(int group);
+
+    /* Process every packet that is ready without blocking.
+     * Returns the number of packets processed, or -1 on error. */
+    int dispatch();
+
+    /* Descriptor that becomes readable when packets are ready, for use with epoll.
+     * Changes when the capture is reopened. */
+    int selectableFd() const;
+
+    /* Periodic upkeep run from the capture thread between dispatches: samples the kernel
+     * capture statistics, grows the kernel buffer if packets are being dropped and regenerates
+     * the filter if the local addresses changed. Returns true if the capture was reopened and
+     * selectableFd changed. */
+    bool maintenance(std::time_t now);
+
+    const char* name() const { return mDevice->name; }
+
+    /* Kernel capture statistics sampled once a second, cumulative across capture reopens.
+     * Safe to call from any thread. */
+    uint64_t filterAccepted() const { return mFilterAccepted; }
+    uint64_t kernelDropped() const { return mKernelDropped; }
+    uint64_t bufferSize() const { return mBufferSize; }
+
+    friend struct SnifferLoop;
+
+  private:
+    /* Open (or reopen) the capture socket with the current buffer size, install the kernel
+     * filter and rejoin the fanout group if we were part of one. */
+    void open();
+
+    /* Close the capture socket, folding its statistics into the cumulative counters. */
+    void close();
+
+    /* Replace the capture socket with one of the current buffer size, closing the old one only
+     * once the new one is capturing in its place. */
+    void grow();
+
+    /* Build a kernel filter from the discard rules and our local addresses and install it on
+     * the capture socket. */
+    void installFilter();
+
+    /* Read the kernel statistics of the current capture socket. */
+    void sampleStats(uint64_t& received, uint64_t& dropped);
+
+    const Config& mCfg;
+    const pcap_if* mDevice;
+    CaptureWorker& mWorker;
+
+    IPList mIPList;
+
+    /* Link layer header type of the captured packets (DLT_EN10MB, DLT_RAW, ...). */
+    int mLinkType{DLT_EN10MB};
+
+    pcap_t* mHandle{nullptr};
+
+    /* Only set when the ring capture backend is configured, mHandle is unused in that case. */
+    std::unique_ptr<PacketRing> mRing;
+
+    /* Bytes to capture of each packet, either everything or just enough for the headers. */
+    int mSnaplen;
+
+    int mFanoutGroup{-1};
+
+    /* Statistics of capture sockets that have since been replaced by a larger buffer. */
+    uint64_t mClosedReceived{0};
+    uint64_t mClosedDropped{0};
+
+    std::atomic<uint64_t> mFilterAccepted{0};
+    std::atomic<uint64_t> mKernelDropped{0};
+    std::atomic<uint64_t> mBufferSize{0};
+
+    std::time_t mNextStatsSample{0};
+    std::time_t mNextAddressCheck{0};
+    std::time_t mNextBufferGrowth{0};
+};
+
+} // namespace ntmd
\ No newline at end of file
@@ -11,19 +11,42 @@
 
 namespace ntmd {
 
-Packet::Packet(const pcap_pkthdr* header, const u_char* rawPkt, const IPList& iplist)
+Packet::Packet(const pcap_pkthdr* header, const u_char* rawPkt, const IPList& iplist,
+               int linkType)
 {
+    /* Find where the ip header starts and the protocol it carries based on the link layer. */
+    unsigned linkLen;
+    uint16_t etherType;
+    switch (linkType)
+    {
+    case DLT_EN10MB:
+        linkLen = sizeof(ethhdr); // ethernet header is always 14 bytes
+        etherType = ntohs(((ether_header*)rawPkt)->ether_type);
+        break;
+    case DLT_LINUX_SLL:
+        linkLen = 16; // protocol type is the last 2 bytes of the cooked header
+        etherType = ntohs(*(uint16_t*)(rawPkt + 14));
+        break;
+    case DLT_RAW:
+    case DLT_IPV4:
+        /* Devices without a link layer (tun, ppp, ...) only carry the ip packet. */
+        linkLen = 0;
+        etherType = header->caplen > 0 && (rawPkt[0] >> 4) == 4 ? ETHERTYPE_IP : 0;
+        break;
+    default:
+        this->discard = true;
+        return;
+    }
+
     /* Discard anything but IPV4 packets for now. */
     /* TODO: Support IPV6 */
-    ether_header* eth_header = (ether_header*)rawPkt;
-    if (ntohs(eth_header->ether_type) != ETHERTYPE_IP)
+    if (header->caplen < linkLen + sizeof(iphdr) || etherType != ETHERTYPE_IP)
     {
         this->discard = true;
         return;
     }
 
-    // skip over ethernet header ( always 14 bytes ) and use ip header
-    iphdr* ipHeader = (iphdr*)(rawPkt + sizeof(ethhdr));
+    iphdr* ipHeader = (iphdr*)(rawPkt + linkLen);
     unsigned short ipHeaderLen = ipHeader->ihl * 4;
 
     this->len = header->len;
@@ -43,7 +66,16 @@ Packet::Packet(const pcap_pkthdr* header, const u_char* rawPkt, const IPList& ip
         return;
     }
 
-    int offset = (ipHeaderLen) + sizeof(ethhdr);
+    uint32_t offset = (ipHeaderLen) + linkLen;
+
+    /* With a truncated snapshot length we still need the ports of the transport header, which are
+     * within the first 8 bytes for every protocol we handle. */
+    if (header->caplen < offset + 8)
+    {
+        this->discard = true;
+        return;
+    }
+
     switch (this->protocol)
     {
     case IPPROTO_TCP: {
@@ -10,6 +10,10 @@
 
 namespace ntmd {
 
+/* Number of bytes needed from the start of a packet to parse everything ntmd reads: the ethernet
+ * header, an IPv4 header with the maximum amount of options and the transport header ports. */
+inline constexpr int HEADER_SNAPLEN = 128;
+
 enum class Direction
 {
     Unknown,
@@ -33,7 +37,10 @@ enum class PacketType
 
 struct Packet
 {
-    Packet(const pcap_pkthdr* header, const u_char* rawPkt, const IPList& iplist);
+    /* Parse the headers of a captured packet whose link layer header is of the given pcap
+     * DLT_ type. Ethernet, linux cooked captures and raw ip packets are supported. */
+    Packet(const pcap_pkthdr* header, const u_char* rawPkt, const IPList& iplist,
+           int linkType = DLT_EN10MB);
     ~Packet() = default;
 
     friend std::ostream& operator<<(std::ostream& os, const Packet& pkt);
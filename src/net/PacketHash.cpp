@@ -1,8 +1,21 @@
 #include "PacketHash.hpp"
 #include "net/Packet.hpp"
 
+#include <random>
+
 namespace ntmd {
 
+const std::array<uint64_t, 2>& packetHashKey()
+{
+    static const std::array<uint64_t, 2> key = [] {
+        std::random_device random;
+        auto word = [&random] { return static_cast<uint64_t>(random()) << 32 | random(); };
+        return std::array<uint64_t, 2>{word(), word()};
+    }();
+
+    return key;
+}
+
 PacketHash::PacketHash(const Packet& pkt)
 {
     /* The /proc/net table has the socket information listed in local/remote format, so to associate
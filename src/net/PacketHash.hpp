@@ -2,10 +2,15 @@
 
 #include "net/Packet.hpp"
 
+#include <array>
 #include <cstdint>
 
 namespace ntmd {
 
+/* Key of the PacketHash hash, drawn at random the first time it is needed. The tuples of unmatched
+ * packets are chosen by remote hosts, without the key they can't pick tuples that collide. */
+const std::array<uint64_t, 2>& packetHashKey();
+
 /* Hash to identify similar packets by their local ip/port and remote ip/port. This is to be able to
  * identify the socket associated with sniffed packets since that information is listed in the
  * /proc/net/ table for said socket.*/
@@ -39,13 +44,22 @@ struct PacketHash
 namespace std {
 using ntmd::PacketHash;
 
+/* The tuple is packed into two 64 bit words which are keyed and multiplied together, folding the
+ * high half of the 128 bit product back into the low half. Every bit of the addresses and ports
+ * affects every bit of the result, unlike xor-ing the fields together which maps the many sockets
+ * that only differ in their port into a handful of neighbouring values. */
 template <>
 struct hash<PacketHash>
 {
     std::size_t operator()(const PacketHash& p) const
     {
-        return ((hash<uint32_t>()(p.ip1) ^ (hash<uint16_t>()(p.port1) << 1)) >> 1) ^
-               (hash<uint32_t>()(p.ip2) << 1) ^ (hash<uint16_t>()(p.port2) << 1) >> 1;
+        const uint64_t ips = (static_cast<uint64_t>(p.ip1) << 32) | p.ip2;
+        const uint64_t ports = (static_cast<uint64_t>(p.port1) << 16) | p.port2;
+
+        const std::array<uint64_t, 2>& key = ntmd::packetHashKey();
+        const unsigned __int128 product =
+            static_cast<unsigned __int128>(ips ^ key[0]) * (ports ^ key[1]);
+        return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
     }
 };
 
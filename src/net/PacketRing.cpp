@@ -0,0 +1,203 @@
+#include "PacketRing.hpp"
+#include "Daemon.hpp"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <pcap.h>
+
+namespace ntmd {
+
+PacketRing::PacketRing(const std::string& device, int blockSize, int blockCount, int timeout,
+                       bool promiscuous)
+{
+    /* Created with protocol 0 the socket receives nothing until bind gives it the protocol and
+     * the device, otherwise the ring would fill with packets from every interface while it is
+     * set up. The capture filter is attached once it is bound. */
+    mFd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (mFd < 0)
+    {
+        std::cerr << ntmd::logerror << "Could not open packet socket for ring capture on "
+                  << device << ". Error: " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(mFd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    {
+        std::cerr << ntmd::logerror
+                  << "Kernel does not support TPACKET_V3 packet rings, use the libpcap backend "
+                     "instead. Error: "
+                  << strerror(errno) << "\n";
+        std::exit(1);
+    }
+
+    /* Blocks must be a multiple of the page size, round up rather than refusing the config. */
+    const unsigned pageSize = getpagesize();
+    mBlockSize = ((blockSize + pageSize - 1) / pageSize) * pageSize;
+    mBlockCount = blockCount > 0 ? blockCount : 1;
+    if (mBlockSize != static_cast<unsigned>(blockSize))
+    {
+        std::cerr << ntmd::logwarn << "Ring block size " << blockSize
+                  << " is not a multiple of the page size, using " << mBlockSize << " instead.\n";
+    }
+
+    /* With TPACKET_V3 packets are variable length inside a block so the frame size is only used
+     * by the kernel to sanity check the ring geometry. */
+    const unsigned frameSize = TPACKET_ALIGNMENT << 7;
+
+    tpacket_req3 req{};
+    req.tp_block_size = mBlockSize;
+    req.tp_block_nr = mBlockCount;
+    req.tp_frame_size = frameSize;
+    req.tp_frame_nr = (mBlockSize * mBlockCount) / frameSize;
+    req.tp_retire_blk_tov = timeout;
+    req.tp_feature_req_word = 0;
+
+    if (setsockopt(mFd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    {
+        std::cerr << ntmd::logerror << "Could not create packet ring of " << mBlockCount
+                  << " blocks of " << mBlockSize << " bytes. Error: " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+
+    mMapSize = static_cast<std::size_t>(mBlockSize) * mBlockCount;
+    void* map = mmap(nullptr, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, mFd, 0);
+    if (map == MAP_FAILED)
+    {
+        /* MAP_LOCKED can fail under a low RLIMIT_MEMLOCK, the ring still works without it. */
+        map = mmap(nullptr, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    }
+
+    if (map == MAP_FAILED)
+    {
+        std::cerr << ntmd::logerror
+                  << "Could not memory map packet ring. Error: " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+    mMap = static_cast<uint8_t*>(map);
+
+    const int ifindex = if_nametoindex(device.c_str());
+    if (ifindex == 0)
+    {
+        std::cerr << ntmd::logerror << "Could not find interface index for device " << device
+                  << ". Error: " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+
+    sockaddr_ll addr{};
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+
+    if (bind(mFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+    {
+        std::cerr << ntmd::logerror << "Could not bind packet ring to device " << device
+                  << ". Error: " << strerror(errno) << "\n";
+        std::exit(1);
+    }
+
+    /* Devices without a link layer (tun, ppp, wireguard) hand the packet socket bare IP packets,
+     * everything else gets ethernet framing. */
+    ifreq ifr{};
+    strncpy(ifr.ifr_name, device.c_str(), IFNAMSIZ - 1);
+    if (ioctl(mFd, SIOCGIFHWADDR, &ifr) == 0 && ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER &&
+        ifr.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK)
+    {
+        mLinkType = DLT_RAW;
+    }
+
+    if (promiscuous)
+    {
+        packet_mreq mreq{};
+        mreq.mr_ifindex = ifindex;
+        mreq.mr_type = PACKET_MR_PROMISC;
+
+        if (setsockopt(mFd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+            std::cerr << ntmd::logwarn
+                      << "Error setting ring into promiscuous mode, proceeding with it off.\n";
+    }
+
+    std::cerr << ntmd::loginfo << "Mapped TPACKET_V3 ring on " << device << " with "
+              << mBlockCount << " blocks of " << mBlockSize << " bytes.\n";
+}
+
+int PacketRing::dispatch(pcap_handler callback, u_char* user)
+{
+    int count = 0;
+    for (unsigned walked = 0; walked < mBlockCount; walked++)
+    {
+        auto* desc = reinterpret_cast<tpacket_block_desc*>(mMap + mBlockIndex * mBlockSize);
+        if ((__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+            break;
+
+        count += walkBlock(reinterpret_cast<uint8_t*>(desc), callback, user);
+
+        /* Hand the block back to the kernel only after every packet in it has been processed. */
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        mBlockIndex = (mBlockIndex + 1) % mBlockCount;
+    }
+
+    return count;
+}
+
+int PacketRing::walkBlock(uint8_t* block, pcap_handler callback, u_char* user)
+{
+    auto* desc = reinterpret_cast<tpacket_block_desc*>(block);
+    const unsigned packets = desc->hdr.bh1.num_pkts;
+
+    auto* hdr = reinterpret_cast<tpacket3_hdr*>(block + desc->hdr.bh1.offset_to_first_pkt);
+    for (unsigned i = 0; i < packets; i++)
+    {
+        /* Present the ring header the same way libpcap would so Packet doesn't care where the
+         * bytes came from. The packet data itself is never copied. */
+        pcap_pkthdr pkthdr;
+        pkthdr.ts.tv_sec = hdr->tp_sec;
+        pkthdr.ts.tv_usec = hdr->tp_nsec / 1000;
+        pkthdr.caplen = hdr->tp_snaplen;
+        pkthdr.len = hdr->tp_len;
+
+        callback(user, &pkthdr, reinterpret_cast<const u_char*>(hdr) + hdr->tp_mac);
+
+        hdr = reinterpret_cast<tpacket3_hdr*>(reinterpret_cast<uint8_t*>(hdr) +
+                                              hdr->tp_next_offset);
+    }
+
+    return packets;
+}
+
+void PacketRing::stats(uint64_t& received, uint64_t& dropped)
+{
+    tpacket_stats_v3 st{};
+    socklen_t len = sizeof(st);
+    if (getsockopt(mFd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0)
+    {
+        /* tp_packets already includes the packets counted in tp_drops. */
+        mReceived += st.tp_packets;
+        mDropped += st.tp_drops;
+    }
+
+    received = mReceived;
+    dropped = mDropped;
+}
+
+PacketRing::~PacketRing()
+{
+    if (mMap != nullptr)
+        munmap(mMap, mMapSize);
+
+    if (mFd >= 0)
+        close(mFd);
+}
+
+} // namespace ntmd
\ No newline at end of file
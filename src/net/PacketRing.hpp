@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <pcap.h>
+
+namespace ntmd {
+
+/* AF_PACKET TPACKET_V3 memory mapped receive ring.
+ * The kernel fills whole blocks of packets directly into memory shared with ntmd, so instead of
+ * libpcap copying every packet out to a buffer and invoking a callback per pcap_dispatch call we
+ * walk each retired block in place and hand the packets to the callback without any copies.
+ * The callback signature is kept the same as libpcap's so both capture paths feed the same
+ * Packet -> ProcessResolver -> TrafficStorage pipeline. */
+class PacketRing
+{
+  public:
+    /* Opens a packet socket bound to the given device and maps a ring of blockCount blocks of
+     * blockSize bytes. A block is handed to userspace once it is full or timeout milliseconds
+     * have passed since it was opened. */
+    PacketRing(const std::string& device, int blockSize, int blockCount, int timeout,
+               bool promiscuous);
+    ~PacketRing();
+
+    PacketRing(const PacketRing&) = delete;
+    PacketRing& operator=(const PacketRing&) = delete;
+
+    /* Calls callback for every packet in every block available to userspace before returning the
+     * blocks to the kernel. Never blocks, poll fd() for POLLIN to wait for a retired block.
+     * Returns the number of packets processed. */
+    int dispatch(pcap_handler callback, u_char* user);
+
+    /* File descriptor of the underlying packet socket. */
+    int fd() const { return mFd; }
+
+    /* Link layer header type of the packets in the ring, as a pcap DLT_ value. */
+    int linkType() const { return mLinkType; }
+
+    /* Cumulative number of packets that passed the socket filter and how many of those were
+     * dropped because the ring was full. */
+    void stats(uint64_t& received, uint64_t& dropped);
+
+  private:
+    /* Walks every packet in a single block that is owned by userspace. */
+    int walkBlock(uint8_t* block, pcap_handler callback, u_char* user);
+
+    int mFd{-1};
+    int mLinkType{DLT_EN10MB};
+
+    uint8_t* mMap{nullptr};
+    std::size_t mMapSize{0};
+
+    unsigned mBlockSize{0};
+    unsigned mBlockCount{0};
+
+    /* Index of the next block we expect the kernel to retire. Blocks are retired in order. */
+    unsigned mBlockIndex{0};
+
+    /* The kernel resets PACKET_STATISTICS on every read, so they are accumulated here. */
+    uint64_t mReceived{0};
+    uint64_t mDropped{0};
+};
+
+} // namespace ntmd
\ No newline at end of file
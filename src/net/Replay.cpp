@@ -0,0 +1,226 @@
+#include "Replay.hpp"
+#include "Daemon.hpp"
+#include "net/Packet.hpp"
+#include "net/PacketHash.hpp"
+#include "proc/DeferredResolver.hpp"
+#include "traffic/DBController.hpp"
+#include "traffic/TrafficStorage.hpp"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+#include <pcap.h>
+
+namespace ntmd {
+
+/* Number of fake applications flows are spread between in a synthetic table. */
+static constexpr int SYNTHETIC_APPS = 16;
+
+Replay::Replay(const Config& cfg, const std::filesystem::path& capture,
+               const std::optional<std::filesystem::path>& table) :
+    mCfg(cfg), mCapture(capture)
+{
+    char errorBuffer[PCAP_ERRBUF_SIZE];
+    pcap_t* handle = pcap_open_offline(capture.c_str(), errorBuffer);
+    if (handle == nullptr)
+    {
+        std::cerr << ntmd::logerror << "Could not open capture file " << capture
+                  << " for replay. Error: " << errorBuffer << "\n";
+        std::exit(1);
+    }
+
+    mLinkType = pcap_datalink(handle);
+
+    pcap_pkthdr* header;
+    const u_char* data;
+    while (pcap_next_ex(handle, &header, &data) == 1)
+    {
+        mRecords.push_back({*header, mData.size()});
+        mData.insert(mData.end(), data, data + header->caplen);
+    }
+    pcap_close(handle);
+
+    std::cerr << ntmd::loginfo << "Loaded " << mRecords.size() << " packets ("
+              << mData.size() << " bytes) from " << capture << ".\n";
+
+    if (table.has_value())
+    {
+        mTable = ProcessTable::load(table.value());
+    }
+    else
+    {
+        const uint32_t local = inferLocalAddress();
+        if (local != 0)
+            mTable.addresses.push_back(local);
+    }
+
+    for (const uint32_t address : mTable.addresses)
+    {
+        in_addr ip;
+        ip.s_addr = address;
+        std::cerr << ntmd::loginfo << "Replaying with local address " << inet_ntoa(ip) << "\n";
+
+        mIPList.add(address);
+    }
+
+    if (!table.has_value())
+    {
+        mTable = synthesize();
+        std::cerr << ntmd::loginfo << "Synthesized " << mTable.sockets.size()
+                  << " sockets for the flows in the capture.\n";
+    }
+}
+
+uint32_t Replay::inferLocalAddress() const
+{
+    /* With an empty address list every packet is discarded for having an unknown direction, but
+     * only after its addresses have been parsed. */
+    const IPList none;
+    std::unordered_map<uint32_t, uint64_t> seen;
+
+    for (const Record& record : mRecords)
+    {
+        Packet pkt(&record.header, mData.data() + record.offset, none, mLinkType);
+        if (pkt.sip == 0)
+            continue;
+
+        seen[pkt.sip]++;
+        seen[pkt.dip]++;
+    }
+
+    uint32_t local = 0;
+    uint64_t most = 0;
+    for (const auto& [ip, count] : seen)
+    {
+        if (count > most)
+        {
+            local = ip;
+            most = count;
+        }
+    }
+
+    return local;
+}
+
+ProcessTable Replay::synthesize() const
+{
+    ProcessTable table;
+    table.addresses = mTable.addresses;
+
+    uint64_t nextInode = 1;
+    for (const Record& record : mRecords)
+    {
+        Packet pkt(&record.header, mData.data() + record.offset, mIPList, mLinkType);
+        if (pkt.discard || (pkt.type != PacketType::TCP && pkt.type != PacketType::UDP))
+            continue;
+
+        const PacketHash hash(pkt);
+        if (table.sockets.count(hash))
+            continue;
+
+        /* Flows are assigned to an application by their local port so that everything a server
+         * listens on ends up in one application, like it would on a real host. */
+        const int app = hash.port1 % SYNTHETIC_APPS;
+
+        table.sockets[hash] = nextInode;
+        table.processes[nextInode] = {"replay-" + std::to_string(app), 1000 + app};
+        nextInode++;
+    }
+
+    return table;
+}
+
+void Replay::run(const std::filesystem::path& dbPath)
+{
+    auto db = DBController(dbPath, mCfg.flushInterval, mCfg.rawRetentionDays,
+                           mCfg.storageEngine);
+    auto trafficStorage = TrafficStorage(mCfg.interval, db, 1, false);
+    DeferredResolver resolver(mTable, mCfg.flowCacheSize, trafficStorage, 0);
+
+    uint64_t accounted = 0;
+    uint64_t deposits = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (const Record& record : mRecords)
+    {
+        Packet pkt(&record.header, mData.data() + record.offset, mIPList, mLinkType);
+        if (pkt.discard)
+            continue;
+
+        /* Every deposit first waits for the resolver thread to credit the flows still pending,
+         * as it does live. */
+        if (trafficStorage.advance(pkt.timestamp))
+            deposits++;
+
+        resolver.add(pkt);
+        accounted++;
+    }
+
+    trafficStorage.flush();
+    if (accounted > 0)
+        deposits++;
+
+    const auto end = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    const uint64_t packets = mRecords.size();
+
+    const ResolverStats stats = resolver.resolverStats();
+    const FlowCache& flowCache = resolver.flowCache();
+    auto percent = [](uint64_t part, uint64_t whole) {
+        return whole == 0 ? 0.0 : 100.0 * part / whole;
+    };
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Replayed " << packets << " packets from " << mCapture.c_str() << " in "
+              << seconds * 1000 << " ms (" << accounted << " accounted, " << deposits
+              << " deposits)\n";
+    std::cout << "  " << (seconds > 0 ? packets / seconds : 0) << " packets/sec, "
+              << (packets > 0 ? seconds * 1e9 / packets : 0) << " ns/packet\n";
+    const uint64_t flowLookups = flowCache.hits() + flowCache.misses();
+    std::cout << "  flow cache: " << flowCache.hits() << "/" << flowLookups << " ("
+              << percent(flowCache.hits(), flowLookups) << "%)\n";
+
+    /* Flows missing from the flow cache and the indexes' lock free lookup wait for the resolver
+     * thread, only its lookups are counted. */
+    std::cout << "  index lookups: " << resolver.indexHits() << "/" << flowCache.misses() << " ("
+              << percent(resolver.indexHits(), flowCache.misses()) << "%), "
+              << resolver.pendedFlows() << " flows waited for the resolver thread\n";
+    std::cout << "  resolver thread: socket lookups " << stats.socketHits << "/" << stats.lookups
+              << " (" << percent(stats.socketHits, stats.lookups) << "%), process lookups "
+              << stats.processHits << "/" << stats.socketHits << " ("
+              << percent(stats.processHits, stats.socketHits) << "%)";
+    if (resolver.pending() > 0)
+        std::cout << ", " << resolver.pending() << " flows never resolved";
+    std::cout << "\n";
+
+    /* Writing happens on the database's own thread, wait for it separately. */
+    const auto writeStart = std::chrono::steady_clock::now();
+    db.flush();
+    const double writeSeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - writeStart).count();
+
+    const DBWriteStats writes = db.writeStats();
+    std::cout << "  database: " << writes.rows << " rows from " << writes.intervals
+              << " intervals in " << writes.commits << " commits, "
+              << (writes.commitSeconds > 0 ? writes.rows / writes.commitSeconds : 0)
+              << " rows/sec while committing, p99 commit "
+              << writes.commitLatency.percentile(0.99) / 1e6 << " ms, flush waited "
+              << writeSeconds * 1000 << " ms\n";
+    if (writes.failedCommits > 0)
+    {
+        std::cout << "  database: " << writes.failedCommits << " commits failed, "
+                  << writes.dropped << " intervals dropped\n";
+    }
+
+    const AddLatency latency = trafficStorage.addLatency();
+    std::cout << "  traffic adds: " << latency.waits.count << "/" << latency.adds
+              << " waited, at most " << latency.waits.maxNanos << " ns\n";
+}
+
+} // namespace ntmd
\ No newline at end of file
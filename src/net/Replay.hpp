@@ -0,0 +1,61 @@
+#pragma once
+
+#include "IPList.hpp"
+#include "config/Config.hpp"
+#include "proc/ProcessTable.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+#include <pcap.h>
+
+namespace ntmd {
+
+/* Replays a pcap file through the same Packet -> DeferredResolver -> TrafficStorage pipeline the
+ * live capture uses, as fast as possible and without touching /proc, so changes to the packet path
+ * can be measured and compared without live traffic.
+ * Sockets and processes come from a table recorded on a live host, or when none is given from a
+ * synthetic table where every flow in the capture gets its own socket owned by one of a handful of
+ * fake applications. Traffic is bucketed into intervals by the capture timestamps of the packets
+ * rather than the wall clock. A table is never searched again, so flows are never deferred to a
+ * later search of /proc like they can be live. */
+class Replay
+{
+  public:
+    /* Reads the whole capture into memory so disk reads aren't part of the measurement. */
+    Replay(const Config& cfg, const std::filesystem::path& capture,
+           const std::optional<std::filesystem::path>& table);
+    ~Replay() = default;
+
+    /* Run every packet through the pipeline, depositing into the database at the given path, then
+     * print throughput and how many packets were resolved to a process. */
+    void run(const std::filesystem::path& dbPath);
+
+  private:
+    struct Record
+    {
+        pcap_pkthdr header;
+        std::size_t offset; /* Offset of the packet data in mData. */
+    };
+
+    /* Guess the local address of a capture without a recorded table as the address seen in the
+     * most packets. */
+    uint32_t inferLocalAddress() const;
+
+    /* Build a table with a socket for every tcp and udp flow in the capture. */
+    ProcessTable synthesize() const;
+
+    const Config& mCfg;
+    std::filesystem::path mCapture;
+
+    int mLinkType{DLT_EN10MB};
+    std::vector<Record> mRecords;
+    std::vector<u_char> mData;
+
+    ProcessTable mTable;
+    IPList mIPList;
+};
+
+} // namespace ntmd
\ No newline at end of file
@@ -1,70 +1,127 @@
 #include "Sniffer.hpp"
 #include "Daemon.hpp"
-#include "IPList.hpp"
 #include "config/Config.hpp"
+#include "util/StringUtil.hpp"
 
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <net/if.h>
 #include <pcap/pcap.h>
 #include <string>
+#include <unistd.h>
 
 #include <pcap.h>
 
 namespace ntmd {
 
 Sniffer::Sniffer(const Config& cfg, TrafficStorage& trafficStorage) :
-    mTrafficStorage(trafficStorage), mProcessResolver(cfg.processCacheSize)
+    mTrafficStorage(trafficStorage)
 {
-    const std::string& device = cfg.interface;
-    const int promiscuous = cfg.promiscuous ? 1 : 0;
-    const int immediate = cfg.immediate ? 1 : 0;
+    const int workers = cfg.workers > 0 ? cfg.workers : 1;
 
-    findDevice(device);
-    std::cerr << ntmd::loginfo << "Chosen network device: " << mDevice->name << "\n";
+    findDevices(cfg.interface);
+    for (const pcap_if* device : mSelected)
+    {
+        std::cerr << ntmd::loginfo << "Chosen network device: " << device->name << "\n";
+    }
 
-    /* TODO: Temporary settings! Investigate each individual setting and their impact.
-     * Which ones should be configurable by user? */
-    int timeoutLimit = 100; // milliseconds
-    char errorBuffer[PCAP_ERRBUF_SIZE];
+    mBackend = cfg.backend == "ring" ? "ring" : "libpcap";
 
-    mHandle = pcap_create(mDevice->name, errorBuffer);
-    if (mHandle == nullptr)
+    for (int i = 0; i < workers; i++)
     {
-        std::cerr << ntmd::logerror << "Could not open network device interface " << mDevice->name
-                  << " for monitoring. Error: " << errorBuffer << "\n";
-        std::exit(1);
+        mWorkers.push_back(std::make_unique<CaptureWorker>(cfg, mSelected, trafficStorage, i));
     }
 
-    if (pcap_set_timeout(mHandle, timeoutLimit))
-        std::cerr << ntmd::logwarn
-                  << "Error setting packet buffer timeout, proceeding with it as instant.\n";
+    if (workers > 1)
+    {
+        /* Fanout group ids are global to the network namespace, derive ours from the pid so
+         * multiple capture processes don't end up sharing a group. */
+        const int group = getpid() & 0xffff;
+        for (const auto& worker : mWorkers)
+        {
+            worker->joinFanout(group);
+        }
 
-    if (pcap_set_immediate_mode(mHandle, immediate))
-        std::cerr << ntmd::logwarn
-                  << "Error setting handle into immediate mode, proceeding with it off.\n";
+        std::cerr << ntmd::loginfo << "Capturing on " << workers
+                  << " workers in PACKET_FANOUT groups starting at " << group << ".\n";
+    }
 
-    if (pcap_set_promisc(mHandle, promiscuous))
-        std::cerr << ntmd::logwarn
-                  << "Error setting handle into promiscuous mode, proceeding with it off.\n";
+    for (const pcap_if* device : mSelected)
+    {
+        mPacketsBaseline.push_back(interfaceCounter(device->name, "rx_packets") +
+                                   interfaceCounter(device->name, "tx_packets"));
+        mDroppedBaseline.push_back(interfaceCounter(device->name, "rx_dropped"));
+    }
 
-    // TODO: Handle all warnings?
-    if (pcap_activate(mHandle))
+    for (int i = 1; i < workers; i++)
     {
-        std::cerr << ntmd::logerror
-                  << "Error activating configured pcap handle, cannot proceed. Error: "
-                  << errorBuffer << "\n";
-        std::exit(1);
+        CaptureWorker* worker = mWorkers[i].get();
+        mThreads.emplace_back([this, worker] {
+            while (mRunning)
+            {
+                worker->dispatch();
+            }
+        });
     }
+}
 
-    mIPList.init(mDevice);
+int Sniffer::dispatch() { return mWorkers[0]->dispatch(); }
+
+CaptureStats Sniffer::stats() const
+{
+    CaptureStats stats;
+    stats.backend = mBackend;
+    stats.workers = mWorkers.size();
+
+    for (std::size_t i = 0; i < mSelected.size(); i++)
+    {
+        const char* name = mSelected[i]->name;
+
+        InterfaceStats iface;
+        iface.name = name;
+
+        /* Every worker has its own socket on every interface. */
+        for (const auto& worker : mWorkers)
+        {
+            const InterfaceCapture& capture = *worker->interfaces()[i];
+            iface.filterAccepted += capture.filterAccepted();
+            iface.kernelDropped += capture.kernelDropped();
+            iface.bufferSize += capture.bufferSize();
+        }
+
+        /* The interface counters include every packet regardless of the filter. Both counters
+         * are sampled at different times so clamp rather than underflow. */
+        const uint64_t seen = interfaceCounter(name, "rx_packets") +
+                              interfaceCounter(name, "tx_packets") - mPacketsBaseline[i];
+        iface.filterRejected = seen > iface.filterAccepted ? seen - iface.filterAccepted : 0;
+
+        /* Same source libpcap uses for ps_ifdrop, read directly so the ring backend reports it
+         * too. */
+        iface.interfaceDropped = interfaceCounter(name, "rx_dropped") - mDroppedBaseline[i];
+
+        stats.filterAccepted += iface.filterAccepted;
+        stats.filterRejected += iface.filterRejected;
+        stats.kernelDropped += iface.kernelDropped;
+        stats.interfaceDropped += iface.interfaceDropped;
+        stats.bufferSize += iface.bufferSize;
+
+        stats.interfaces.push_back(iface);
+    }
+
+    return stats;
 }
 
-int Sniffer::dispatch()
+uint64_t Sniffer::interfaceCounter(const char* device, const char* counter)
 {
-    return pcap_dispatch(mHandle, -1, SnifferLoop::pktCallback, reinterpret_cast<u_char*>(this));
+    std::ifstream fs(std::string("/sys/class/net/") + device + "/statistics/" + counter);
+
+    uint64_t value = 0;
+    fs >> value;
+    return value;
 }
 
-void Sniffer::findDevice(const std::string& device)
+void Sniffer::findDevices(const std::string& devices)
 {
     char errorBuffer[PCAP_ERRBUF_SIZE];
     if (pcap_findalldevs(&mDevices, errorBuffer))
@@ -74,38 +131,119 @@ void Sniffer::findDevice(const std::string& device)
         std::exit(1);
     }
 
-    if (!device.empty())
+    if (util::trim(devices).empty())
+    {
+        /* Use the first device in the list as the default if no
+         * device specified in the config or as a command line argument. */
+        if (mDevices != nullptr)
+            mSelected.push_back(mDevices);
+    }
+    else if (util::trim(devices) == "any")
     {
+        /* libpcap's own "any" device uses cooked headers and can't be used with PACKET_FANOUT
+         * groups per device, so open every real interface that is up instead. Loopback traffic
+         * is skipped since it would be accounted twice (once as outgoing, once as incoming). */
         for (pcap_if_t* i = mDevices; i != NULL; i = i->next)
         {
-            // TODO: Log devices found probably in verbose mode
-            if (std::strcmp(i->name, device.c_str()) == 0)
-            {
-                mDevice = i;
-                break;
-            }
+            if ((i->flags & PCAP_IF_LOOPBACK) || !(i->flags & PCAP_IF_UP))
+                continue;
+
+            /* Skip pseudo devices (any, nflog, usbmon, bluetooth...) that aren't network
+             * interfaces. */
+            if (if_nametoindex(i->name) == 0 || std::strcmp(i->name, "any") == 0)
+                continue;
+
+            mSelected.push_back(i);
         }
     }
     else
     {
-        /* Use the first device in the list as the default if no
-         * device specified in the config or as a command line argument. */
-        mDevice = mDevices;
+        for (const std::string& item : util::split(devices, ','))
+        {
+            const std::string device = util::trim(item);
+            if (device.empty())
+                continue;
+
+            const pcap_if* found = nullptr;
+            for (pcap_if_t* i = mDevices; i != NULL; i = i->next)
+            {
+                // TODO: Log devices found probably in verbose mode
+                if (std::strcmp(i->name, device.c_str()) == 0)
+                {
+                    found = i;
+                    break;
+                }
+            }
+
+            if (found == nullptr)
+            {
+                std::cerr << ntmd::logerror << "Could not find specified interface device \""
+                          << device
+                          << "\", either correct the interface or use no value for ntmd to "
+                             "select the first device found.\n";
+                std::exit(1);
+            }
+
+            mSelected.push_back(found);
+        }
     }
 
-    if (mDevice == nullptr)
+    if (mSelected.empty())
     {
-        std::cerr << ntmd::logerror << "Could not find specified interface device \"" << device
-                  << "\", either correct the interface or use no value for ntmd to select the "
-                     "first device found.\n";
+        std::cerr << ntmd::logerror << "Could not find any interface device to monitor for \""
+                  << devices << "\".\n";
         std::exit(1);
     }
 }
 
+void Sniffer::logCaptureCost() const
+{
+    uint64_t packets = 0, nanos = 0, flowHits = 0, flowMisses = 0;
+    for (const auto& worker : mWorkers)
+    {
+        packets += worker->packetCount();
+        nanos += worker->captureNanos();
+        flowHits += worker->resolver().flowCache().hits();
+        flowMisses += worker->resolver().flowCache().misses();
+    }
+
+    if (packets == 0)
+        return;
+
+    const double nsPerPacket = static_cast<double>(nanos) / packets;
+    std::cerr << ntmd::lognotice << mBackend << " capture backend processed " << packets
+              << " packets on " << mWorkers.size() << " worker(s) using "
+              << static_cast<uint64_t>(nsPerPacket) << " ns of CPU per packet (~"
+              << static_cast<uint64_t>(1e9 / nsPerPacket) << " pps per core).\n";
+
+    if (flowHits + flowMisses > 0)
+    {
+        std::cerr << ntmd::lognotice << "Flow cache resolved "
+                  << flowHits * 100 / (flowHits + flowMisses) << "% of packets.\n";
+    }
+
+    const AddLatency latency = mTrafficStorage.addLatency();
+    if (latency.waits.count > 0)
+    {
+        std::cerr << ntmd::lognotice << latency.waits.count << " of " << latency.adds
+                  << " traffic adds waited on their shard, 99% within "
+                  << latency.waits.percentile(0.99) << " ns and at most " << latency.waits.maxNanos
+                  << " ns.\n";
+    }
+}
+
 Sniffer::~Sniffer()
 {
-    if (mHandle != nullptr)
-        pcap_close(mHandle);
+    mRunning = false;
+    for (std::thread& thread : mThreads)
+    {
+        thread.join();
+    }
+
+    logCaptureCost();
+
+    /* Workers must be closed before the device list they were opened from is freed. */
+    mWorkers.clear();
 
     if (mDevices != nullptr)
         pcap_freealldevs(mDevices);
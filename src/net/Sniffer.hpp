@@ -1,46 +1,104 @@
 #pragma once
 
-#include "IPList.hpp"
+#include "CaptureWorker.hpp"
 #include "config/Config.hpp"
-#include "proc/ProcessResolver.hpp"
 #include "traffic/TrafficStorage.hpp"
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <pcap.h>
 
 namespace ntmd {
 
 /* Kind of hacky solution to getting the static pktCallback access to the private member variables
- * of Sniffer. Required since you can't declare a friend static method directly. */
+ * of InterfaceCapture and CaptureWorker. Required since you can't declare a friend static method
+ * directly. */
 struct SnifferLoop
 {
-    friend class Sniffer;
     static void pktCallback(u_char* user, const pcap_pkthdr* hdr, const u_char* bytes);
 };
 
+/* Counters describing what the capture backend has seen on an interface since startup. */
+struct InterfaceStats
+{
+    std::string name;
+
+    /* Packets that passed the kernel capture filter and were handed to ntmd. */
+    uint64_t filterAccepted{0};
+
+    /* Packets seen on the interface that the kernel capture filter dropped. Derived from the
+     * interface counters in /sys/class/net so it is approximate. */
+    uint64_t filterRejected{0};
+
+    /* Packets that passed the filter but were dropped because the capture buffer was full
+     * (ps_drop). Any of these means some traffic was never attributed to a process. */
+    uint64_t kernelDropped{0};
+
+    /* Packets dropped by the interface itself before reaching the capture socket (ps_ifdrop). */
+    uint64_t interfaceDropped{0};
+
+    /* Current total kernel capture buffer size in bytes across all workers. */
+    uint64_t bufferSize{0};
+};
+
+/* Capture statistics exposed through the API, totals across every interface. */
+struct CaptureStats : InterfaceStats
+{
+    std::string backend;
+    int workers{0};
+
+    std::vector<InterfaceStats> interfaces;
+};
+
 class Sniffer
 {
   public:
     Sniffer(const Config& cfg, TrafficStorage& trafficStorage);
     ~Sniffer();
 
-    /* Trys to find and set the device given or if the device parameter
-     * is empty will use the first device found. */
-    void findDevice(const std::string& device);
+    /* Trys to find and set the devices given as a comma separated list. "any" selects every
+     * interface that is up (except loopback) and an empty list will use the first device found. */
+    void findDevices(const std::string& devices);
 
+    /* Receive and process a batch of packets on the calling thread using the first capture
+     * worker. Any additional workers run on their own threads. Returns the number of packets
+     * processed. */
     int dispatch();
 
-    friend void SnifferLoop::pktCallback(u_char* user, const pcap_pkthdr* hdr, const u_char* bytes);
+    /* Aggregate capture statistics across all workers. Safe to call from any thread. */
+    CaptureStats stats() const;
 
   private:
-    IPList mIPList;
-    ProcessResolver mProcessResolver;
-    TrafficStorage& mTrafficStorage;
+    /* Read one of the kernel's statistics counters for a device from /sys/class/net,
+     * these count every packet regardless of any capture filter. */
+    static uint64_t interfaceCounter(const char* device, const char* counter);
+
+    /* Logs the packet count and CPU time spent per packet by the capture backend so the libpcap
+     * and ring backends can be compared on the same host. */
+    void logCaptureCost() const;
 
-    pcap_if* mDevice{nullptr};
+    /* Worker 0 is driven by the caller of dispatch, the rest each have a thread in mThreads. */
+    std::vector<std::unique_ptr<CaptureWorker>> mWorkers;
+    std::vector<std::thread> mThreads;
+    std::atomic<bool> mRunning{true};
+
+    const char* mBackend;
+
+    /* Only used to report how long the workers waited to add traffic. */
+    const TrafficStorage& mTrafficStorage;
+
+    /* Devices being captured on, pointing into mDevices. */
+    std::vector<const pcap_if*> mSelected;
     pcap_if_t* mDevices{nullptr};
-    pcap_t* mHandle{nullptr};
+
+    /* Interface counters of every selected device when capture started. */
+    std::vector<uint64_t> mPacketsBaseline;
+    std::vector<uint64_t> mDroppedBaseline;
 };
 
 } // namespace ntmd
\ No newline at end of file
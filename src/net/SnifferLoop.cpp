@@ -1,6 +1,8 @@
+#include "CaptureWorker.hpp"
+#include "InterfaceCapture.hpp"
 #include "Packet.hpp"
 #include "Sniffer.hpp"
-#include "proc/ProcessIndex.hpp"
+#include "proc/DeferredResolver.hpp"
 
 #include <pcap.h>
 
@@ -8,18 +10,17 @@ namespace ntmd {
 
 void SnifferLoop::pktCallback(u_char* user, const pcap_pkthdr* hdr, const u_char* rawPkt)
 {
-    Sniffer* s = reinterpret_cast<Sniffer*>(user);
+    InterfaceCapture* c = reinterpret_cast<InterfaceCapture*>(user);
 
-    Packet pkt(hdr, rawPkt, s->mIPList);
+    Packet pkt(hdr, rawPkt, c->mIPList, c->mLinkType);
 
     /* We will discard packets we don't care about in the future.
      * For now lets see all of them for debugging. */
     if (pkt.discard)
         return;
 
-    const Process& process = s->mProcessResolver.resolve(pkt);
-
-    s->mTrafficStorage.add(process, pkt);
+    /* Packets that can't be resolved yet are buffered and credited by the resolver thread. */
+    c->mWorker.mResolver.add(pkt);
 }
 
 } // namespace ntmd
\ No newline at end of file
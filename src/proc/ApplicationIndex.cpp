@@ -0,0 +1,30 @@
+#include "ApplicationIndex.hpp"
+
+#include <mutex>
+#include <string>
+
+namespace ntmd {
+
+ApplicationIndex::ApplicationIndex() { intern(""); }
+
+uint32_t ApplicationIndex::intern(const std::string& name)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    const auto found = mIds.find(name);
+    if (found != mIds.end())
+        return found->second;
+
+    const uint32_t id = mNames.size();
+    mNames.push_back(name);
+    mIds.emplace(name, id);
+    return id;
+}
+
+const std::string& ApplicationIndex::name(uint32_t id)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mNames.at(id);
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ntmd {
+
+/* Index of every application name (process comm name) seen since startup, giving each a dense
+ * integer id. Processes carry the id of their name so traffic can be accounted per application by
+ * indexing an array rather than hashing and comparing the name for every packet, names are only
+ * looked up again when the traffic is handed to the database or API.
+ * Ids are never reused or removed, the number of distinct comm names on a host stays small.
+ * Id 0 is always the empty name. */
+class ApplicationIndex
+{
+  public:
+    static ApplicationIndex& instance()
+    {
+        static ApplicationIndex instance;
+        return instance;
+    }
+
+    /* Returns the id of the name, giving it the next free id if it hasn't been seen before. */
+    uint32_t intern(const std::string& name);
+
+    /* Name of an id previously returned by intern. The reference stays valid forever. */
+    const std::string& name(uint32_t id);
+
+  private:
+    ApplicationIndex();
+    ApplicationIndex(ApplicationIndex const&) = delete;
+    void operator=(ApplicationIndex const&) = delete;
+
+    std::mutex mMutex;
+
+    /* Names by id. A deque never moves its elements so references to names stay valid. */
+    std::deque<std::string> mNames;
+    std::unordered_map<std::string, uint32_t> mIds;
+};
+
+} // namespace ntmd
\ No newline at end of file
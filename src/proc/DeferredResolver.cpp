@@ -0,0 +1,208 @@
+#include "DeferredResolver.hpp"
+#include "Daemon.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+namespace ntmd {
+
+/* Process events are applied, and deferred flows checked on, at least this often even without any
+ * flows to resolve. */
+static constexpr auto SYNC_INTERVAL = std::chrono::seconds(1);
+
+/* Times the search for a flow can be deferred before it is given up on. */
+static constexpr int MAX_DEFERRED_RETRIES = 3;
+
+DeferredResolver::DeferredResolver(int processIndexCacheSize, int flowCacheSize,
+                                   TrafficStorage& trafficStorage, int shard) :
+    mProcessResolver(processIndexCacheSize),
+    mFlowCache(flowCacheSize), mTrafficStorage(trafficStorage), mShard(shard)
+{
+    start();
+}
+
+DeferredResolver::DeferredResolver(const ProcessTable& table, int flowCacheSize,
+                                   TrafficStorage& trafficStorage, int shard) :
+    mProcessResolver(table),
+    mFlowCache(flowCacheSize), mTrafficStorage(trafficStorage), mShard(shard)
+{
+    start();
+}
+
+void DeferredResolver::start()
+{
+    mDepositHook = mTrafficStorage.addDepositHook(
+        {[this] { requestDrain(); },
+         [this](std::chrono::steady_clock::time_point deadline) { drain(deadline); }});
+    mThread = std::thread(&DeferredResolver::resolveLoop, this);
+}
+
+void DeferredResolver::add(const Packet& pkt)
+{
+    /* Read before resolving, if anything is invalidated in the meantime the cached result is
+     * already stale. */
+    const uint64_t generation = mProcessResolver.generation();
+
+    if (auto app = mFlowCache.find(pkt, generation))
+    {
+        mTrafficStorage.add(app.value(), pkt, mShard);
+        return;
+    }
+
+    if (auto app = mProcessResolver.find(pkt))
+    {
+        mIndexHits++;
+        mFlowCache.insert(pkt, app.value(), generation);
+        mTrafficStorage.add(app.value(), pkt, mShard);
+        return;
+    }
+
+    const PacketHash hash(pkt);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto [it, inserted] = mPending.try_emplace(hash, PendingFlow{pkt});
+
+    TrafficLine& traffic = it->second.traffic;
+    if (pkt.direction == Direction::Incoming)
+    {
+        traffic.bytesRx += pkt.len;
+        traffic.pktRxCount++;
+    }
+    else
+    {
+        traffic.bytesTx += pkt.len;
+        traffic.pktTxCount++;
+    }
+
+    if (inserted)
+    {
+        mPendedFlows++;
+        mQueue.push_back(hash);
+        mQueued.notify_one();
+    }
+}
+
+std::size_t DeferredResolver::pending() const
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mPending.size();
+}
+
+ResolverStats DeferredResolver::resolverStats() const
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mStats;
+}
+
+void DeferredResolver::resolveLoop()
+{
+    while (mRunning)
+    {
+        std::vector<PacketHash> queue;
+        bool draining;
+        bool deferred;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mQueued.wait_for(lock, SYNC_INTERVAL, [this] {
+                return !mQueue.empty() || mDrainRequested || !mRunning;
+            });
+
+            queue.swap(mQueue);
+            draining = mDrainRequested;
+            mDrainRequested = false;
+            deferred = !mDeferred.empty();
+            mResolving = !queue.empty() || draining;
+        }
+
+        mProcessResolver.sync();
+
+        /* Deferred flows are retried once all of /proc may be searched again, and a deposit
+         * searches it regardless so its traffic is credited in the interval it was captured in. */
+        std::vector<PacketHash> retry;
+        if (deferred && mProcessResolver.searchAll(draining))
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            retry.swap(mDeferred);
+        }
+
+        resolve(queue, draining);
+        resolve(retry, draining);
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mStats = mProcessResolver.stats();
+        mResolving = false;
+        mDrained.notify_all();
+    }
+}
+
+void DeferredResolver::resolve(const std::vector<PacketHash>& flows, bool final)
+{
+    for (const PacketHash& hash : flows)
+    {
+        Packet pkt = [&] {
+            std::unique_lock<std::mutex> lock(mMutex);
+            return mPending.at(hash).pkt;
+        }();
+
+        /* The slow part, done without holding the pending table so the capture thread can keep
+         * buffering. */
+        const Process* process = mProcessResolver.tryResolve(pkt);
+
+        /* Packets for the flow can arrive until its entry is removed, take its traffic only
+         * now so none of them are lost. Later packets are found by the capture thread. */
+        TrafficLine traffic;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            auto it = mPending.find(hash);
+
+            if (process == nullptr && !final && it->second.retries < MAX_DEFERRED_RETRIES)
+            {
+                it->second.retries++;
+                mDeferred.push_back(hash);
+                continue;
+            }
+
+            traffic = it->second.traffic;
+            mPending.erase(it);
+        }
+
+        const Process& owner = process != nullptr ? *process : mProcessResolver.unknownProcess();
+        mTrafficStorage.add(owner.app, traffic, mShard);
+    }
+}
+
+void DeferredResolver::requestDrain()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDrainRequested = true;
+    mQueued.notify_one();
+}
+
+void DeferredResolver::drain(std::chrono::steady_clock::time_point deadline)
+{
+    /* Anything left is credited in the next interval instead. */
+    std::unique_lock<std::mutex> lock(mMutex);
+    const bool drained = mDrained.wait_until(lock, deadline, [this] {
+        return mQueue.empty() && !mDrainRequested && !mResolving;
+    });
+
+    if (!drained)
+    {
+        std::cerr << ntmd::logdebug << mPending.size()
+                  << " flows were still being resolved at deposit, they will be credited in the "
+                     "next interval.\n";
+    }
+}
+
+DeferredResolver::~DeferredResolver()
+{
+    mTrafficStorage.removeDepositHook(mDepositHook);
+
+    mRunning = false;
+    mQueued.notify_all();
+    if (mThread.joinable())
+        mThread.join();
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "FlowCache.hpp"
+#include "ProcessResolver.hpp"
+#include "net/Packet.hpp"
+#include "net/PacketHash.hpp"
+#include "traffic/TrafficStorage.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ntmd {
+
+/* Accounts captured packets to their process without ever making the capture thread wait on a
+ * socket or /proc search.
+ * Packets of flows in the flow cache, or whose socket and process are already indexed, are added
+ * to the TrafficStorage straight away. Everything else has its bytes buffered per PacketHash in a
+ * pending table while a resolver thread searches for the owning process, once found the buffered
+ * bytes are credited to it (or to "Unknown Traffic"). Flows whose search was deferred by the rate
+ * limit on full searches of /proc stay pending and are retried once the next one is allowed.
+ * Pending traffic is resolved before every deposit so it is counted in the interval it was
+ * captured in. */
+class DeferredResolver
+{
+  public:
+    DeferredResolver(int processIndexCacheSize, int flowCacheSize, TrafficStorage& trafficStorage,
+                     int shard);
+
+    /* Offline resolver that only uses the given table and never reads /proc, used for replays. */
+    DeferredResolver(const ProcessTable& table, int flowCacheSize, TrafficStorage& trafficStorage,
+                     int shard);
+    ~DeferredResolver();
+
+    DeferredResolver(const DeferredResolver&) = delete;
+    DeferredResolver& operator=(const DeferredResolver&) = delete;
+
+    /* Account a packet to its process now or once it has been resolved. Called from the capture
+     * thread. */
+    void add(const Packet& pkt);
+
+    /* Number of flows currently waiting to be resolved. */
+    std::size_t pending() const;
+
+    /* Only read these from the capture thread or once it has stopped. */
+    const FlowCache& flowCache() const { return mFlowCache; }
+    uint64_t indexHits() const { return mIndexHits; }     /* Packets found in the indexes. */
+    uint64_t pendedFlows() const { return mPendedFlows; } /* Flows that had to wait. */
+
+    /* Lookups made by the resolver thread for flows that had to wait, as of its last pass. */
+    ResolverStats resolverStats() const;
+
+  private:
+    struct PendingFlow
+    {
+        Packet pkt; /* First packet of the flow, used to search for its socket. */
+        TrafficLine traffic{};
+        int retries{0}; /* Times the search for its process has been deferred. */
+    };
+
+    /* Register the deposit hook and start the resolver thread. */
+    void start();
+
+    void resolveLoop();
+
+    /* Search for the process of each flow and credit its traffic. Flows that couldn't be searched
+     * for yet are deferred to be retried, unless final, in which case they are credited to
+     * "Unknown Traffic" like any other flow that isn't found. */
+    void resolve(const std::vector<PacketHash>& flows, bool final);
+
+    /* Ask the resolver thread to credit everything that is pending now. */
+    void requestDrain();
+
+    /* Wait for the requested drain to finish, giving up at the deadline so a slow search can't
+     * hold back a deposit forever. */
+    void drain(std::chrono::steady_clock::time_point deadline);
+
+    ProcessResolver mProcessResolver;
+    FlowCache mFlowCache;
+    TrafficStorage& mTrafficStorage;
+    int mShard;
+
+    uint64_t mIndexHits{0};
+    uint64_t mPendedFlows{0};
+
+    mutable std::mutex mMutex;
+    std::condition_variable mQueued;
+    std::condition_variable mDrained;
+    std::unordered_map<PacketHash, PendingFlow> mPending;
+    std::vector<PacketHash> mQueue;
+    std::vector<PacketHash> mDeferred; /* Pending flows waiting for the next full search. */
+    bool mDrainRequested{false};
+    bool mResolving{false};
+    ResolverStats mStats;
+
+    int mDepositHook;
+
+    std::atomic<bool> mRunning{true};
+    std::thread mThread;
+};
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "FlowCache.hpp"
+
+#include <ctime>
+
+namespace ntmd {
+
+/* Seconds a flow stays cached, by capture time. Bounds how long a flow can stay attributed to a
+ * process after its socket changed hands without the resolver noticing. */
+static constexpr std::time_t FLOW_TTL = 30;
+
+FlowCache::Key::Key(const Packet& pkt) : protocol(pkt.protocol)
+{
+    if (pkt.direction == Direction::Outgoing)
+    {
+        localIP = pkt.sip;
+        localPort = pkt.sport;
+        remoteIP = pkt.dip;
+        remotePort = pkt.dport;
+    }
+    else
+    {
+        localIP = pkt.dip;
+        localPort = pkt.dport;
+        remoteIP = pkt.sip;
+        remotePort = pkt.sport;
+    }
+}
+
+FlowCache::FlowCache(std::size_t size)
+{
+    if (size == 0)
+        return;
+
+    std::size_t sets = 1;
+    while (sets * WAYS < size)
+        sets <<= 1;
+
+    mSets.resize(sets);
+    mSetMask = sets - 1;
+}
+
+FlowCache::Set& FlowCache::set(const Key& key)
+{
+    const uint64_t ports = static_cast<uint64_t>(key.localPort) << 24 |
+                           static_cast<uint64_t>(key.remotePort) << 8 | key.protocol;
+
+    uint64_t hash = (static_cast<uint64_t>(key.localIP) << 32 | key.remoteIP) * 0x9e3779b97f4a7c15;
+    hash ^= ports * 0xc2b2ae3d27d4eb4f;
+    hash ^= hash >> 31;
+
+    return mSets[hash & mSetMask];
+}
+
+std::optional<uint32_t> FlowCache::find(const Packet& pkt, uint64_t generation)
+{
+    if (mSets.empty())
+        return std::nullopt;
+
+    const Key key(pkt);
+    for (Slot& slot : set(key).slots)
+    {
+        if (slot.key == key)
+        {
+            if (slot.generation != static_cast<uint32_t>(generation) ||
+                static_cast<uint32_t>(pkt.timestamp) >= slot.expires)
+                break;
+
+            slot.lastUsed = ++mTick;
+            mHits++;
+            return slot.app;
+        }
+    }
+
+    mMisses++;
+    return std::nullopt;
+}
+
+void FlowCache::insert(const Packet& pkt, uint32_t app, uint64_t generation)
+{
+    if (mSets.empty())
+        return;
+
+    const Key key(pkt);
+    std::array<Slot, WAYS>& slots = set(key).slots;
+
+    /* Reuse the flow's own slot if it is still around, otherwise replace the least recently used
+     * slot of the set. Unused slots always have the lowest lastUsed. */
+    Slot* victim = &slots[0];
+    for (Slot& slot : slots)
+    {
+        if (slot.key == key)
+        {
+            victim = &slot;
+            break;
+        }
+
+        if (slot.lastUsed < victim->lastUsed)
+            victim = &slot;
+    }
+
+    victim->key = key;
+    victim->lastUsed = ++mTick;
+    victim->expires = static_cast<uint32_t>(pkt.timestamp + FLOW_TTL);
+    victim->generation = static_cast<uint32_t>(generation);
+    victim->app = app;
+}
+
+} // namespace ntmd
\ No newline at end of file
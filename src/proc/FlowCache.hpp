@@ -0,0 +1,95 @@
+#pragma once
+
+#include "net/Packet.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace ntmd {
+
+/* Cache of the application each flow's process was last resolved to, keyed by the flow's
+ * local/remote addresses, ports and protocol so both directions share an entry.
+ * The cache is a fixed size set associative table: a flow can only live in the slots of the set its
+ * key hashes to, a set being a single cache line, so a lookup touches one line and the least
+ * recently used slot of the set is replaced when it is full. Entries expire after a short
+ * time and are ignored once the resolver's generation has moved on, which happens whenever a
+ * socket or process that could have been cached goes away.
+ * Not thread safe, every capture thread owns its own cache. */
+class FlowCache
+{
+  public:
+    /* Size is the total number of flows cached, rounded up to a whole number of sets. A size of 0
+     * disables the cache. */
+    FlowCache(std::size_t size);
+    ~FlowCache() = default;
+
+    /* Returns the id in the ApplicationIndex the packet's flow was cached with, or nullopt if it
+     * isn't cached, has expired or was cached in a different generation. */
+    std::optional<uint32_t> find(const Packet& pkt, uint64_t generation);
+
+    /* Cache the application of the process a packet's flow resolved to during the given
+     * generation. */
+    void insert(const Packet& pkt, uint32_t app, uint64_t generation);
+
+    uint64_t hits() const { return mHits; }
+    uint64_t misses() const { return mMisses; }
+
+  private:
+    struct Key
+    {
+        uint32_t localIP{0};
+        uint32_t remoteIP{0};
+        uint16_t localPort{0};
+        uint16_t remotePort{0};
+        uint8_t protocol{0};
+
+        Key() = default;
+        Key(const Packet& pkt);
+
+        bool operator==(const Key& other) const
+        {
+            return localIP == other.localIP && remoteIP == other.remoteIP &&
+                   localPort == other.localPort && remotePort == other.remotePort &&
+                   protocol == other.protocol;
+        }
+    };
+
+    /* Times and generations are kept in 32 bits. Capture timestamps fit until 2106 and a stale
+     * generation would have to wrap around within a flow's lifetime to be mistaken for the current
+     * one. An unused slot never matches as it has always expired. */
+    struct Slot
+    {
+        Key key;
+        uint32_t lastUsed{0};
+        uint32_t expires{0};
+        uint32_t generation{0};
+        uint32_t app{0};
+    };
+
+    /* Slots per set, as many as fit in a cache line. */
+    static constexpr std::size_t WAYS = 2;
+
+    struct alignas(64) Set
+    {
+        std::array<Slot, WAYS> slots{};
+    };
+
+    static_assert(sizeof(Set) == 64, "a set should fill exactly one cache line");
+
+    /* The set the key belongs to. */
+    Set& set(const Key& key);
+
+    std::vector<Set> mSets;
+    std::size_t mSetMask{0};
+
+    /* Ticks on every lookup, used to order the slots in a set by how recently they were used. */
+    uint32_t mTick{0};
+
+    uint64_t mHits{0};
+    uint64_t mMisses{0};
+};
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "ProcConnector.hpp"
+#include "Daemon.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <utility>
+
+namespace ntmd {
+
+ProcConnector::ProcConnector(Callback callback) : mCallback(std::move(callback))
+{
+    mFd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (mFd < 0)
+    {
+        std::cerr << ntmd::logwarn
+                  << "Could not open proc connector socket, new processes will be found by "
+                     "searching /proc. Error: "
+                  << strerror(errno) << "\n";
+        return;
+    }
+
+    sockaddr_nl addr{};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+
+    if (bind(mFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || !subscribe(true))
+    {
+        std::cerr << ntmd::logwarn
+                  << "Could not subscribe to proc connector events, new processes will be found "
+                     "by searching /proc. Error: "
+                  << strerror(errno) << "\n";
+        close(mFd);
+        mFd = -1;
+        return;
+    }
+
+    /* Wake up regularly so the thread notices when it should stop. */
+    timeval timeout{1, 0};
+    setsockopt(mFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    mThread = std::thread(&ProcConnector::readLoop, this);
+}
+
+bool ProcConnector::subscribe(bool listen)
+{
+    alignas(nlmsghdr) char buffer[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))]{};
+
+    auto* header = reinterpret_cast<nlmsghdr*>(buffer);
+    header->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+    header->nlmsg_type = NLMSG_DONE;
+
+    auto* msg = static_cast<cn_msg*>(NLMSG_DATA(header));
+    msg->id.idx = CN_IDX_PROC;
+    msg->id.val = CN_VAL_PROC;
+    msg->len = sizeof(proc_cn_mcast_op);
+
+    const proc_cn_mcast_op op = listen ? PROC_CN_MCAST_LISTEN : PROC_CN_MCAST_IGNORE;
+    std::memcpy(msg->data, &op, sizeof(op));
+
+    return send(mFd, buffer, header->nlmsg_len, 0) >= 0;
+}
+
+void ProcConnector::readLoop()
+{
+    alignas(nlmsghdr) char buffer[8192];
+
+    while (mRunning)
+    {
+        const ssize_t received = recv(mFd, buffer, sizeof(buffer), 0);
+        if (received < 0)
+        {
+            if (errno == ENOBUFS)
+                mCallback({EventType::Overflow});
+            else if (errno != EAGAIN && errno != EINTR)
+            {
+                std::cerr << ntmd::logwarn
+                          << "Could not read proc connector events. Error: " << strerror(errno)
+                          << "\n";
+            }
+            continue;
+        }
+
+        int len = received;
+        for (auto* header = reinterpret_cast<nlmsghdr*>(buffer); NLMSG_OK(header, len);
+             header = NLMSG_NEXT(header, len))
+        {
+            auto* msg = static_cast<cn_msg*>(NLMSG_DATA(header));
+            if (msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC)
+                continue;
+
+            auto* event = reinterpret_cast<proc_event*>(msg->data);
+            switch (event->what)
+            {
+            case proc_event::PROC_EVENT_FORK:
+                /* A new thread shares its process' descriptors, only new processes matter. */
+                if (event->event_data.fork.child_pid == event->event_data.fork.child_tgid)
+                    mCallback({EventType::Fork, event->event_data.fork.child_tgid});
+                break;
+            case proc_event::PROC_EVENT_EXEC:
+                mCallback({EventType::Exec, event->event_data.exec.process_tgid});
+                break;
+            case proc_event::PROC_EVENT_EXIT:
+                if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid)
+                    mCallback({EventType::Exit, event->event_data.exit.process_tgid});
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+ProcConnector::~ProcConnector()
+{
+    mRunning = false;
+    if (mThread.joinable())
+        mThread.join();
+
+    if (mFd >= 0)
+    {
+        subscribe(false);
+        close(mFd);
+    }
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <sys/types.h>
+#include <thread>
+
+namespace ntmd {
+
+/* Subscription to the kernel's process events through the NETLINK_CONNECTOR proc connector.
+ * Events are read on a separate thread and passed to the callback as they arrive, the callback is
+ * called from that thread. Only whole processes are reported, events for individual threads are
+ * ignored since they share the file descriptors of their process. */
+class ProcConnector
+{
+  public:
+    enum class EventType
+    {
+        Fork,
+        Exec,
+        Exit,
+        /* The kernel dropped events because we didn't read them fast enough. */
+        Overflow,
+    };
+
+    struct Event
+    {
+        EventType type;
+        pid_t pid{0};
+    };
+
+    using Callback = std::function<void(const Event&)>;
+
+    /* Subscribes to process events, requires CAP_NET_ADMIN. If the subscription fails a warning
+     * is logged and available returns false. */
+    ProcConnector(Callback callback);
+    ~ProcConnector();
+
+    ProcConnector(const ProcConnector&) = delete;
+    ProcConnector& operator=(const ProcConnector&) = delete;
+
+    bool available() const { return mFd >= 0; }
+
+  private:
+    /* Send a listen or ignore request for the proc connector multicast group. */
+    bool subscribe(bool listen);
+
+    void readLoop();
+
+    int mFd{-1};
+    Callback mCallback;
+
+    std::thread mThread;
+    std::atomic<bool> mRunning{true};
+};
+
+} // namespace ntmd
\ No newline at end of file
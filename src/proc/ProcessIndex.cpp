@@ -16,14 +16,33 @@
 #include <set>
 #include <thread>
 #include <unistd.h>
+#include <utility>
 
 namespace ntmd {
 
 using inode = uint64_t;
 using OptionalProcessRef = std::optional<std::reference_wrapper<const Process>>;
 
+/* Minimum seconds between full searches of /proc while process events are available. */
+static constexpr int FULL_SEARCH_INTERVAL = 10;
+
+/* Queued events past this are replaced by a full refresh, the capture thread may not have called
+ * get in a while during a burst of short lived processes. */
+static constexpr std::size_t MAX_QUEUED_EVENTS = 4096;
+
 ProcessIndex::ProcessIndex(int cacheSize) : mLRUCache(cacheSize)
 {
+    /* Subscribe before the initial scan so no process can slip in between the two. */
+    mConnector = std::make_unique<ProcConnector>([this](const ProcConnector::Event& event) {
+        std::unique_lock<std::mutex> lock(mEventMutex);
+        if (mEvents.size() < MAX_QUEUED_EVENTS)
+            mEvents.push_back(event);
+        else
+            mEvents.back() = {ProcConnector::EventType::Overflow};
+
+        mEventsPending = true;
+    });
+
     refresh();
 
     /* Clear out list of inode's that we have failed to find a process for in the past every 60
@@ -34,12 +53,20 @@ ProcessIndex::ProcessIndex(int cacheSize) : mLRUCache(cacheSize)
             std::this_thread::sleep_for(std::chrono::seconds(60));
 
             std::unique_lock<std::mutex> lock(mMutex);
+            if (!mCouldNotFind.empty())
+                mGeneration++;
+
             mCouldNotFind.clear();
         }
     });
     loop.detach();
 }
 
+ProcessIndex::ProcessIndex(std::unordered_map<inode, Process> processes) :
+    mProcessMap(std::move(processes)), mLRUCache(0), mOffline(true)
+{
+}
+
 void ProcessIndex::refresh()
 {
     /* Throughout the project I've tried to stick with using mostly modern c++ abstractions that are
@@ -52,6 +79,8 @@ void ProcessIndex::refresh()
      * performance benefits and clear now. */
     // TODO: We aren't clearing this anymore after a refactor, think of a solution.
     mProcessMap.clear();
+    mPidInodes.clear();
+    mGeneration++;
 
     DIR* procDir = opendir("/proc");
     if (procDir == nullptr)
@@ -89,14 +118,33 @@ OptionalProcessRef ProcessIndex::search(inode target)
 {
     OptionalProcessRef foundProcess;
 
-    /* First search the pid's in the cache, and update/remove values inside the cache.
-     * If the cache finds the new socket and its associated process, return it. */
-    foundProcess = searchCache(target);
+    /* First search the processes that were just created, then the pid's in the cache, and
+     * update/remove values inside the caches.
+     * If the caches find the new socket and its associated process, return it. */
+    foundProcess = searchCache(mRecentPids, target);
+    if (foundProcess.has_value())
+    {
+        return foundProcess;
+    }
+
+    foundProcess = searchCache(mLRUCache, target);
     if (foundProcess.has_value())
     {
         return foundProcess;
     }
 
+    if (mConnector != nullptr && mConnector->available())
+    {
+        const std::time_t now = std::time(nullptr);
+        if (now - mLastFullSearch < FULL_SEARCH_INTERVAL)
+        {
+            mSearchDeferred = true;
+            return foundProcess;
+        }
+
+        mLastFullSearch = now;
+    }
+
     /* If the new socket doesn't belong to a cached pid, do a search of the entire pid directory but
      * sorted with the most recently spawned processes searched first (larger pid).
      * To do this we first traverse the entire proc directory to sort the pid's, then scan the fd
@@ -123,7 +171,7 @@ OptionalProcessRef ProcessIndex::search(inode target)
         const pid_t pid = std::stoi(pidStr);
 
         /* Do not search PIDs that are in cache since they will have been searched already. */
-        if (mLRUCache.contains(pid))
+        if (mLRUCache.contains(pid) || mRecentPids.contains(pid))
         {
             continue;
         }
@@ -155,12 +203,12 @@ OptionalProcessRef ProcessIndex::search(inode target)
     return foundProcess;
 }
 
-OptionalProcessRef ProcessIndex::searchCache(inode target)
+OptionalProcessRef ProcessIndex::searchCache(LRUArray<pid_t>& cache, inode target)
 {
     OptionalProcessRef foundProcess;
     std::vector<pid_t> expired;
 
-    for (const pid_t& pid : mLRUCache.iterator())
+    for (const pid_t& pid : cache.iterator())
     {
         const std::string pidStr = std::to_string(pid);
         const std::string fdPath = "/proc/" + pidStr + "/fd";
@@ -182,7 +230,7 @@ OptionalProcessRef ProcessIndex::searchCache(inode target)
      * to ensure the iterator doesn't become invalid. */
     for (const pid_t& pid : expired)
     {
-        mLRUCache.erase(pid);
+        cache.erase(pid);
     }
 
     return foundProcess;
@@ -218,6 +266,11 @@ OptionalProcessRef ProcessIndex::processPidDir(const std::string& fdPath, const
         return std::nullopt;
     }
 
+    /* Every socket of the process is found again below. */
+    const Process process(comm, pid);
+    std::vector<inode>& pidInodes = mPidInodes[pid];
+    pidInodes.clear();
+
     /* Find any socket file descriptors the process may own. */
     dirent* fdEntry;
     while ((fdEntry = readdir(fdDir)))
@@ -242,12 +295,8 @@ OptionalProcessRef ProcessIndex::processPidDir(const std::string& fdPath, const
             /* socket:[12345]  -> 12345 */
             inode = std::stoi(link.substr(8, link.size()));
 
-            Process process;
-
-            process.pid = pid;
-            process.comm = comm;
-
             const auto& it = mProcessMap.insert_or_assign(inode, process).first;
+            pidInodes.push_back(inode);
             if (inode != 0 && inode == target)
             {
                 const Process& ref = it->second;
@@ -258,6 +307,9 @@ OptionalProcessRef ProcessIndex::processPidDir(const std::string& fdPath, const
 
     closedir(fdDir);
 
+    if (pidInodes.empty())
+        mPidInodes.erase(pid);
+
     return found;
 }
 
@@ -266,6 +318,10 @@ OptionalProcessRef ProcessIndex::get(inode inode)
     /* If we have recently failed to find the process for the given inode already,
      * don't search for it again. */
     std::unique_lock<std::mutex> lock(mMutex);
+    mSearchDeferred = false;
+    if (mEventsPending)
+        applyEvents();
+
     if (mCouldNotFind.count(inode))
     {
         return std::nullopt;
@@ -276,6 +332,11 @@ OptionalProcessRef ProcessIndex::get(inode inode)
     {
         return found->second;
     }
+    else if (mOffline)
+    {
+        mCouldNotFind[inode] = true;
+        return std::nullopt;
+    }
     else
     {
         /* Attempt to search for the socket inode and the corresponding process it belongs too.
@@ -291,6 +352,11 @@ OptionalProcessRef ProcessIndex::get(inode inode)
 
             return process;
         }
+        else if (mSearchDeferred)
+        {
+            /* Try again once a full search is allowed. */
+            return std::nullopt;
+        }
         else
         {
             std::cerr << ntmd::logdebug << "Could not find a process associated with the inode["
@@ -301,6 +367,139 @@ OptionalProcessRef ProcessIndex::get(inode inode)
     }
 }
 
+bool ProcessIndex::searchAll(bool force)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (mOffline)
+        return false;
+
+    const std::time_t now = std::time(nullptr);
+    if (!force && now - mLastFullSearch < FULL_SEARCH_INTERVAL)
+        return false;
+
+    mLastFullSearch = now;
+
+    if (mEventsPending)
+        applyEvents();
+
+    DIR* procDir = opendir("/proc");
+    if (procDir == nullptr)
+    {
+        std::cerr << ntmd::logwarn << "Failed to open the /proc directory, error: "
+                  << strerror(errno) << ".\n";
+        return false;
+    }
+
+    dirent* procEntry;
+    while ((procEntry = readdir(procDir)))
+    {
+        if (procEntry->d_type != DT_DIR || !util::isNumber(procEntry->d_name))
+            continue;
+
+        const std::string pidStr = procEntry->d_name;
+        processPidDir("/proc/" + pidStr + "/fd", pidStr, std::stoi(pidStr));
+    }
+
+    closedir(procDir);
+    return true;
+}
+
+bool ProcessIndex::find(inode inode, std::optional<uint32_t>& app)
+{
+    std::unique_lock<std::mutex> lock(mMutex, std::try_to_lock);
+    if (!lock.owns_lock())
+        return false;
+
+    const auto& found = mProcessMap.find(inode);
+    if (found != mProcessMap.end())
+    {
+        app = found->second.app;
+        return true;
+    }
+
+    if (mCouldNotFind.count(inode))
+    {
+        app = std::nullopt;
+        return true;
+    }
+
+    return false;
+}
+
+void ProcessIndex::sync()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (mEventsPending)
+        applyEvents();
+}
+
+void ProcessIndex::applyEvents()
+{
+    std::vector<ProcConnector::Event> events;
+    {
+        std::unique_lock<std::mutex> lock(mEventMutex);
+        events.swap(mEvents);
+        mEventsPending = false;
+    }
+
+    bool overflow = false;
+    for (const ProcConnector::Event& event : events)
+    {
+        switch (event.type)
+        {
+        case ProcConnector::EventType::Fork:
+            mRecentPids.update(event.pid);
+            break;
+        case ProcConnector::EventType::Exec:
+            /* The sockets it kept through exec now belong to a different program. */
+            evict(event.pid);
+            mRecentPids.update(event.pid);
+            break;
+        case ProcConnector::EventType::Exit:
+            evict(event.pid);
+            mLRUCache.erase(event.pid);
+            mRecentPids.erase(event.pid);
+            break;
+        case ProcConnector::EventType::Overflow:
+            overflow = true;
+            break;
+        }
+    }
+
+    /* Missed events could leave processes that have exited in the index, start over. */
+    if (overflow)
+    {
+        std::cerr << ntmd::logdebug << "Missed process events, refreshing the process index.\n";
+        refresh();
+    }
+}
+
+void ProcessIndex::evict(pid_t pid)
+{
+    const auto& it = mPidInodes.find(pid);
+    if (it == mPidInodes.end())
+        return;
+
+    bool removed = false;
+    for (const inode inode : it->second)
+    {
+        /* Forked processes share sockets, only remove the ones last found owned by this pid. */
+        const auto& found = mProcessMap.find(inode);
+        if (found != mProcessMap.end() && found->second.pid == pid)
+        {
+            mProcessMap.erase(found);
+            removed = true;
+        }
+    }
+
+    mPidInodes.erase(it);
+
+    /* Most processes never own a socket, only processes that could have been resolved to
+     * invalidate earlier results. */
+    if (removed)
+        mGeneration++;
+}
+
 ProcessIndex::~ProcessIndex() {}
 
 } // namespace ntmd
\ No newline at end of file
@@ -1,8 +1,13 @@
 #pragma once
 
+#include "ApplicationIndex.hpp"
+#include "ProcConnector.hpp"
+#include "util/FlatHashMap.hpp"
 #include "util/LRUArray.hpp"
 
+#include <atomic>
 #include <cstdint>
+#include <ctime>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -10,17 +15,28 @@
 #include <string>
 #include <sys/types.h>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace ntmd {
 
 struct Process
 {
+    Process() = default;
+    Process(std::string comm, pid_t pid) :
+        comm(std::move(comm)), pid(pid), app(ApplicationIndex::instance().intern(this->comm)){};
+
     std::string comm;
-    pid_t pid;
+    pid_t pid{0};
+
+    /* Id of the comm name in the ApplicationIndex. */
+    uint32_t app{0};
 };
 
-/* Index of all processes and their associated socket file descriptors in the /proc directory. */
+/* Index of all processes and their associated socket file descriptors in the /proc directory.
+ * The index is kept in sync with the processes on the system through proc connector events: exited
+ * processes are evicted as soon as they are reported and new or exec'd processes are the first to
+ * be searched when an unknown socket inode shows up, so a full search of /proc is rarely needed. */
 class ProcessIndex
 {
     using inode = uint64_t;
@@ -28,6 +44,10 @@ class ProcessIndex
 
   public:
     ProcessIndex(int cacheSize);
+
+    /* Offline index that only knows the given socket inodes and never searches /proc, used for
+     * replaying captures. */
+    explicit ProcessIndex(std::unordered_map<inode, Process> processes);
     ~ProcessIndex();
 
     /* Scan and update our process map with socket inodes for every PID folder in /proc.
@@ -37,15 +57,45 @@ class ProcessIndex
     /* Attempt to find and return a Process from the mProcessMap based on the inode key. */
     OptionalProcessRef get(inode inode);
 
+    /* Look a socket inode's process up only in what is already indexed, never waiting on the lock
+     * or searching /proc. Returns false if get has to be called to find it, otherwise sets app to
+     * the owning process' application id or nullopt if it is already known not to be found. */
+    bool find(inode inode, std::optional<uint32_t>& app);
+
+    /* True if the last get didn't find the inode only because full searches of /proc are rate
+     * limited, a later search may still find it. */
+    bool deferred() const { return mSearchDeferred; }
+
+    /* Index the sockets of every process in /proc, to find all the inodes get deferred at once.
+     * Returns false without searching if full searches are still rate limited, unless forced. */
+    bool searchAll(bool force);
+
+    /* Apply any process events that have arrived since the last call to get or sync. */
+    void sync();
+
+    /* Changes whenever processes may have been removed from the index or inodes that weren't found
+     * may now be, so results cached from an older generation should be looked up again. */
+    uint64_t generation() const { return mGeneration.load(std::memory_order_relaxed); }
+
+    const std::unordered_map<inode, Process>& processes() const { return mProcessMap; }
+
   private:
     /* Search the /proc directory for a specific socket inode and once found do not search any
      * further. First search through the cached pids, then the entire /proc folder but sorted with
      * the newest processes searched first. */
     OptionalProcessRef search(inode target);
 
-    /* Refresh only the PID folders in the cache, returns a reference to the process if the given
-     * inode was found. */
-    OptionalProcessRef searchCache(inode target);
+    /* Refresh only the PID folders in the given cache, returns a reference to the process if the
+     * given inode was found. */
+    OptionalProcessRef searchCache(LRUArray<pid_t>& cache, inode target);
+
+    /* Apply the process events queued by the proc connector since the last lookup. Events are
+     * only ever applied by the thread calling get and sync so that references it has handed out
+     * stay valid until its next call, other threads only get application ids through find. */
+    void applyEvents();
+
+    /* Remove every socket inode owned by the pid from mProcessMap. */
+    void evict(pid_t pid);
 
     /* Search a pid dir's file descriptor folder (/proc/123/fd) for a specific socket inode.
      * This will also update mProcessMap.
@@ -59,18 +109,44 @@ class ProcessIndex
      * point to the same process in memory.*/
     std::unordered_map<inode, Process> mProcessMap;
 
+    /* Socket inodes found for each pid, so a process' sockets can be evicted when it exits. */
+    std::unordered_map<pid_t, std::vector<inode>> mPidInodes;
+
     /* Cache of PIDs who's folder was most recently searched for that contained a new socket file
      * descriptor. This alleviates a lot of CPU cycles for programs that create sockets often,
      * avoiding full /proc refreshs to find new sockets from these cached programs.
      * Discards the least recently used pid once reached max size. */
     LRUArray<pid_t> mLRUCache;
 
+    /* Processes that were recently created or exec'd, searched before any other process since new
+     * sockets most likely belong to them. */
+    static constexpr std::size_t RECENT_PIDS = 64;
+    LRUArray<pid_t> mRecentPids{RECENT_PIDS};
+
     /* For packets and their socket inodes that we cannot find a corresponding process for, add them
      * to a not found list so that we don't continously hammer the CPU trying to find a process that
      * we already know we can't find for every additional packet sniffed. Idealy this list should be
      * empty or very small. */
-    std::unordered_map<inode, bool> mCouldNotFind;
+    FlatHashMap<inode, bool> mCouldNotFind;
     std::mutex mMutex;
+
+    std::atomic<uint64_t> mGeneration{0};
+
+    /* Offline indexes never search /proc. */
+    bool mOffline{false};
+
+    /* With process events a full search of /proc is only needed for a new socket of a process that
+     * is neither recent nor cached, which doesn't have to be instant, so they are rate limited. */
+    std::time_t mLastFullSearch{0};
+    bool mSearchDeferred{false};
+
+    /* Events queued by the proc connector thread for applyEvents. */
+    std::mutex mEventMutex;
+    std::vector<ProcConnector::Event> mEvents;
+    std::atomic<bool> mEventsPending{false};
+
+    /* Declared last so its thread is stopped before anything it queues events into is destroyed. */
+    std::unique_ptr<ProcConnector> mConnector;
 };
 
 } // namespace ntmd
\ No newline at end of file
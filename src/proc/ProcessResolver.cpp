@@ -12,20 +12,51 @@ namespace ntmd {
 
 const Process& ProcessResolver::resolve(const Packet& pkt)
 {
+    const Process* process = tryResolve(pkt);
+    return process != nullptr ? *process : mUnknownProcess;
+}
+
+const Process* ProcessResolver::tryResolve(const Packet& pkt)
+{
+    mStats.lookups++;
+
     uint64_t inode = mSocketIndex.get(pkt);
     if (inode == 0)
-        return mUnknownProcess;
+        return &mUnknownProcess;
+
+    mStats.socketHits++;
 
     auto process = mProcessIndex.get(inode);
 
     if (process.has_value())
     {
-        return process->get();
+        mStats.processHits++;
+        return &process->get();
+    }
+    else if (mProcessIndex.deferred())
+    {
+        return nullptr;
     }
     else
     {
-        return mUnknownProcess;
+        return &mUnknownProcess;
     }
 }
 
+std::optional<uint32_t> ProcessResolver::find(const Packet& pkt)
+{
+    uint64_t inode;
+    if (!mSocketIndex.find(pkt, inode))
+        return std::nullopt;
+
+    if (inode == 0)
+        return mUnknownProcess.app;
+
+    std::optional<uint32_t> app;
+    if (!mProcessIndex.find(inode, app))
+        return std::nullopt;
+
+    return app.has_value() ? app : mUnknownProcess.app;
+}
+
 } // namespace ntmd
\ No newline at end of file
@@ -1,24 +1,66 @@
 #pragma once
 
 #include "ProcessIndex.hpp"
+#include "ProcessTable.hpp"
 #include "SocketIndex.hpp"
 #include "net/Packet.hpp"
 
+#include <cstdint>
 #include <functional>
 #include <optional>
 
 namespace ntmd {
 
+/* How many packets given to a resolver found a socket inode and how many of those found the
+ * process that owns it. */
+struct ResolverStats
+{
+    uint64_t lookups{0};
+    uint64_t socketHits{0};
+    uint64_t processHits{0};
+};
+
 class ProcessResolver
 {
   public:
     ProcessResolver(int processIndexCacheSize) : mProcessIndex(processIndexCacheSize) {}
+
+    /* Offline resolver that only uses the given table and never reads /proc. */
+    explicit ProcessResolver(const ProcessTable& table) :
+        mSocketIndex(table.sockets), mProcessIndex(table.processes)
+    {
+    }
     ~ProcessResolver() = default;
 
     /* Uses both the socket index and process index to
      * attempt to find a Process associated with the sniffed packet given. */
     const Process& resolve(const Packet& pkt);
 
+    /* Like resolve, but returns nullptr rather than the unknown process if the packet's process
+     * may still be found once /proc can be searched again, see ProcessIndex::searchAll. */
+    const Process* tryResolve(const Packet& pkt);
+
+    /* Index every process' sockets so deferred packets can be resolved, see
+     * ProcessIndex::searchAll. */
+    bool searchAll(bool force) { return mProcessIndex.searchAll(force); }
+
+    /* What packets whose process can't be found are credited to. */
+    const Process& unknownProcess() const { return mUnknownProcess; }
+
+    /* Resolve a packet using only the sockets and processes already indexed, never blocking on or
+     * reading /proc, safe to call while another thread is in resolve. Returns the application id
+     * of the packet's process, or nullopt if the packet has to be resolved with resolve. */
+    std::optional<uint32_t> find(const Packet& pkt);
+
+    /* Apply the process events that arrived since the last resolve. */
+    void sync() { mProcessIndex.sync(); }
+
+    /* Moves forward whenever either index may have dropped something, results resolved in an
+     * older generation may no longer be right. */
+    uint64_t generation() const { return mSocketIndex.generation() + mProcessIndex.generation(); }
+
+    const ResolverStats& stats() const { return mStats; }
+
   private:
     SocketIndex mSocketIndex;
     ProcessIndex mProcessIndex;
@@ -27,6 +69,9 @@ class ProcessResolver
      * the SocketIndex or ProcessIndex. Instead of just ignoring the traffic that was failed to be
      * matched with a process, we will report it back to the user as unknown. */
     const Process mUnknownProcess{"Unknown Traffic", 0};
+
+    /* Only touched by the thread calling resolve, find isn't counted. */
+    ResolverStats mStats;
 };
 
 } // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,150 @@
+#include "ProcessTable.hpp"
+#include "Daemon.hpp"
+#include "ProcessIndex.hpp"
+#include "SocketIndex.hpp"
+
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <fstream>
+#include <ifaddrs.h>
+#include <iostream>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sstream>
+#include <string>
+
+namespace ntmd {
+
+ProcessTable ProcessTable::record()
+{
+    ProcessTable table;
+
+    SocketIndex sockets;
+    table.sockets = sockets.sockets();
+
+    ProcessIndex processes(0);
+    table.processes = processes.processes();
+
+    ifaddrs *interfaces, *interface;
+    if (getifaddrs(&interfaces) < 0)
+    {
+        std::cerr << ntmd::logerror
+                  << "Unable to access local interface addresses to record. Cannot proceed, "
+                     "exiting.\n";
+        std::exit(1);
+    }
+
+    for (interface = interfaces; interface != nullptr; interface = interface->ifa_next)
+    {
+        if (interface->ifa_addr == nullptr || interface->ifa_addr->sa_family != AF_INET ||
+            (interface->ifa_flags & IFF_LOOPBACK))
+            continue;
+
+        table.addresses.push_back(((sockaddr_in*)interface->ifa_addr)->sin_addr.s_addr);
+    }
+    freeifaddrs(interfaces);
+
+    return table;
+}
+
+ProcessTable ProcessTable::load(const std::filesystem::path& path)
+{
+    std::ifstream fs(path);
+    if (!fs.is_open())
+    {
+        std::cerr << ntmd::logerror << "Could not open process table file " << path
+                  << ". Cannot proceed, exiting.\n";
+        std::exit(1);
+    }
+
+    ProcessTable table;
+
+    std::string line;
+    while (std::getline(fs, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream ss(line);
+        std::string kind;
+        ss >> kind;
+
+        bool ok = false;
+        if (kind == "address")
+        {
+            std::string address;
+            in_addr ip;
+            ok = static_cast<bool>(ss >> address) && inet_aton(address.c_str(), &ip) != 0;
+            if (ok)
+                table.addresses.push_back(ip.s_addr);
+        }
+        else if (kind == "socket")
+        {
+            PacketHash hash;
+            inode inode;
+            ok = static_cast<bool>(ss >> hash.ip1 >> hash.port1 >> hash.ip2 >> hash.port2 >> inode);
+            if (ok)
+                table.sockets[hash] = inode;
+        }
+        else if (kind == "process")
+        {
+            inode inode;
+            pid_t pid;
+            ok = static_cast<bool>(ss >> inode >> pid);
+
+            /* The comm name is the rest of the line, it can contain spaces. */
+            if (ok)
+            {
+                std::string comm;
+                ss >> std::ws;
+                std::getline(ss, comm);
+                table.processes[inode] = Process(comm, pid);
+            }
+        }
+
+        if (!ok)
+        {
+            std::cerr << ntmd::logwarn << "Skipping malformed line in process table " << path
+                      << ": " << line << "\n";
+        }
+    }
+
+    std::cerr << ntmd::loginfo << "Loaded " << table.sockets.size() << " sockets, "
+              << table.processes.size() << " process inodes and " << table.addresses.size()
+              << " addresses from " << path << ".\n";
+
+    return table;
+}
+
+void ProcessTable::save(const std::filesystem::path& path) const
+{
+    std::ofstream fs(path);
+    if (!fs.is_open())
+    {
+        std::cerr << ntmd::logerror << "Could not open " << path
+                  << " to write the process table to.\n";
+        std::exit(1);
+    }
+
+    fs << "# ntmd process table\n";
+
+    for (const uint32_t address : addresses)
+    {
+        in_addr ip;
+        ip.s_addr = address;
+        fs << "address " << inet_ntoa(ip) << "\n";
+    }
+
+    for (const auto& [hash, inode] : sockets)
+    {
+        fs << "socket " << hash.ip1 << " " << hash.port1 << " " << hash.ip2 << " " << hash.port2
+           << " " << inode << "\n";
+    }
+
+    for (const auto& [inode, process] : processes)
+    {
+        fs << "process " << inode << " " << process.pid << " " << process.comm << "\n";
+    }
+}
+
+} // namespace ntmd
\ No newline at end of file
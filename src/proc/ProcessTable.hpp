@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ProcessIndex.hpp"
+#include "SocketIndex.hpp"
+#include "net/PacketHash.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+namespace ntmd {
+
+/* Static snapshot of a host's socket and process tables along with its local addresses.
+ * Used to replay captures offline without reading /proc; either recorded from a live host and
+ * saved to a file, or generated from the flows in the capture itself. */
+struct ProcessTable
+{
+    using inode = uint64_t;
+
+    SocketMap sockets;
+    std::unordered_map<inode, Process> processes;
+    std::vector<uint32_t> addresses;
+
+    /* Snapshot the socket and process tables in /proc and the local ipv4 addresses of this
+     * host. */
+    static ProcessTable record();
+
+    /* Load a table previously written with save. Exits if the file can't be read. */
+    static ProcessTable load(const std::filesystem::path& path);
+
+    /* Write the table as text, one socket, process or address per line. */
+    void save(const std::filesystem::path& path) const;
+};
+
+} // namespace ntmd
\ No newline at end of file
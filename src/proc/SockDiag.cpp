@@ -0,0 +1,163 @@
+#include "SockDiag.hpp"
+#include "Daemon.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <linux/netlink.h>
+#include <netinet/in.h>
+#include <linux/sock_diag.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+
+namespace ntmd {
+
+/* Large enough for the kernel to pack many sockets into each read of a dump. */
+static constexpr std::size_t BUFFER_SIZE = 64 * 1024;
+
+bool SockDiag::open()
+{
+    if (mFd >= 0)
+        return true;
+
+    if (mUnavailable)
+        return false;
+
+    mFd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (mFd < 0)
+    {
+        std::cerr << ntmd::logwarn
+                  << "Could not open sock_diag netlink socket, falling back to the /proc/net "
+                     "tables. Error: "
+                  << strerror(errno) << "\n";
+        mUnavailable = true;
+        return false;
+    }
+
+    mBuffer.resize(BUFFER_SIZE);
+    return true;
+}
+
+bool SockDiag::dump(uint8_t family, uint8_t protocol, uint32_t states, const Callback& callback)
+{
+    inet_diag_req_v2 req{};
+    req.sdiag_family = family;
+    req.sdiag_protocol = protocol;
+    req.idiag_states = states;
+
+    return request(req, true, callback);
+}
+
+bool SockDiag::lookup(uint8_t family, uint8_t protocol, const uint32_t local[4],
+                      uint16_t localPort, const uint32_t remote[4], uint16_t remotePort,
+                      inet_diag_msg& result)
+{
+    /* Tcp looks the socket up with the source as the local end, but udp looks it up as if the
+     * request was a received packet, with the source being the remote end. */
+    if (protocol == IPPROTO_UDP)
+    {
+        std::swap(local, remote);
+        std::swap(localPort, remotePort);
+    }
+
+    inet_diag_req_v2 req{};
+    req.sdiag_family = family;
+    req.sdiag_protocol = protocol;
+    req.idiag_states = ~0u;
+    req.id.idiag_sport = localPort;
+    req.id.idiag_dport = remotePort;
+    req.id.idiag_cookie[0] = INET_DIAG_NOCOOKIE;
+    req.id.idiag_cookie[1] = INET_DIAG_NOCOOKIE;
+    std::memcpy(req.id.idiag_src, local, sizeof(req.id.idiag_src));
+    std::memcpy(req.id.idiag_dst, remote, sizeof(req.id.idiag_dst));
+
+    bool found = false;
+    request(req, false, [&](const inet_diag_msg& msg) {
+        result = msg;
+        found = true;
+    });
+
+    return found;
+}
+
+bool SockDiag::request(const inet_diag_req_v2& req, bool dump, const Callback& callback)
+{
+    if (!open())
+        return false;
+
+    struct
+    {
+        nlmsghdr header;
+        inet_diag_req_v2 request;
+    } message{};
+
+    message.header.nlmsg_len = sizeof(message);
+    message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    message.header.nlmsg_flags = NLM_F_REQUEST | (dump ? NLM_F_DUMP : 0);
+    message.header.nlmsg_seq = ++mSequence;
+    message.request = req;
+
+    sockaddr_nl kernel{};
+    kernel.nl_family = AF_NETLINK;
+
+    if (sendto(mFd, &message, sizeof(message), 0, reinterpret_cast<sockaddr*>(&kernel),
+               sizeof(kernel)) < 0)
+    {
+        std::cerr << ntmd::logwarn
+                  << "Could not send sock_diag request. Error: " << strerror(errno) << "\n";
+        return false;
+    }
+
+    while (true)
+    {
+        const ssize_t received = recv(mFd, mBuffer.data(), mBuffer.size(), 0);
+        if (received < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            std::cerr << ntmd::logwarn
+                      << "Could not read sock_diag reply. Error: " << strerror(errno) << "\n";
+            return false;
+        }
+
+        int len = received;
+        for (auto* header = reinterpret_cast<nlmsghdr*>(mBuffer.data()); NLMSG_OK(header, len);
+             header = NLMSG_NEXT(header, len))
+        {
+            /* Leftovers of an earlier dump that was abandoned part way through. */
+            if (header->nlmsg_seq != mSequence)
+                continue;
+
+            if (header->nlmsg_type == NLMSG_DONE)
+                return true;
+
+            if (header->nlmsg_type == NLMSG_ERROR)
+            {
+                /* A lookup for a socket that doesn't exist is answered with ENOENT. */
+                auto* error = static_cast<nlmsgerr*>(NLMSG_DATA(header));
+                if (dump || error->error != -ENOENT)
+                {
+                    std::cerr << ntmd::logdebug << "sock_diag request for family "
+                              << (int)req.sdiag_family << " protocol " << (int)req.sdiag_protocol
+                              << " failed. Error: " << strerror(-error->error) << "\n";
+                }
+                return false;
+            }
+
+            callback(*static_cast<const inet_diag_msg*>(NLMSG_DATA(header)));
+
+            if (!dump)
+                return true;
+        }
+    }
+}
+
+SockDiag::~SockDiag()
+{
+    if (mFd >= 0)
+        close(mFd);
+}
+
+} // namespace ntmd
\ No newline at end of file
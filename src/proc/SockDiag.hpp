@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <linux/inet_diag.h>
+
+namespace ntmd {
+
+/* Client for the NETLINK_SOCK_DIAG (inet_diag) interface.
+ * The kernel dumps its socket tables as binary messages already filtered by family, protocol and
+ * state, which is far cheaper than formatting /proc/net/tcp as text only for us to parse it back
+ * with sscanf. */
+class SockDiag
+{
+  public:
+    using Callback = std::function<void(const inet_diag_msg&)>;
+
+    SockDiag() = default;
+    ~SockDiag();
+
+    SockDiag(const SockDiag&) = delete;
+    SockDiag& operator=(const SockDiag&) = delete;
+
+    /* Dump every socket of the given address family and protocol that is in one of the tcp states
+     * set in the states bitmask (1 << TCP_ESTABLISHED, ...). Returns false if netlink is
+     * unavailable or the dump failed, in which case callback may have seen part of the table. */
+    bool dump(uint8_t family, uint8_t protocol, uint32_t states, const Callback& callback);
+
+    /* Ask the kernel for the one socket matching the exact local and remote addresses and ports,
+     * all in network byte order. Ipv4 addresses only use the first element. Tcp falls back to a
+     * listening socket and udp to an unconnected one like the kernel's own lookup for a received
+     * packet. Returns false if there is no such socket. */
+    bool lookup(uint8_t family, uint8_t protocol, const uint32_t local[4], uint16_t localPort,
+                const uint32_t remote[4], uint16_t remotePort, inet_diag_msg& result);
+
+    /* Whether the netlink socket could be opened. */
+    bool available() { return open(); }
+
+  private:
+    /* Opens the netlink socket the first time it is needed, returns false if it can't be. */
+    bool open();
+
+    /* Send a request and call callback with every socket in the reply. A dump is answered with
+     * any number of sockets, anything else with exactly one or an error. */
+    bool request(const inet_diag_req_v2& request, bool dump, const Callback& callback);
+
+    int mFd{-1};
+    bool mUnavailable{false};
+    uint32_t mSequence{0};
+
+    std::vector<char> mBuffer;
+};
+
+} // namespace ntmd
\ No newline at end of file
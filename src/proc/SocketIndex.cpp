@@ -2,35 +2,75 @@
 #include "Daemon.hpp"
 #include "net/PacketHash.hpp"
 
+#include <arpa/inet.h>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string>
+#include <sys/socket.h>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace ntmd {
 
 using inode = uint64_t;
 
+/* Minutes between full resyncs of the socket map with the kernel's tables. In between, sockets are
+ * added one at a time as packets for them are seen. */
+static constexpr int RESYNC_MINUTES = 10;
+
+/* Most tuples remembered as not found before the list is cleared. */
+static constexpr std::size_t MAX_NOT_FOUND = 1 << 16;
+
 SocketIndex::SocketIndex()
 {
-    refresh({"/proc/net/tcp", "/proc/net/udp", "/proc/net/raw"});
+    if (!dump(IPPROTO_TCP))
+        refresh({"/proc/net/tcp"});
+
+    if (!dump(IPPROTO_UDP))
+        refresh({"/proc/net/udp"});
+
+    refresh({"/proc/net/raw"});
 
     std::thread loop([this] {
-        while (true)
+        /* Resyncs use their own netlink socket so they never interleave with lookups. */
+        SockDiag sockDiag;
+
+        for (int minute = 1;; minute++)
         {
             std::this_thread::sleep_for(std::chrono::seconds(60));
 
+            /* Rebuilding the map from scratch also drops the sockets that have since been
+             * closed. It is built before taking the lock so lookups aren't held up by the dump. */
+            SocketMap sockets;
+            const bool resync = minute % RESYNC_MINUTES == 0 &&
+                                dump(sockDiag, IPPROTO_TCP, sockets) &&
+                                dump(sockDiag, IPPROTO_UDP, sockets);
+
             std::unique_lock<std::mutex> lock(mMutex);
+            if (resync || !mCouldNotFind.empty())
+                mGeneration++;
+
             mCouldNotFind.clear();
+
+            if (resync)
+                mSocketMap.swap(sockets);
         }
     });
     loop.detach();
 }
 
+SocketIndex::SocketIndex(SocketMap sockets) :
+    mSocketMap(std::move(sockets)), mOffline(true)
+{
+}
+
 void SocketIndex::refresh(const std::vector<std::string>& tables)
 {
     for (const std::string& table : tables)
@@ -92,6 +132,150 @@ void SocketIndex::refresh(const std::vector<std::string>& tables)
     }
 }
 
+/* Get the ipv4 address an ipv6 socket address maps to. The unspecified address (::) of a dual stack
+ * socket maps to 0.0.0.0. */
+static bool mappedIPv4(const uint32_t address[4], uint32_t& ip)
+{
+    if (address[0] != 0 || address[1] != 0)
+        return false;
+
+    if (address[2] == htonl(0xffff))
+    {
+        ip = address[3];
+        return true;
+    }
+
+    if (address[2] == 0 && address[3] == 0)
+    {
+        ip = 0;
+        return true;
+    }
+
+    return false;
+}
+
+/* Convert a socket from a sock_diag reply, returns false if it can't be matched with the ipv4
+ * packets we capture. */
+static bool diagSocket(const inet_diag_msg& msg, Socket& sock)
+{
+    /* Sockets without an inode, like the ones in TIME_WAIT state, have no process. */
+    if (msg.idiag_inode == 0)
+        return false;
+
+    sock.localPort = ntohs(msg.id.idiag_sport);
+    sock.remotePort = ntohs(msg.id.idiag_dport);
+    sock.inode = msg.idiag_inode;
+
+    if (msg.idiag_family == AF_INET)
+    {
+        sock.localIP = msg.id.idiag_src[0];
+        sock.remoteIP = msg.id.idiag_dst[0];
+        return true;
+    }
+
+    return mappedIPv4(msg.id.idiag_src, sock.localIP) &&
+           mappedIPv4(msg.id.idiag_dst, sock.remoteIP);
+}
+
+bool SocketIndex::dump(uint8_t protocol) { return dump(mSockDiag, protocol, mSocketMap); }
+
+bool SocketIndex::dump(SockDiag& sockDiag, uint8_t protocol, SocketMap& sockets)
+{
+    auto insert = [&](const inet_diag_msg& msg) {
+        Socket sock;
+        if (!diagSocket(msg, sock))
+            return;
+
+        /* Same keys as the /proc/net tables, see refresh. */
+        if (protocol == IPPROTO_UDP)
+            sockets[PacketHash(sock.localPort)] = sock.inode;
+        else
+            sockets[PacketHash(sock.localIP, sock.localPort, sock.remoteIP, sock.remotePort)] =
+                sock.inode;
+    };
+
+    /* Sockets in these states never have an inode. */
+    const uint32_t states = ~((1u << TCP_TIME_WAIT) | (1u << TCP_SYN_RECV));
+
+    if (!sockDiag.dump(AF_INET, protocol, states, insert))
+        return false;
+
+    /* Hosts with ipv6 disabled can't dump it, that doesn't make the ipv4 dump any less complete. */
+    sockDiag.dump(AF_INET6, protocol, states, insert);
+    return true;
+}
+
+inode SocketIndex::lookup(const Packet& pkt)
+{
+    const uint8_t protocol = pkt.type == PacketType::TCP ? IPPROTO_TCP : IPPROTO_UDP;
+    const bool outgoing = pkt.direction == Direction::Outgoing;
+
+    const uint32_t localIP = outgoing ? pkt.sip : pkt.dip;
+    const uint32_t remoteIP = outgoing ? pkt.dip : pkt.sip;
+    const uint16_t localPort = htons(outgoing ? pkt.sport : pkt.dport);
+    const uint16_t remotePort = htons(outgoing ? pkt.dport : pkt.sport);
+
+    inet_diag_msg msg;
+    const uint32_t local[4] = {localIP, 0, 0, 0};
+    const uint32_t remote[4] = {remoteIP, 0, 0, 0};
+    bool found = mSockDiag.lookup(AF_INET, protocol, local, localPort, remote, remotePort, msg);
+
+    /* The socket could also be a dual stack ipv6 socket seeing the ipv4 mapped addresses. */
+    if (!found)
+    {
+        const uint32_t local6[4] = {0, 0, htonl(0xffff), localIP};
+        const uint32_t remote6[4] = {0, 0, htonl(0xffff), remoteIP};
+        found = mSockDiag.lookup(AF_INET6, protocol, local6, localPort, remote6, remotePort, msg);
+    }
+
+    if (!found || msg.idiag_inode == 0)
+        return 0;
+
+    mSocketMap[PacketHash(pkt)] = msg.idiag_inode;
+    return msg.idiag_inode;
+}
+
+bool SocketIndex::find(const Packet& pkt, inode& inode)
+{
+    std::unique_lock<std::mutex> lock(mMutex, std::try_to_lock);
+    if (!lock.owns_lock())
+        return false;
+
+    PacketHash hash(pkt);
+    const auto& found = mSocketMap.find(hash);
+    if (found != mSocketMap.end())
+    {
+        inode = found->second;
+        return true;
+    }
+
+    /* Only tcp and udp sockets are ever searched for. */
+    if (mCouldNotFind.count(hash) ||
+        (pkt.type != PacketType::TCP && pkt.type != PacketType::UDP))
+    {
+        inode = 0;
+        return true;
+    }
+
+    return false;
+}
+
+void SocketIndex::notFound(const PacketHash& hash)
+{
+    if (mCouldNotFind.size() >= MAX_NOT_FOUND)
+    {
+        std::cerr << ntmd::logdebug << "Forgetting " << mCouldNotFind.size()
+                  << " packets without a socket, too many were remembered.\n";
+
+        /* Flows cached as unknown because of them may be found now, like after the periodic
+         * clear. */
+        mCouldNotFind.clear();
+        mGeneration++;
+    }
+
+    mCouldNotFind[hash] = true;
+}
+
 inode SocketIndex::get(const Packet& pkt)
 {
 
@@ -112,21 +296,36 @@ inode SocketIndex::get(const Packet& pkt)
     }
     else
     {
-        if (pkt.type == PacketType::TCP)
+        if (mOffline)
+        {
+            notFound(hash);
+            return 0;
+        }
+
+        if (pkt.type != PacketType::TCP && pkt.type != PacketType::UDP)
+        {
+            // refresh({"/proc/net/tcp", "/proc/net/udp", "/proc/net/raw"});
+            return 0;
+        }
+
+        /* Ask the kernel for just this packet's socket rather than reloading every socket on the
+         * host to find it. */
+        if (mSockDiag.available())
+        {
+            const inode inode = lookup(pkt);
+            if (inode != 0)
+                return inode;
+        }
+        else if (pkt.type == PacketType::TCP)
         {
             /* TODO: Handle IPV4 Mapped IPV6 addresses, and/or fully support IPV6 (runelite) */
             /* Just parsing tcp6 table like ipv4 tcp table works ?? (investigate) */
             refresh({"/proc/net/tcp"});
             refresh({"/proc/net/tcp6"});
         }
-        else if (pkt.type == PacketType::UDP)
-        {
-            refresh({"/proc/net/udp"});
-        }
         else
         {
-            // refresh({"/proc/net/tcp", "/proc/net/udp", "/proc/net/raw"});
-            return 0;
+            refresh({"/proc/net/udp"});
         }
 
         const auto& found = mSocketMap.find(hash);
@@ -139,7 +338,7 @@ inode SocketIndex::get(const Packet& pkt)
             std::cerr << ntmd::logdebug
                       << "Could not find an associated socket inode for the packet: " << pkt
                       << "\n";
-            mCouldNotFind[hash] = true;
+            notFound(hash);
             return 0;
         }
     }
@@ -1,11 +1,13 @@
 #pragma once
 
+#include "SockDiag.hpp"
 #include "net/PacketHash.hpp"
+#include "util/FlatHashMap.hpp"
 
+#include <atomic>
 #include <cstdint>
 #include <mutex>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 namespace ntmd {
@@ -19,7 +21,11 @@ struct Socket
     uint64_t inode{0};
 };
 
-/* Index for all sockets in the /proc/net tables. Such as /proc/net/tcp.
+/* Socket inodes by the addresses of the packets sent through them. */
+using SocketMap = FlatHashMap<PacketHash, uint64_t>;
+
+/* Index for all sockets in the kernel's socket tables, dumped through sock_diag netlink or read
+ * from the /proc/net tables (such as /proc/net/tcp) when netlink isn't available.
  * The inode's listed for each socket in the tables are essential for
  * connecting them with the process that owns them. */
 class SocketIndex
@@ -28,6 +34,10 @@ class SocketIndex
 
   public:
     SocketIndex();
+
+    /* Offline index that only knows the given sockets and never reads the /proc/net tables, used
+     * for replaying captures. */
+    explicit SocketIndex(SocketMap sockets);
     ~SocketIndex() = default;
 
     /* Update mSocketMap to be in sync with these /proc/net tables:
@@ -40,19 +50,56 @@ class SocketIndex
      */
     void refresh(const std::vector<std::string>& tables);
 
+    /* Update mSocketMap with every ipv4 socket of the given protocol, including ipv6 sockets
+     * bound to ipv4 mapped addresses, through sock_diag. Returns false if netlink couldn't be used
+     * and the /proc/net tables have to be read instead. */
+    bool dump(uint8_t protocol);
+
     /* Gets the packet hash from the packet's local and remote ip/port values then
-     * attempts to find a corresponding socket and its inode. */
+     * attempts to find a corresponding socket and its inode. Sockets missing from the index are
+     * looked up by their exact addresses through sock_diag, the whole map is only resynced with
+     * the kernel every few minutes. */
     inode get(const Packet& pkt);
 
+    /* Look a packet's socket up only in what is already indexed, never waiting on the lock or
+     * searching the kernel. Returns false if get has to be called to find it, otherwise sets inode
+     * to the socket's inode or 0 if it is already known not to be found. */
+    bool find(const Packet& pkt, inode& inode);
+
+    const SocketMap& sockets() const { return mSocketMap; }
+
+    /* Changes whenever sockets may have been removed from the index or packets that weren't found
+     * may now be, so results cached from an older generation should be looked up again. */
+    uint64_t generation() const { return mGeneration.load(std::memory_order_relaxed); }
+
   private:
-    std::unordered_map<PacketHash, inode> mSocketMap;
+    /* Dump every socket of the given protocol into the sockets map using the given netlink
+     * socket. */
+    static bool dump(SockDiag& sockDiag, uint8_t protocol, SocketMap& sockets);
+
+    /* Find the socket of a packet by its exact addresses and add it to mSocketMap. Returns 0 if
+     * the kernel has no such socket. */
+    inode lookup(const Packet& pkt);
+
+    /* Remember that no socket was found for the tuple. mMutex must be held. */
+    void notFound(const PacketHash& hash);
+
+    SocketMap mSocketMap;
+
+    SockDiag mSockDiag;
+
+    std::atomic<uint64_t> mGeneration{0};
+
+    /* Offline indexes are never refreshed from /proc. */
+    bool mOffline{false};
 
     /* For packets and their socket inodes that we cannot find a corresponding proc net line for,
      * add them to a not found list so that we don't continously hammer the CPU trying to find a
      * proc net line that we already know we can't find for every additional packet sniffed. Idealy
-     * this list should be empty or very small. */
+     * this list should be empty or very small. Remote hosts can fill it with packets to closed
+     * ports, so it is cleared once it holds MAX_NOT_FOUND tuples. */
     std::mutex mMutex;
-    std::unordered_map<PacketHash, bool> mCouldNotFind;
+    FlatHashMap<PacketHash, bool> mCouldNotFind;
 };
 
 } // namespace ntmd
\ No newline at end of file
@@ -1,213 +1,261 @@
 #include "DBController.hpp"
 #include "Daemon.hpp"
-#include "util/FilesystemUtil.hpp"
-#include "util/StringUtil.hpp"
-
+#include "SQLiteStore.hpp"
+#include "SegmentStore.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <filesystem>
 #include <iostream>
-#include <sqlite3.h>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unistd.h>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace ntmd {
 
 using TrafficMap = std::unordered_map<std::string, TrafficLine>;
 
-DBController::DBController(std::filesystem::path dbPath)
+/* Most intervals waiting to be committed before deposits have to wait for the writer. The writer
+ * commits early once half of these are queued. */
+static constexpr std::size_t MAX_QUEUED_INTERVALS = 256;
+
+DBController::DBController(std::filesystem::path dbPath, int flushInterval, int rawRetentionDays,
+                           const std::string& engine) :
+    mFlushInterval(flushInterval)
 {
     if (dbPath.empty())
     {
         dbPath = "/var/lib/ntmd.db";
     }
 
-    int error = sqlite3_open(dbPath.c_str(), &mHandle);
-    if (error)
+    if (engine == "segments")
     {
-        std::cerr << ntmd::logerror << "Error opening or creating database at " << dbPath
-                  << " with error: " << sqlite3_errmsg(mHandle) << "\n";
-        std::cerr << ntmd::logerror << "Cannot proceed without database connection, exiting.\n";
-        std::exit(1);
+        /* Kept apart from the database file so switching engines never touches the other's
+         * data. */
+        if (dbPath != ":memory:")
+            dbPath += ".segments";
+
+        mStore = std::make_unique<SegmentStore>(dbPath);
+    }
+    else
+    {
+        mStore = std::make_unique<SQLiteStore>(dbPath, rawRetentionDays);
     }
-    std::cerr << ntmd::loginfo << "Successfully opened or created database file at: " << dbPath
-              << "\n";
-}
 
-DBController::~DBController() { sqlite3_close(mHandle); }
+    mWriter = std::thread(&DBController::writeLoop, this);
+}
 
-void DBController::insertApplicationTraffic(const TrafficMap& traffic) const
+DBController::~DBController()
 {
-    char* err;
-    int execErr;
-    execErr = sqlite3_exec(mHandle, "BEGIN TRANSACTION", nullptr, nullptr, &err);
-    if (execErr != SQLITE_OK)
+    /* The writer commits whatever is still queued before it returns. */
     {
-        std::cerr << ntmd::logwarn << "Error beginning application traffic db transaction.\n";
-        sqlite3_free(err);
-        return;
+        std::unique_lock<std::mutex> lock(mQueueMutex);
+        mRunning = false;
     }
+    mQueued.notify_all();
+    mWriter.join();
 
-    /* The best db design that I could think of for performance, space, and simplicity was to
-     * have a table per application; unfortunately since the sqlite3 api doesn't allow for
-     * binding table names, we must do it dynamically. */
-    const char* sqlCreateTable = "CREATE TABLE IF NOT EXISTS \"%s\" ("
-                                 "timestamp INT PRIMARY KEY NOT NULL, "
-                                 "bytesRx INT DEFAULT 0, "
-                                 "bytesTx INT DEFAULT 0, "
-                                 "pktRxCount INT DEFAULT 0, "
-                                 "pktTxCount INT DEFAULT 0);";
-
-    const char* sqlInsertValues = "INSERT INTO \"%s\" VALUES (?, ?, ?, ?, ?);";
-
-    sqlite3_stmt* createTableStmt;
-    sqlite3_stmt* insertTrafficStmt;
-    time_t timestamp = std::time(nullptr);
-
-    // TODO: Can this be done faster/prettier?
-    for (const auto& [name, line] : traffic)
+    if (mStats.commits > 0)
     {
-        if (util::containsSemicolon(name))
-        {
-            std::cerr << ntmd::logwarn
-                      << "Tried inserting traffic into database for an application with a comm "
-                         "name that contains non-alphanumeric character(s): "
-                      << name
-                      << "\n"
-                         "Skipping to avoid potential sql injection.\n";
-            continue;
-        }
-
-        /* Create application table if it doesn't already exist. */
-        char sqlReplaced[512];
-        snprintf(sqlReplaced, 512, sqlCreateTable, name.c_str());
-
-        sqlite3_prepare_v2(mHandle, sqlReplaced, -1, &createTableStmt, nullptr);
-        int ret = sqlite3_step(createTableStmt);
-        if (ret != SQLITE_DONE)
-        {
-            std::cerr << ntmd::logwarn << "Commit failed while trying to create table.\n";
-        }
-
-        sqlite3_finalize(createTableStmt);
+        std::cerr << ntmd::loginfo << "Database writer committed " << mStats.intervals
+                  << " intervals (" << mStats.rows << " rows) in " << mStats.commits
+                  << " commits, 99% of commits took under "
+                  << mStats.commitLatency.percentile(0.99) / 1000 << " us.\n";
+    }
+}
 
-        /* Deposit traffic line into application table */
-        snprintf(sqlReplaced, 512, sqlInsertValues, name.c_str());
-        sqlite3_prepare_v2(mHandle, sqlReplaced, -1, &insertTrafficStmt, nullptr);
-        sqlite3_bind_int(insertTrafficStmt, 1, timestamp);
-        sqlite3_bind_int(insertTrafficStmt, 2, line.bytesRx);
-        sqlite3_bind_int(insertTrafficStmt, 3, line.bytesTx);
-        sqlite3_bind_int(insertTrafficStmt, 4, line.pktRxCount);
-        sqlite3_bind_int(insertTrafficStmt, 5, line.pktTxCount);
+void DBController::insertApplicationTraffic(std::shared_ptr<const TrafficInterval> interval)
+{
+    /* Nothing to write, don't spend a commit on it. */
+    if (interval->traffic.empty())
+        return;
 
-        ret = sqlite3_step(insertTrafficStmt);
-        if (ret != SQLITE_DONE)
+    std::unique_lock<std::mutex> lock(mQueueMutex);
+    if (mQueue.size() >= MAX_QUEUED_INTERVALS && mCommitFailing)
+    {
+        /* Waiting would hold up every deposit until the store can be written to again. The queued
+         * intervals are left alone as the writer may be committing them right now. */
+        if (mStats.dropped == mDroppedReported)
         {
-            std::cerr << ntmd::logwarn
-                      << "Commit failed while trying to insert application traffic.\n";
+            std::cerr << ntmd::logerror << "Database commits are failing with "
+                      << MAX_QUEUED_INTERVALS
+                      << " intervals waiting, new intervals are dropped until they succeed.\n";
         }
 
-        sqlite3_finalize(insertTrafficStmt);
+        mStats.dropped++;
+        return;
     }
 
-    sqlite3_exec(mHandle, "COMMIT TRANSACTION", nullptr, nullptr, &err);
-    if (execErr != SQLITE_OK)
+    if (mQueue.size() >= MAX_QUEUED_INTERVALS)
     {
-        std::cerr << ntmd::logwarn << "Error commiting application traffic transaction.\n";
-        sqlite3_free(err);
+        std::cerr << ntmd::logwarn << "Database writer has fallen " << mQueue.size()
+                  << " intervals behind, waiting for it to catch up.\n";
+        mDequeued.wait(lock, [this] { return mQueue.size() < MAX_QUEUED_INTERVALS; });
     }
 
-    // TODO: further research into this?
-    /* Occasionally sqlite with allocate more memory that persists after these insert statements.
-     * When a new table is made or accessed for the first time during runtime the sqlite object will
-     * allocate metadata for it to increase performance. Although this isn't that big of an issue,
-     * every once and a while it will allocate 4K-9K bytes seemingly randomly despite doing nothing
-     * unique from other calls to this function. At first I thought this was new cache pages but
-     * upon testing none were being created/used. Overtime this will build up memory usage.
-     * Furthermore, when calling functions like fetchTrafficWithQuery the memory used by sqlite will
-     * increase by almost 700K bytes and never get freed until I suppose it hits a hard limit
-     * despite there being no actual memory leak reported by valgrind. Manually releasing all memory
-     * like this is bound to decrease insertion performance but I think it is better than the
-     * alternative situation of ever increasing memory. Ideally we could find the proper settings
-     * for sqlite to avoid allocating the extra memory in the first place. */
-    sqlite3_db_release_memory(mHandle);
+    mQueue.push_back(std::move(interval));
+    mStats.maxQueued = std::max<uint64_t>(mStats.maxQueued, mQueue.size());
+    mQueued.notify_one();
 }
 
-TrafficMap DBController::fetchTrafficSince(time_t timestamp) const
+void DBController::flush()
 {
-    char sql[256];
-    snprintf(sql, 256,
-             "select SUM(bytesRx), SUM(bytesTx), SUM(pktRxCount), SUM(pktTxCount) from \"%%s\" "
-             "where timestamp >= %ld;",
-             timestamp);
+    std::unique_lock<std::mutex> lock(mQueueMutex);
+    if (mQueue.empty())
+        return;
+
+    mFlushRequested = true;
+    mQueued.notify_one();
 
-    return fetchTrafficWithQuery(sql);
+    /* Gives up once a commit fails, what it couldn't write stays queued. */
+    const uint64_t attempts = mCommitAttempts;
+    mDequeued.wait(lock, [this, attempts] {
+        return mQueue.empty() || (mCommitFailing && mCommitAttempts > attempts);
+    });
 }
 
-TrafficMap DBController::fetchTrafficBetween(time_t start, time_t end) const
+DBWriteStats DBController::writeStats() const
 {
-    char sql[256];
-    snprintf(sql, 256,
-             "select SUM(bytesRx), SUM(bytesTx), SUM(pktRxCount), SUM(pktTxCount) from \"%%s\" "
-             "where timestamp >= %ld and timestamp <= %ld;",
-             start, end);
-
-    return fetchTrafficWithQuery(sql);
+    std::unique_lock<std::mutex> lock(mQueueMutex);
+    return mStats;
 }
 
-std::vector<std::string> DBController::fetchApplicationNames() const
+void DBController::writeLoop()
 {
-    const char* sqlGetApps = "select name from sqlite_schema where type='table';";
-    std::vector<std::string> names;
-
-    sqlite3_stmt* stmt;
-    sqlite3_prepare_v3(mHandle, sqlGetApps, strlen(sqlGetApps), 0, &stmt, nullptr);
-    while (sqlite3_step(stmt) == SQLITE_ROW)
+    for (;;)
     {
-        const char* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        std::vector<std::shared_ptr<const TrafficInterval>> batch;
+        {
+            std::unique_lock<std::mutex> lock(mQueueMutex);
+            mQueued.wait(lock, [this] { return !mQueue.empty() || !mRunning; });
+            if (mQueue.empty())
+                return;
+
+            /* Intervals deposited while we wait are committed along with the first one, so the
+             * database is synced once per flush interval rather than once per interval. After a
+             * failed commit the next one waits out the interval too, however much is queued. */
+            const int wait = mCommitFailing ? std::max(mFlushInterval, 1) : mFlushInterval;
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(wait);
+            mQueued.wait_until(lock, deadline, [this] {
+                return !mRunning || mFlushRequested ||
+                       (!mCommitFailing && mQueue.size() >= MAX_QUEUED_INTERVALS / 2);
+            });
+
+            mFlushRequested = false;
+
+            /* The intervals stay queued, and visible to reads, until they are committed. */
+            batch.assign(mQueue.begin(), mQueue.end());
+        }
 
-        if (name != nullptr)
-            names.push_back(name);
-    }
+        std::unique_lock<std::mutex> commitLock(mCommitMutex);
+        const bool committed = commit(batch);
+
+        std::unique_lock<std::mutex> lock(mQueueMutex);
+        mCommitAttempts++;
+
+        if (committed)
+        {
+            if (mCommitFailing)
+            {
+                std::cerr << ntmd::lognotice << "Database commits are succeeding again";
+                if (mStats.dropped > mDroppedReported)
+                {
+                    std::cerr << ", " << mStats.dropped - mDroppedReported
+                              << " intervals were dropped while they weren't";
+                }
+                std::cerr << ".\n";
+
+                mDroppedReported = mStats.dropped;
+            }
+
+            mCommitFailing = false;
+            mQueue.erase(mQueue.begin(), mQueue.begin() + batch.size());
+        }
+        else if (!mRunning)
+        {
+            std::cerr << ntmd::logerror << "Could not commit the last " << mQueue.size()
+                      << " intervals to the database before closing it, they are lost.\n";
+
+            mStats.failedCommits++;
+            mStats.dropped += mQueue.size();
+            mQueue.clear();
+        }
+        else
+        {
+            /* Left queued, where reads still see them, for the next flush to retry. */
+            std::cerr << ntmd::logwarn << "Could not commit " << batch.size()
+                      << " intervals to the database, " << mQueue.size()
+                      << " intervals are waiting to be retried in "
+                      << std::max(mFlushInterval, 1) << " seconds.\n";
+
+            mCommitFailing = true;
+            mStats.failedCommits++;
+        }
 
-    sqlite3_finalize(stmt);
-    return names;
+        mDequeued.notify_all();
+    }
 }
 
-TrafficMap DBController::fetchTrafficWithQuery(const char* query) const
+bool DBController::commit(const std::vector<std::shared_ptr<const TrafficInterval>>& batch)
 {
-    auto tables = fetchApplicationNames();
-    TrafficMap traffic;
+    const auto start = std::chrono::steady_clock::now();
+
+    uint64_t rows = 0;
+    if (!mStore->commit(batch, rows))
+        return false;
+
+    const auto end = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(mQueueMutex);
+    mStats.intervals += batch.size();
+    mStats.rows += rows;
+    mStats.commits++;
+    mStats.commitLatency.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    mStats.commitSeconds += std::chrono::duration<double>(end - start).count();
+    return true;
+}
 
-    for (const std::string& name : tables)
+void DBController::addQueued(TrafficMap& traffic, time_t start, time_t end) const
+{
+    std::unique_lock<std::mutex> lock(mQueueMutex);
+    for (const auto& interval : mQueue)
     {
-        TrafficLine line{};
-
-        char sqlReplaced[256];
-        snprintf(sqlReplaced, 256, query, name.c_str());
+        if (interval->timestamp < start || interval->timestamp > end)
+            continue;
 
-        sqlite3_stmt* stmt;
-        sqlite3_prepare_v3(mHandle, sqlReplaced, 256, 0, &stmt, nullptr);
-        if (sqlite3_step(stmt) == SQLITE_ROW)
-        {
-            line.bytesRx = sqlite3_column_int64(stmt, 0);
-            line.bytesTx = sqlite3_column_int64(stmt, 1);
-            line.pktRxCount = sqlite3_column_int64(stmt, 2);
-            line.pktTxCount = sqlite3_column_int64(stmt, 3);
-        }
-        else
+        for (const auto& [name, line] : interval->traffic)
         {
-            std::cerr << ntmd::logwarn << "Error fetching traffic with query: " << query << "\n";
+            traffic[name] += line;
         }
+    }
+}
 
-        /* If no traffic rows were returned from table query, don't include in traffic map. */
-        if (!line.empty())
-            traffic[name] = line;
+TrafficMap DBController::fetchTrafficSince(time_t timestamp) const
+{
+    return fetchTraffic(timestamp, std::numeric_limits<time_t>::max());
+}
 
-        sqlite3_finalize(stmt);
-    }
+TrafficMap DBController::fetchTrafficBetween(time_t start, time_t end) const
+{
+    return fetchTraffic(start, end);
+}
+
+TrafficMap DBController::fetchTraffic(time_t start, time_t end) const
+{
+    std::unique_lock<std::mutex> lock(mCommitMutex);
+    TrafficMap traffic = mStore->fetch(start, end);
 
+    addQueued(traffic, start, end);
     return traffic;
 }
 
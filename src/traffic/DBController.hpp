@@ -1,21 +1,37 @@
 #pragma once
 
+#include "TrafficStore.hpp"
+#include "util/LatencyHistogram.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <deque>
 #include <filesystem>
-#include <sqlite3.h>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 namespace ntmd {
 
-struct TrafficLine
+/* Counters of the database writer thread. */
+struct DBWriteStats
 {
-    uint64_t bytesRx{0}; /* Bytes received. */
-    uint64_t bytesTx{0}; /* Bytes transmitted. */
-    int pktRxCount{0};   /* Number of packets received. */
-    int pktTxCount{0};   /* Number of packets transmitted. */
+    uint64_t intervals{0}; /* Intervals of traffic committed. */
+    uint64_t rows{0};      /* Traffic lines inserted. */
+    uint64_t commits{0};   /* Transactions committed, each one syncs the database to disk. */
+    uint64_t maxQueued{0}; /* Most intervals that were ever waiting to be committed at once. */
+    uint64_t failedCommits{0}; /* Commits the store couldn't write, retried on the next flush. */
+    uint64_t dropped{0};       /* Intervals given up on, never written to the database. */
 
-    bool empty() { return bytesRx == 0 && bytesTx == 0 && pktRxCount == 0 && pktTxCount == 0; }
+    /* Time from beginning a transaction to the end of its commit. */
+    LatencyHistogram commitLatency{};
+    double commitSeconds{0};
 };
 
 class DBController
@@ -24,13 +40,31 @@ class DBController
 
   public:
     /* Opens or creates database at the given path.
-     * If the database is being created at the path it will be initalized with the correct schema.*/
-    DBController(std::filesystem::path dbPath);
+     * The engine is either "sqlite", a database file at the path, or "segments", a directory of
+     * append only segment files at the path with ".segments" appended. See SQLiteStore and
+     * SegmentStore.
+     * If the database is being created at the path it will be initalized with the correct schema.
+     * Deposited traffic is written by a separate thread that commits every flushInterval seconds,
+     * or as soon as it is deposited if flushInterval is 0.
+     * If rawRetentionDays isn't 0 per second traffic older than that many days is deleted, only
+     * the minute, hour and day rollups of it are kept (sqlite only). */
+    DBController(std::filesystem::path dbPath, int flushInterval = 0, int rawRetentionDays = 0,
+                 const std::string& engine = "sqlite");
+
+    /* Commits any traffic still waiting to be written before closing the database. */
     ~DBController();
 
-    /* Take the built up network traffic from TrafficStorage over the time interval
-     * and deposit the traffic into the database by application name and timestamp. */
-    void insertApplicationTraffic(const TrafficMap& traffic) const;
+    /* Take the built up network traffic from TrafficStorage over the time interval and queue it
+     * to be deposited into the database by application name and timestamp. The interval is shared
+     * with the caller rather than copied, it must not change afterwards. Only blocks if the writer
+     * has fallen far behind. */
+    void insertApplicationTraffic(std::shared_ptr<const TrafficInterval> interval);
+
+    /* Commit everything queued so far without waiting for the flush interval, blocking until it
+     * is done. */
+    void flush();
+
+    DBWriteStats writeStats() const;
 
     /* Fetch all traffic monitored after the given timestamp. */
     TrafficMap fetchTrafficSince(time_t timestamp) const;
@@ -40,15 +74,50 @@ class DBController
     TrafficMap fetchTrafficBetween(time_t start, time_t end) const;
 
   private:
-    /* Load application names from database tables into an empty traffic map. */
-    std::vector<std::string> fetchApplicationNames() const;
+    /* Commits queued intervals in batches until the controller is destroyed. */
+    void writeLoop();
+
+    /* Commit every interval of the batch to the store at once. Returns false if the store couldn't
+     * write it, nothing of the batch was committed then. */
+    bool commit(const std::vector<std::shared_ptr<const TrafficInterval>>& batch);
+
+    /* Add the traffic of queued intervals between start and end (inclusive) that hasn't been
+     * committed yet. mCommitMutex must be held so nothing is committed in the meantime. */
+    void addQueued(TrafficMap& traffic, time_t start, time_t end) const;
+
+    /* Total traffic of each application between two timestamps (inclusive), including traffic
+     * that is queued but not committed yet. */
+    TrafficMap fetchTraffic(time_t start, time_t end) const;
+
+    /* Only used by the writer and by reads while holding mCommitMutex. */
+    std::unique_ptr<TrafficStore> mStore;
+
+    int mFlushInterval;
+
+    /* Intervals deposited but not committed yet, oldest first. The writer only removes a batch
+     * once it is committed so reads never miss traffic in between. */
+    mutable std::mutex mQueueMutex;
+    mutable std::condition_variable mQueued;
+    mutable std::condition_variable mDequeued;
+    std::deque<std::shared_ptr<const TrafficInterval>> mQueue;
+
+    /* Set by flush to have the writer commit without waiting out the flush interval. */
+    bool mFlushRequested{false};
+
+    /* The last commit failed. Its intervals stay queued to be retried, unless the queue fills up
+     * and deposits would have to wait on a writer that isn't getting anywhere. */
+    bool mCommitFailing{false};
+    uint64_t mCommitAttempts{0};
+    uint64_t mDroppedReported{0}; /* mStats.dropped when commits last recovered. */
+
+    /* Held by the writer for a whole commit and by reads, so a read sees every interval either in
+     * the store or in mQueue but never both. */
+    mutable std::mutex mCommitMutex;
 
-    /* Generic common operation to grab a traffic from every
-     * application table based on a query for each individual table.
-     * The only format specifier left in the query string should be for the table name (%s). */
-    TrafficMap fetchTrafficWithQuery(const char* query) const;
+    DBWriteStats mStats;
 
-    sqlite3* mHandle{nullptr};
+    std::atomic<bool> mRunning{true};
+    std::thread mWriter;
 };
 
 } // namespace ntmd
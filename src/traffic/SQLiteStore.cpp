@@ -0,0 +1,549 @@
+#include "SQLiteStore.hpp"
+#include "Daemon.hpp"
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <sqlite3.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ntmd {
+
+using TrafficMap = std::unordered_map<std::string, TrafficLine>;
+
+/* Traffic is also summed over minutes, hours and days as it is committed. Each rollup table is
+ * shaped like the traffic table with the timestamp being the start of the span. Every span is a
+ * whole number of the finer spans so each tier can be built from the one before it. */
+struct Rollup
+{
+    const char* table;
+    time_t seconds;
+};
+
+static constexpr Rollup ROLLUPS[] = {
+    {"traffic_minute", 60},
+    {"traffic_hour", 60 * 60},
+    {"traffic_day", 24 * 60 * 60},
+};
+
+static_assert(std::size(ROLLUPS) == SQLiteStore::ROLLUP_TIERS);
+
+/* Retention is enforced at most this often, in seconds of committed traffic. */
+static constexpr time_t PRUNE_INTERVAL = 60 * 60;
+
+/* Adds to a row that already exists for the same application and timestamp instead of failing. */
+static constexpr const char* SQL_ADD_ON_CONFLICT =
+    " ON CONFLICT (app, timestamp) DO UPDATE SET "
+    "bytesRx = bytesRx + excluded.bytesRx, bytesTx = bytesTx + excluded.bytesTx, "
+    "pktRxCount = pktRxCount + excluded.pktRxCount, "
+    "pktTxCount = pktTxCount + excluded.pktTxCount;";
+
+static std::string createTrafficTableSql(const std::string& table)
+{
+    return "CREATE TABLE IF NOT EXISTS " + table +
+           " ("
+           "app INTEGER NOT NULL REFERENCES applications (id), "
+           "timestamp INTEGER NOT NULL, "
+           "bytesRx INTEGER DEFAULT 0, "
+           "bytesTx INTEGER DEFAULT 0, "
+           "pktRxCount INTEGER DEFAULT 0, "
+           "pktTxCount INTEGER DEFAULT 0, "
+           "PRIMARY KEY (app, timestamp)) WITHOUT ROWID;";
+}
+
+static std::string insertTrafficSql(const std::string& table)
+{
+    return "INSERT INTO " + table + " VALUES (?1, ?2, ?3, ?4, ?5, ?6)" + SQL_ADD_ON_CONFLICT;
+}
+
+/* Ranges of a query are stitched together from two ranges of each rollup table and two of the
+ * traffic table, see fetch. */
+static constexpr std::size_t RANGES_PER_TABLE = 2;
+static constexpr std::size_t QUERY_TABLES = std::size(ROLLUPS) + 1;
+
+static std::string selectTrafficSql()
+{
+    /* Walking the applications first lets every application's range of timestamps be read
+     * straight from each table's (app, timestamp) key. */
+    std::string sql = "SELECT name, SUM(rx), SUM(tx), SUM(pktRx), SUM(pktTx) FROM (";
+    int parameter = 1;
+    for (std::size_t i = 0; i < QUERY_TABLES; i++)
+    {
+        const std::string table = i < std::size(ROLLUPS) ? ROLLUPS[i].table : "traffic";
+        for (std::size_t range = 0; range < RANGES_PER_TABLE; range++)
+        {
+            if (parameter > 1)
+                sql += " UNION ALL ";
+
+            sql += "SELECT a.id AS id, a.name AS name, SUM(t.bytesRx) AS rx, SUM(t.bytesTx) AS tx, "
+                   "SUM(t.pktRxCount) AS pktRx, SUM(t.pktTxCount) AS pktTx "
+                   "FROM applications a CROSS JOIN " +
+                   table + " t ON t.app = a.id WHERE t.timestamp >= ?" +
+                   std::to_string(parameter) + " AND t.timestamp <= ?" +
+                   std::to_string(parameter + 1) + " GROUP BY a.id";
+            parameter += 2;
+        }
+    }
+
+    return sql + ") GROUP BY id;";
+}
+
+SQLiteStore::SQLiteStore(const std::filesystem::path& dbPath, int rawRetentionDays) :
+    mRawRetentionDays(rawRetentionDays)
+{
+    int error = sqlite3_open(dbPath.c_str(), &mHandle);
+    if (error)
+    {
+        std::cerr << ntmd::logerror << "Error opening or creating database at " << dbPath
+                  << " with error: " << sqlite3_errmsg(mHandle) << "\n";
+        std::cerr << ntmd::logerror << "Cannot proceed without database connection, exiting.\n";
+        std::exit(1);
+    }
+    std::cerr << ntmd::loginfo << "Successfully opened or created database file at: " << dbPath
+              << "\n";
+
+    /* With a write ahead log a commit appends to a single file and syncs it once, instead of
+     * writing a rollback journal, syncing it, updating the database and syncing again. */
+    char* err;
+    if (sqlite3_exec(mHandle, "PRAGMA journal_mode=WAL;", nullptr, nullptr, &err) != SQLITE_OK)
+    {
+        std::cerr << ntmd::logwarn << "Could not enable write ahead logging on the database: "
+                  << err << "\n";
+        sqlite3_free(err);
+    }
+
+    const bool rollupsCreated = createSchema();
+    migrateApplicationTables();
+    if (rollupsCreated)
+        backfillRollups();
+
+    mInsertApplication =
+        prepare("INSERT INTO applications (name) VALUES (?1) ON CONFLICT (name) DO NOTHING;");
+    mSelectApplication = prepare("SELECT id FROM applications WHERE name = ?1;");
+
+    /* Traffic deposited twice for the same second, like after a quick restart, is added to what
+     * was already there. */
+    mInsertTraffic = prepare(insertTrafficSql("traffic").c_str());
+    for (std::size_t i = 0; i < ROLLUP_TIERS; i++)
+        mInsertRollup[i] = prepare(insertTrafficSql(ROLLUPS[i].table).c_str());
+
+    mDeleteTraffic = prepare("DELETE FROM traffic WHERE app IN (SELECT id FROM applications) "
+                             "AND timestamp < ?1;");
+
+    mSelectTraffic = prepare(selectTrafficSql().c_str());
+}
+
+bool SQLiteStore::createSchema()
+{
+    bool rollupsExist = false;
+    sqlite3_stmt* stmt = prepare("SELECT 1 FROM sqlite_schema WHERE type = 'table' AND "
+                                 "name = 'traffic_day';");
+    rollupsExist = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+
+    /* Application names are stored once, traffic refers to them by id. Traffic is clustered by
+     * application then time so a range of an application's traffic is one contiguous read. */
+    std::string sqlCreateTables = "CREATE TABLE IF NOT EXISTS applications ("
+                                  "id INTEGER PRIMARY KEY, "
+                                  "name TEXT NOT NULL UNIQUE);" +
+                                  createTrafficTableSql("traffic");
+    for (const Rollup& rollup : ROLLUPS)
+        sqlCreateTables += createTrafficTableSql(rollup.table);
+
+    char* err;
+    if (sqlite3_exec(mHandle, sqlCreateTables.c_str(), nullptr, nullptr, &err) != SQLITE_OK)
+    {
+        std::cerr << ntmd::logerror << "Could not create the database tables: " << err << "\n";
+        std::cerr << ntmd::logerror << "Cannot proceed without database connection, exiting.\n";
+        sqlite3_free(err);
+        std::exit(1);
+    }
+
+    return !rollupsExist;
+}
+
+void SQLiteStore::backfillRollups()
+{
+    /* Each tier is summed from the finer one below it, so the traffic table is only read once. */
+    bool ok = sqlite3_exec(mHandle, "BEGIN TRANSACTION", nullptr, nullptr, nullptr) == SQLITE_OK;
+    std::string source = "traffic";
+    for (const Rollup& rollup : ROLLUPS)
+    {
+        const std::string start = "timestamp - timestamp % " + std::to_string(rollup.seconds);
+        const std::string sqlFill = std::string("INSERT INTO ") + rollup.table + " SELECT app, " +
+                                    start +
+                                    ", SUM(bytesRx), SUM(bytesTx), SUM(pktRxCount), "
+                                    "SUM(pktTxCount) FROM " +
+                                    source + " GROUP BY app, " + start + ";";
+
+        ok = ok && sqlite3_exec(mHandle, sqlFill.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+        source = rollup.table;
+    }
+
+    if (!ok || sqlite3_exec(mHandle, "COMMIT TRANSACTION", nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+        std::cerr << ntmd::logerror << "Could not fill the traffic rollup tables: "
+                  << sqlite3_errmsg(mHandle) << "\n";
+        std::cerr << ntmd::logerror << "Cannot proceed without database connection, exiting.\n";
+        sqlite3_exec(mHandle, "ROLLBACK TRANSACTION", nullptr, nullptr, nullptr);
+        std::exit(1);
+    }
+}
+
+void SQLiteStore::migrateApplicationTables()
+{
+    /* Databases written by older versions have a table of traffic per application. */
+    std::vector<std::string> tables;
+    sqlite3_stmt* stmt = prepare("SELECT name FROM sqlite_schema WHERE type = 'table' AND "
+                                 "name NOT IN ('applications', 'traffic', 'traffic_minute', "
+                                 "'traffic_hour', 'traffic_day') AND "
+                                 "name NOT LIKE 'sqlite\\_%' ESCAPE '\\';");
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const char* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+
+        if (name != nullptr)
+            tables.push_back(name);
+    }
+    sqlite3_finalize(stmt);
+
+    if (tables.empty())
+        return;
+
+    std::cerr << ntmd::loginfo << "Migrating " << tables.size()
+              << " application tables into the traffic table.\n";
+
+    /* Everything is moved in one transaction, if any of it fails the old tables are left as they
+     * were. */
+    bool ok = sqlite3_exec(mHandle, "BEGIN TRANSACTION", nullptr, nullptr, nullptr) == SQLITE_OK;
+    for (const std::string& name : tables)
+    {
+        if (!ok)
+            break;
+
+        /* Table names can't be bound, quote the name by doubling any quotes in it. */
+        std::string quoted = "\"";
+        for (const char c : name)
+        {
+            quoted += c;
+            if (c == '"')
+                quoted += '"';
+        }
+        quoted += "\"";
+
+        sqlite3_stmt* insertApp =
+            prepare("INSERT INTO applications (name) VALUES (?1) ON CONFLICT (name) DO NOTHING;");
+        sqlite3_bind_text(insertApp, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        ok = sqlite3_step(insertApp) == SQLITE_DONE;
+        sqlite3_finalize(insertApp);
+
+        const std::string sqlMove =
+            "INSERT INTO traffic SELECT a.id, t.timestamp, t.bytesRx, t.bytesTx, t.pktRxCount, "
+            "t.pktTxCount FROM " +
+            quoted +
+            " t, applications a WHERE a.name = ?1" + SQL_ADD_ON_CONFLICT;
+
+        sqlite3_stmt* move;
+        ok = ok && sqlite3_prepare_v2(mHandle, sqlMove.c_str(), -1, &move, nullptr) == SQLITE_OK;
+        if (ok)
+        {
+            sqlite3_bind_text(move, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+            ok = sqlite3_step(move) == SQLITE_DONE;
+            sqlite3_finalize(move);
+        }
+
+        const std::string sqlDrop = "DROP TABLE " + quoted + ";";
+        ok = ok && sqlite3_exec(mHandle, sqlDrop.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+    }
+
+    if (!ok || sqlite3_exec(mHandle, "COMMIT TRANSACTION", nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+        std::cerr << ntmd::logerror << "Could not migrate the application tables: "
+                  << sqlite3_errmsg(mHandle) << "\n";
+        std::cerr << ntmd::logerror << "Cannot proceed without database connection, exiting.\n";
+        sqlite3_exec(mHandle, "ROLLBACK TRANSACTION", nullptr, nullptr, nullptr);
+        std::exit(1);
+    }
+
+    /* Give the space of the dropped tables back. */
+    sqlite3_exec(mHandle, "VACUUM;", nullptr, nullptr, nullptr);
+}
+
+sqlite3_stmt* SQLiteStore::prepare(const char* sql)
+{
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v3(mHandle, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) !=
+        SQLITE_OK)
+    {
+        std::cerr << ntmd::logerror << "Could not prepare database statement \"" << sql
+                  << "\": " << sqlite3_errmsg(mHandle) << "\n";
+        std::cerr << ntmd::logerror << "Cannot proceed without database connection, exiting.\n";
+        std::exit(1);
+    }
+
+    return stmt;
+}
+
+SQLiteStore::~SQLiteStore()
+{
+    sqlite3_finalize(mInsertApplication);
+    sqlite3_finalize(mSelectApplication);
+    sqlite3_finalize(mInsertTraffic);
+    for (sqlite3_stmt* insertRollup : mInsertRollup)
+        sqlite3_finalize(insertRollup);
+    sqlite3_finalize(mDeleteTraffic);
+    sqlite3_finalize(mSelectTraffic);
+
+    sqlite3_close(mHandle);
+}
+
+bool SQLiteStore::commit(const std::vector<std::shared_ptr<const TrafficInterval>>& batch,
+                         uint64_t& rows)
+{
+    char* err;
+    if (sqlite3_exec(mHandle, "BEGIN TRANSACTION", nullptr, nullptr, &err) != SQLITE_OK)
+    {
+        std::cerr << ntmd::logwarn << "Error beginning application traffic db transaction.\n";
+        sqlite3_free(err);
+        return false;
+    }
+
+    /* Nothing of a batch is kept unless all of it was written, so it can be committed again. */
+    mNewApplications.clear();
+    auto rollback = [this] {
+        sqlite3_exec(mHandle, "ROLLBACK TRANSACTION", nullptr, nullptr, nullptr);
+        for (const std::string& name : mNewApplications)
+        {
+            mApplicationIds.erase(name);
+        }
+        return false;
+    };
+
+    /* Consecutive intervals mostly fall into the same minute, hour and day, so the batch is summed
+     * per span first and every rollup row is only written once per commit. */
+    std::array<std::map<std::pair<int64_t, time_t>, TrafficLine>, ROLLUP_TIERS> rollups;
+    time_t newest = 0;
+
+    rows = 0;
+    for (const auto& interval : batch)
+    {
+        newest = std::max(newest, interval->timestamp);
+
+        for (const auto& [name, line] : interval->traffic)
+        {
+            const int64_t app = applicationId(name);
+            if (app < 0)
+                return rollback();
+
+            for (std::size_t i = 0; i < ROLLUP_TIERS; i++)
+            {
+                const time_t span = interval->timestamp - interval->timestamp % ROLLUPS[i].seconds;
+                rollups[i][{app, span}] += line;
+            }
+
+            sqlite3_bind_int64(mInsertTraffic, 1, app);
+            sqlite3_bind_int64(mInsertTraffic, 2, interval->timestamp);
+            sqlite3_bind_int64(mInsertTraffic, 3, line.bytesRx);
+            sqlite3_bind_int64(mInsertTraffic, 4, line.bytesTx);
+            sqlite3_bind_int64(mInsertTraffic, 5, line.pktRxCount);
+            sqlite3_bind_int64(mInsertTraffic, 6, line.pktTxCount);
+
+            const int inserted = sqlite3_step(mInsertTraffic);
+            sqlite3_reset(mInsertTraffic);
+            if (inserted != SQLITE_DONE)
+            {
+                std::cerr << ntmd::logwarn
+                          << "Commit failed while trying to insert application traffic.\n";
+                return rollback();
+            }
+
+            rows++;
+        }
+    }
+
+    for (std::size_t i = 0; i < ROLLUP_TIERS; i++)
+    {
+        sqlite3_stmt* insert = mInsertRollup[i];
+        for (const auto& [key, line] : rollups[i])
+        {
+            sqlite3_bind_int64(insert, 1, key.first);
+            sqlite3_bind_int64(insert, 2, key.second);
+            sqlite3_bind_int64(insert, 3, line.bytesRx);
+            sqlite3_bind_int64(insert, 4, line.bytesTx);
+            sqlite3_bind_int64(insert, 5, line.pktRxCount);
+            sqlite3_bind_int64(insert, 6, line.pktTxCount);
+
+            const int inserted = sqlite3_step(insert);
+            sqlite3_reset(insert);
+            if (inserted != SQLITE_DONE)
+            {
+                std::cerr << ntmd::logwarn << "Commit failed while trying to insert "
+                          << ROLLUPS[i].table << " traffic.\n";
+                return rollback();
+            }
+        }
+    }
+
+    /* Retention follows the timestamps being committed rather than the clock, so replaying a
+     * capture prunes the same way the daemon would have. */
+    if (mRawRetentionDays > 0 && newest - mLastPrune >= PRUNE_INTERVAL)
+    {
+        pruneTraffic(newest - static_cast<time_t>(mRawRetentionDays) * 24 * 60 * 60);
+        mLastPrune = newest;
+    }
+
+    if (sqlite3_exec(mHandle, "COMMIT TRANSACTION", nullptr, nullptr, &err) != SQLITE_OK)
+    {
+        std::cerr << ntmd::logwarn << "Error commiting application traffic transaction.\n";
+        sqlite3_free(err);
+        return rollback();
+    }
+
+    // TODO: further research into this?
+    /* Occasionally sqlite with allocate more memory that persists after these insert statements.
+     * When a new table is made or accessed for the first time during runtime the sqlite object will
+     * allocate metadata for it to increase performance. Although this isn't that big of an issue,
+     * every once and a while it will allocate 4K-9K bytes seemingly randomly despite doing nothing
+     * unique from other calls to this function. At first I thought this was new cache pages but
+     * upon testing none were being created/used. Overtime this will build up memory usage.
+     * Furthermore, when calling functions like fetchTrafficWithQuery the memory used by sqlite will
+     * increase by almost 700K bytes and never get freed until I suppose it hits a hard limit
+     * despite there being no actual memory leak reported by valgrind. Manually releasing all memory
+     * like this is bound to decrease insertion performance but I think it is better than the
+     * alternative situation of ever increasing memory. Ideally we could find the proper settings
+     * for sqlite to avoid allocating the extra memory in the first place.
+     * Now that intervals are committed in batches this only happens once per flush. */
+    sqlite3_db_release_memory(mHandle);
+    return true;
+}
+
+void SQLiteStore::pruneTraffic(time_t before)
+{
+    sqlite3_bind_int64(mDeleteTraffic, 1, before);
+    if (sqlite3_step(mDeleteTraffic) != SQLITE_DONE)
+    {
+        std::cerr << ntmd::logwarn << "Could not delete traffic older than " << before << ": "
+                  << sqlite3_errmsg(mHandle) << "\n";
+    }
+    sqlite3_reset(mDeleteTraffic);
+}
+
+int64_t SQLiteStore::applicationId(const std::string& name)
+{
+    const auto found = mApplicationIds.find(name);
+    if (found != mApplicationIds.end())
+        return found->second;
+
+    /* First time the application is written since startup, it may already have an id from an
+     * earlier run. */
+    sqlite3_bind_text(mInsertApplication, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+    const int inserted = sqlite3_step(mInsertApplication);
+    sqlite3_reset(mInsertApplication);
+
+    int64_t id = -1;
+    sqlite3_bind_text(mSelectApplication, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+    if (inserted == SQLITE_DONE && sqlite3_step(mSelectApplication) == SQLITE_ROW)
+        id = sqlite3_column_int64(mSelectApplication, 0);
+    sqlite3_reset(mSelectApplication);
+
+    if (id < 0)
+    {
+        std::cerr << ntmd::logwarn << "Could not add application " << name
+                  << " to the database: " << sqlite3_errmsg(mHandle) << "\n";
+        return -1;
+    }
+
+    mApplicationIds[name] = id;
+    mNewApplications.push_back(name);
+    return id;
+}
+
+TrafficMap SQLiteStore::fetch(time_t start, time_t end)
+{
+    /* Nothing is stored that far ahead and it keeps end + 1 from overflowing below. */
+    end = std::min(end, std::numeric_limits<time_t>::max() - ROLLUPS[ROLLUP_TIERS - 1].seconds);
+
+    /* Split the range between the tables, coarsest first. Whole days in the middle of the range
+     * are read from the day rollups, whole hours on either side of those from the hour rollups and
+     * so on, with only the seconds at the very edges read from the traffic table. A range only has
+     * unaligned ends at the coarsest tier that covers part of it, past that each leftover piece
+     * has one end on a span boundary, so every table is read over at most two ranges. Unused
+     * ranges are left empty. */
+    std::array<std::pair<time_t, time_t>, QUERY_TABLES * RANGES_PER_TABLE> ranges;
+    ranges.fill({1, 0});
+
+    std::vector<std::pair<time_t, time_t>> pieces{{start, end}};
+    for (std::size_t tier = ROLLUP_TIERS; tier-- > 0;)
+    {
+        const time_t seconds = ROLLUPS[tier].seconds;
+        std::size_t used = 0;
+
+        std::vector<std::pair<time_t, time_t>> leftover;
+        for (const auto& [low, high] : pieces)
+        {
+            /* First and one past the last whole span inside the piece. */
+            const time_t first = (low / seconds + (low % seconds > 0)) * seconds;
+            const time_t last = (high + 1) / seconds * seconds;
+            if (first >= last)
+            {
+                leftover.push_back({low, high});
+                continue;
+            }
+
+            ranges[tier * RANGES_PER_TABLE + used++] = {first, last - 1};
+            if (low < first)
+                leftover.push_back({low, first - 1});
+            if (last <= high)
+                leftover.push_back({last, high});
+        }
+
+        pieces = std::move(leftover);
+    }
+
+    for (std::size_t i = 0; i < pieces.size(); i++)
+        ranges[ROLLUP_TIERS * RANGES_PER_TABLE + i] = pieces[i];
+
+    TrafficMap traffic;
+
+    for (std::size_t i = 0; i < ranges.size(); i++)
+    {
+        sqlite3_bind_int64(mSelectTraffic, i * 2 + 1, ranges[i].first);
+        sqlite3_bind_int64(mSelectTraffic, i * 2 + 2, ranges[i].second);
+    }
+
+    int ret;
+    while ((ret = sqlite3_step(mSelectTraffic)) == SQLITE_ROW)
+    {
+        const char* name = reinterpret_cast<const char*>(sqlite3_column_text(mSelectTraffic, 0));
+        if (name == nullptr)
+            continue;
+
+        TrafficLine line{};
+        line.bytesRx = sqlite3_column_int64(mSelectTraffic, 1);
+        line.bytesTx = sqlite3_column_int64(mSelectTraffic, 2);
+        line.pktRxCount = sqlite3_column_int64(mSelectTraffic, 3);
+        line.pktTxCount = sqlite3_column_int64(mSelectTraffic, 4);
+
+        /* If no traffic rows were returned for an application, don't include it in the map. */
+        if (!line.empty())
+            traffic[name] = line;
+    }
+
+    if (ret != SQLITE_DONE)
+    {
+        std::cerr << ntmd::logwarn << "Error fetching traffic between " << start << " and " << end
+                  << ": " << sqlite3_errmsg(mHandle) << "\n";
+    }
+
+    sqlite3_reset(mSelectTraffic);
+    return traffic;
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "TrafficStore.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <sqlite3.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ntmd {
+
+/* Keeps traffic in a sqlite database, a row per application per interval along with minute, hour
+ * and day rollups of it. */
+class SQLiteStore : public TrafficStore
+{
+  public:
+    /* Minute, hour and day tables that traffic is also summed into as it is committed. */
+    static constexpr std::size_t ROLLUP_TIERS = 3;
+
+    /* Opens or creates the database at the given path, creating or migrating its schema as
+     * needed. If rawRetentionDays isn't 0 per second traffic older than that many days is
+     * deleted, only the minute, hour and day rollups of it are kept. */
+    SQLiteStore(const std::filesystem::path& dbPath, int rawRetentionDays);
+    ~SQLiteStore() override;
+
+    SQLiteStore(const SQLiteStore&) = delete;
+    SQLiteStore& operator=(const SQLiteStore&) = delete;
+
+    /* Insert every interval of the batch in a single transaction. */
+    bool commit(const std::vector<std::shared_ptr<const TrafficInterval>>& batch,
+                uint64_t& rows) override;
+
+    TrafficMap fetch(time_t start, time_t end) override;
+
+  private:
+    /* Database id of an application, adding it to the applications table the first time it is
+     * seen. Returns -1 if it couldn't be added. */
+    int64_t applicationId(const std::string& name);
+
+    /* Create the applications, traffic and rollup tables if they don't exist yet. Returns true
+     * if the rollup tables had to be created. */
+    bool createSchema();
+
+    /* Fill the rollup tables from the traffic already in the traffic table. */
+    void backfillRollups();
+
+    /* Delete per second traffic from before the given timestamp. */
+    void pruneTraffic(time_t before);
+
+    /* Move the traffic of databases with a table per application into the traffic table. */
+    void migrateApplicationTables();
+
+    /* Prepare a statement that is kept for the lifetime of the store. Exits if the statement
+     * can't be prepared. */
+    sqlite3_stmt* prepare(const char* sql);
+
+    sqlite3* mHandle{nullptr};
+
+    int mRawRetentionDays;
+
+    /* Timestamp of the newest interval committed when traffic was last pruned. */
+    time_t mLastPrune{0};
+
+    /* Statements used by commits. */
+    sqlite3_stmt* mInsertApplication{nullptr};
+    sqlite3_stmt* mSelectApplication{nullptr};
+    sqlite3_stmt* mInsertTraffic{nullptr};
+    std::array<sqlite3_stmt*, ROLLUP_TIERS> mInsertRollup{};
+    sqlite3_stmt* mDeleteTraffic{nullptr};
+
+    /* Used by reads. */
+    sqlite3_stmt* mSelectTraffic{nullptr};
+
+    /* Ids of the applications committed since startup. */
+    std::unordered_map<std::string, int64_t> mApplicationIds;
+
+    /* Applications first given an id by the current commit, forgotten again if it is rolled
+     * back. */
+    std::vector<std::string> mNewApplications;
+};
+
+} // namespace ntmd
\ No newline at end of file
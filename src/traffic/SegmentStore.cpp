@@ -0,0 +1,551 @@
+#include "SegmentStore.hpp"
+#include "Daemon.hpp"
+#include "util/StringUtil.hpp"
+#include "util/Varint.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace ntmd {
+
+using TrafficMap = std::unordered_map<std::string, TrafficLine>;
+
+/* "NTSB", marks the start of every block. */
+static constexpr uint32_t BLOCK_MAGIC = 0x4253544e;
+
+static constexpr const char* APPLICATIONS_FILE = "applications";
+static constexpr const char* SEGMENT_EXTENSION = ".seg";
+
+/* Write all of data at the given offset, retrying short writes. */
+static bool writeAll(int fd, const uint8_t* data, std::size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        const ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        data += written;
+        size -= written;
+        offset += written;
+    }
+
+    return true;
+}
+
+SegmentStore::SegmentStore(const std::filesystem::path& directory) : mDirectory(directory)
+{
+    if (mDirectory == ":memory:")
+    {
+        std::string path = (std::filesystem::temp_directory_path() / "ntmd-segments-XXXXXX");
+        if (mkdtemp(path.data()) == nullptr)
+        {
+            std::cerr << ntmd::logerror << "Could not create a temporary segment directory. Error: "
+                      << strerror(errno) << "\n";
+            std::exit(1);
+        }
+
+        mDirectory = path;
+        mTemporary = true;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(mDirectory, ec);
+    if (ec)
+    {
+        std::cerr << ntmd::logerror << "Error opening or creating segment directory at "
+                  << mDirectory << " with error: " << ec.message() << "\n";
+        std::cerr << ntmd::logerror << "Cannot proceed without database connection, exiting.\n";
+        std::exit(1);
+    }
+
+    loadApplications();
+
+    for (const auto& entry : std::filesystem::directory_iterator(mDirectory, ec))
+    {
+        const std::filesystem::path& path = entry.path();
+        const std::string stem = path.stem().string();
+        if (path.extension() != SEGMENT_EXTENSION || !util::isNumber(stem))
+            continue;
+
+        loadSegment(std::stoll(stem), path);
+    }
+
+    std::cerr << ntmd::loginfo << "Opened segment directory at " << mDirectory << " with "
+              << mSegments.size() << " segments.\n";
+}
+
+SegmentStore::~SegmentStore()
+{
+    for (auto& [start, segment] : mSegments)
+    {
+        if (segment.map != nullptr)
+            munmap(const_cast<uint8_t*>(segment.map), segment.mapSize);
+    }
+
+    if (mWriteFd >= 0)
+        close(mWriteFd);
+
+    if (mTemporary)
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(mDirectory, ec);
+    }
+}
+
+time_t SegmentStore::segmentStart(time_t timestamp)
+{
+    time_t start = timestamp - timestamp % SEGMENT_SECONDS;
+    if (start > timestamp)
+        start -= SEGMENT_SECONDS;
+
+    return start;
+}
+
+uint32_t SegmentStore::checksum(const uint8_t* data, std::size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+void SegmentStore::loadApplications()
+{
+    const std::filesystem::path path = mDirectory / APPLICATIONS_FILE;
+
+    std::vector<uint8_t> data;
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        uint8_t buffer[1 << 16];
+        ssize_t count;
+        while ((count = read(fd, buffer, sizeof(buffer))) > 0)
+            data.insert(data.end(), buffer, buffer + count);
+        close(fd);
+    }
+
+    /* Every name is its length followed by its bytes. */
+    const uint8_t* position = data.data();
+    const uint8_t* end = data.data() + data.size();
+    while (position < end)
+    {
+        const uint8_t* record = position;
+
+        /* A varint is at most 10 bytes, only decode it once it is known to be complete. */
+        const uint8_t* last = position;
+        while (last < end && last - position < 10 && (*last & 0x80))
+            last++;
+        if (last == end || (*last & 0x80))
+            break;
+
+        const uint64_t length = util::getVarint(position);
+        if (length > static_cast<uint64_t>(end - position))
+        {
+            position = record;
+            break;
+        }
+
+        const std::string name(reinterpret_cast<const char*>(position), length);
+        mIds[name] = mNames.size();
+        mNames.push_back(name);
+        position += length;
+    }
+
+    mNamesSize = position - data.data();
+    if (mNamesSize < data.size())
+    {
+        std::cerr << ntmd::logwarn << "Cutting off a partly written application name at the end of "
+                  << path << ".\n";
+
+        std::error_code ec;
+        std::filesystem::resize_file(path, mNamesSize, ec);
+    }
+}
+
+void SegmentStore::loadSegment(time_t start, const std::filesystem::path& path)
+{
+    Segment& segment = mSegments[start];
+    segment.path = path;
+
+    const int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        std::cerr << ntmd::logerror << "Could not open segment " << path
+                  << ". Error: " << strerror(errno) << "\n";
+        std::cerr << ntmd::logerror << "Cannot proceed without database connection, exiting.\n";
+        std::exit(1);
+    }
+
+    const std::size_t fileSize = st.st_size;
+    void* map = nullptr;
+    if (fileSize > 0)
+    {
+        map = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            std::cerr << ntmd::logerror << "Could not map segment " << path
+                      << ". Error: " << strerror(errno) << "\n";
+            std::cerr << ntmd::logerror
+                      << "Cannot proceed without database connection, exiting.\n";
+            std::exit(1);
+        }
+    }
+
+    /* Only the headers are read here. Blocks are only ever appended, so a crash can only have
+     * left the last one incomplete and only its checksum is worth checking. */
+    const uint8_t* data = static_cast<const uint8_t*>(map);
+    std::size_t offset = 0;
+    while (offset + sizeof(BlockHeader) <= fileSize)
+    {
+        BlockHeader header;
+        memcpy(&header, data + offset, sizeof(header));
+
+        std::size_t length = 0;
+        for (const uint32_t bytes : header.columnBytes)
+            length += bytes;
+
+        if (header.magic != BLOCK_MAGIC || length > fileSize - offset - sizeof(header))
+            break;
+
+        const std::size_t next = offset + sizeof(header) + length;
+        if (next + sizeof(BlockHeader) > fileSize &&
+            checksum(data + offset + sizeof(header), length) != header.checksum)
+        {
+            break;
+        }
+
+        segment.blocks.push_back({offset, header.first, header.last});
+        offset = next;
+    }
+
+    if (map != nullptr)
+        munmap(map, fileSize);
+
+    segment.size = offset;
+    if (offset < fileSize)
+    {
+        std::cerr << ntmd::logwarn << "Cutting off " << fileSize - offset
+                  << " bytes of a partly written block at the end of segment " << path << ".\n";
+
+        if (ftruncate(fd, offset) < 0)
+        {
+            std::cerr << ntmd::logerror << "Could not truncate segment " << path
+                      << ". Error: " << strerror(errno) << "\n";
+            std::cerr << ntmd::logerror
+                      << "Cannot proceed without database connection, exiting.\n";
+            std::exit(1);
+        }
+    }
+
+    close(fd);
+}
+
+uint32_t SegmentStore::applicationId(const std::string& name)
+{
+    const auto found = mIds.find(name);
+    if (found != mIds.end())
+        return found->second;
+
+    const uint32_t id = mNames.size();
+    mIds[name] = id;
+    mNames.push_back(name);
+    return id;
+}
+
+bool SegmentStore::appendApplications(uint32_t from)
+{
+    std::vector<uint8_t> data;
+    for (uint32_t id = from; id < mNames.size(); id++)
+    {
+        util::putVarint(data, mNames[id].size());
+        data.insert(data.end(), mNames[id].begin(), mNames[id].end());
+    }
+
+    const std::filesystem::path path = mDirectory / APPLICATIONS_FILE;
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+
+    bool ok = fd >= 0 && writeAll(fd, data.data(), data.size(), mNamesSize) && fdatasync(fd) == 0;
+    if (!ok)
+    {
+        std::cerr << ntmd::logwarn << "Could not write application names to " << path
+                  << ". Error: " << strerror(errno) << "\n";
+
+        /* Forget the names so they are written again with the next commit. */
+        for (uint32_t id = from; id < mNames.size(); id++)
+            mIds.erase(mNames[id]);
+        mNames.resize(from);
+
+        if (fd >= 0 && ftruncate(fd, mNamesSize) < 0)
+        {
+            std::cerr << ntmd::logwarn << "Could not truncate " << path
+                      << " after a failed write.\n";
+        }
+    }
+    else
+    {
+        mNamesSize += data.size();
+    }
+
+    if (fd >= 0)
+        close(fd);
+
+    return ok;
+}
+
+bool SegmentStore::appendBlock(time_t start, const std::vector<Row>& rows)
+{
+    BlockHeader header{};
+    header.magic = BLOCK_MAGIC;
+    header.rows = rows.size();
+    header.first = rows.front().timestamp;
+    header.last = rows.front().timestamp;
+    for (const Row& row : rows)
+    {
+        header.first = std::min<int64_t>(header.first, row.timestamp);
+        header.last = std::max<int64_t>(header.last, row.timestamp);
+    }
+
+    /* Rows are in the order they were deposited, so the timestamps barely change from one row to
+     * the next. The first is stored relative to the block's lowest timestamp. */
+    std::array<std::vector<uint8_t>, COLUMNS> columns;
+    time_t previous = header.first;
+    for (const Row& row : rows)
+    {
+        util::putVarint(columns[0], row.app);
+        util::putVarint(columns[1], util::zigzag(row.timestamp - previous));
+        util::putVarint(columns[2], row.line.bytesRx);
+        util::putVarint(columns[3], row.line.bytesTx);
+        util::putVarint(columns[4], static_cast<uint64_t>(row.line.pktRxCount));
+        util::putVarint(columns[5], static_cast<uint64_t>(row.line.pktTxCount));
+
+        previous = row.timestamp;
+    }
+
+    std::vector<uint8_t> block(sizeof(header));
+    for (std::size_t i = 0; i < COLUMNS; i++)
+    {
+        header.columnBytes[i] = columns[i].size();
+        block.insert(block.end(), columns[i].begin(), columns[i].end());
+    }
+    header.checksum = checksum(block.data() + sizeof(header), block.size() - sizeof(header));
+    memcpy(block.data(), &header, sizeof(header));
+
+    Segment& segment = mSegments[start];
+    if (segment.path.empty())
+        segment.path = mDirectory / (std::to_string(start) + SEGMENT_EXTENSION);
+
+    if (mWriteFd < 0 || mWriteSegment != start)
+    {
+        if (mWriteFd >= 0)
+            close(mWriteFd);
+
+        mWriteFd = open(segment.path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        mWriteSegment = start;
+        if (mWriteFd < 0)
+        {
+            std::cerr << ntmd::logwarn << "Could not open segment " << segment.path
+                      << ". Error: " << strerror(errno) << "\n";
+            return false;
+        }
+    }
+
+    if (!writeAll(mWriteFd, block.data(), block.size(), segment.size) || fdatasync(mWriteFd) < 0)
+    {
+        std::cerr << ntmd::logwarn << "Could not append to segment " << segment.path
+                  << ". Error: " << strerror(errno) << "\n";
+
+        /* Don't leave part of the block behind for the next one to be written after. */
+        if (ftruncate(mWriteFd, segment.size) < 0)
+        {
+            std::cerr << ntmd::logwarn << "Could not truncate segment " << segment.path
+                      << " after a failed write.\n";
+        }
+
+        return false;
+    }
+
+    segment.blocks.push_back({segment.size, header.first, header.last});
+    segment.size += block.size();
+    return true;
+}
+
+bool SegmentStore::commit(const std::vector<std::shared_ptr<const TrafficInterval>>& batch,
+                          uint64_t& rows)
+{
+    rows = 0;
+
+    const uint32_t known = mNames.size();
+    std::map<time_t, std::vector<Row>> segments;
+    for (const auto& interval : batch)
+    {
+        std::vector<Row>& segment = segments[segmentStart(interval->timestamp)];
+        for (const auto& [name, line] : interval->traffic)
+        {
+            segment.push_back({applicationId(name), interval->timestamp, line});
+        }
+    }
+
+    if (mNames.size() > known && !appendApplications(known))
+        return false;
+
+    /* A batch is either written whole or not at all so that it can be committed again, blocks
+     * already appended to other segments are cut off if a later one fails. */
+    std::vector<std::pair<time_t, std::size_t>> appended;
+    for (const auto& [start, segmentRows] : segments)
+    {
+        if (segmentRows.empty())
+            continue;
+
+        const std::size_t size = mSegments[start].size;
+        if (!appendBlock(start, segmentRows))
+        {
+            for (const auto& [previous, previousSize] : appended)
+            {
+                Segment& segment = mSegments[previous];
+                if (truncate(segment.path.c_str(), previousSize) < 0)
+                {
+                    std::cerr << ntmd::logwarn << "Could not truncate segment " << segment.path
+                              << " after a failed commit.\n";
+                }
+
+                segment.blocks.pop_back();
+                segment.size = previousSize;
+            }
+
+            rows = 0;
+            return false;
+        }
+
+        appended.push_back({start, size});
+        rows += segmentRows.size();
+    }
+
+    return true;
+}
+
+const uint8_t* SegmentStore::map(Segment& segment)
+{
+    if (segment.size <= segment.mapSize)
+        return segment.map;
+
+    if (segment.map != nullptr)
+        munmap(const_cast<uint8_t*>(segment.map), segment.mapSize);
+    segment.map = nullptr;
+    segment.mapSize = 0;
+
+    const int fd = open(segment.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        std::cerr << ntmd::logwarn << "Could not open segment " << segment.path
+                  << ". Error: " << strerror(errno) << "\n";
+        return nullptr;
+    }
+
+    void* map = mmap(nullptr, segment.size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        std::cerr << ntmd::logwarn << "Could not map segment " << segment.path
+                  << ". Error: " << strerror(errno) << "\n";
+        return nullptr;
+    }
+
+    segment.map = static_cast<const uint8_t*>(map);
+    segment.mapSize = segment.size;
+    return segment.map;
+}
+
+void SegmentStore::sumBlock(const uint8_t* block, time_t start, time_t end,
+                            std::vector<TrafficLine>& totals) const
+{
+    BlockHeader header;
+    memcpy(&header, block, sizeof(header));
+
+    std::array<const uint8_t*, COLUMNS> columns;
+    columns[0] = block + sizeof(header);
+    for (std::size_t i = 1; i < COLUMNS; i++)
+        columns[i] = columns[i - 1] + header.columnBytes[i - 1];
+
+    /* The timestamps of a block entirely inside the range don't need to be read at all. */
+    const bool inside = header.first >= start && header.last <= end;
+    time_t timestamp = header.first;
+
+    for (uint32_t row = 0; row < header.rows; row++)
+    {
+        const uint64_t app = util::getVarint(columns[0]);
+        TrafficLine line{};
+        line.bytesRx = util::getVarint(columns[2]);
+        line.bytesTx = util::getVarint(columns[3]);
+        line.pktRxCount = static_cast<int>(util::getVarint(columns[4]));
+        line.pktTxCount = static_cast<int>(util::getVarint(columns[5]));
+
+        if (!inside)
+        {
+            timestamp += util::unzigzag(util::getVarint(columns[1]));
+            if (timestamp < start || timestamp > end)
+                continue;
+        }
+
+        if (app < totals.size())
+            totals[app] += line;
+    }
+}
+
+TrafficMap SegmentStore::fetch(time_t start, time_t end)
+{
+    std::vector<TrafficLine> totals(mNames.size());
+
+    for (auto it = mSegments.lower_bound(segmentStart(start));
+         it != mSegments.end() && it->first <= end; ++it)
+    {
+        Segment& segment = it->second;
+        if (segment.blocks.empty())
+            continue;
+
+        const uint8_t* data = nullptr;
+        for (const Block& block : segment.blocks)
+        {
+            if (block.last < start || block.first > end)
+                continue;
+
+            if (data == nullptr && (data = map(segment)) == nullptr)
+                break;
+
+            sumBlock(data + block.offset, start, end, totals);
+        }
+    }
+
+    TrafficMap traffic;
+    for (std::size_t app = 0; app < totals.size(); app++)
+    {
+        if (!totals[app].empty())
+            traffic[mNames[app]] = totals[app];
+    }
+
+    return traffic;
+}
+
+} // namespace ntmd
\ No newline at end of file
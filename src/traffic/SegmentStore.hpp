@@ -0,0 +1,134 @@
+#pragma once
+
+#include "TrafficStore.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ntmd {
+
+/* Append only storage engine for hosts with a lot of traffic to record.
+ * Traffic is kept in a segment file per day of timestamps. Every commit appends one block to the
+ * segment of each day it has traffic for and syncs it, nothing already written is ever modified.
+ * Within a block the application ids, timestamps and counters are stored column after column as
+ * variable length integers, timestamps as the change from the previous row, so a row takes a
+ * handful of bytes instead of a b-tree cell with its page and index overhead.
+ * Application names are appended to their own file and referred to by their position in it.
+ * The first and last timestamp of every block are kept in memory, reads map the segments that
+ * overlap the range and only decode the blocks that do. */
+class SegmentStore : public TrafficStore
+{
+  public:
+    /* Opens or creates the segment directory. ":memory:" creates a temporary directory that is
+     * removed again when the store is destroyed. A block left half written by a crash is cut
+     * off. */
+    explicit SegmentStore(const std::filesystem::path& directory);
+    ~SegmentStore() override;
+
+    SegmentStore(const SegmentStore&) = delete;
+    SegmentStore& operator=(const SegmentStore&) = delete;
+
+    /* Append a block per day of traffic in the batch. The application names are synced before
+     * any block that refers to them. */
+    bool commit(const std::vector<std::shared_ptr<const TrafficInterval>>& batch,
+                uint64_t& rows) override;
+
+    TrafficMap fetch(time_t start, time_t end) override;
+
+  private:
+    /* Every segment holds the traffic of one day of timestamps. */
+    static constexpr time_t SEGMENT_SECONDS = 24 * 60 * 60;
+
+    /* Application id, timestamp and the four counters. */
+    static constexpr std::size_t COLUMNS = 6;
+
+    /* Written in front of every block, in host byte order. */
+    struct BlockHeader
+    {
+        uint32_t magic;
+        uint32_t rows;
+        int64_t first;                             /* Lowest timestamp in the block. */
+        int64_t last;                              /* Highest timestamp in the block. */
+        std::array<uint32_t, COLUMNS> columnBytes; /* Length of each column, in order. */
+        uint32_t checksum;                         /* FNV-1a of every column. */
+        uint32_t reserved;
+    };
+
+    struct Block
+    {
+        std::size_t offset; /* Of the header within the segment. */
+        time_t first;
+        time_t last;
+    };
+
+    struct Segment
+    {
+        std::filesystem::path path;
+        std::size_t size{0}; /* Bytes of complete blocks, the file is never longer. */
+        std::vector<Block> blocks;
+
+        /* Read only mapping of the file, remapped once the file has grown past it. */
+        const uint8_t* map{nullptr};
+        std::size_t mapSize{0};
+    };
+
+    struct Row
+    {
+        uint32_t app;
+        time_t timestamp;
+        TrafficLine line;
+    };
+
+    /* Start of the day holding a timestamp, which names its segment. */
+    static time_t segmentStart(time_t timestamp);
+
+    static uint32_t checksum(const uint8_t* data, std::size_t size);
+
+    /* Read the application names, cutting off a name that was only partly written. */
+    void loadApplications();
+
+    /* Index the blocks of a segment file, cutting off anything after the last complete block. */
+    void loadSegment(time_t start, const std::filesystem::path& path);
+
+    /* Id of an application, giving it the next id if it hasn't been seen before. New names are
+     * only written to disk by appendApplications. */
+    uint32_t applicationId(const std::string& name);
+
+    /* Append and sync the names from the given id on. */
+    bool appendApplications(uint32_t from);
+
+    /* Append and sync a block holding the rows to the segment. */
+    bool appendBlock(time_t start, const std::vector<Row>& rows);
+
+    /* Add the rows of a block that fall between start and end to totals, indexed by
+     * application id. */
+    void sumBlock(const uint8_t* block, time_t start, time_t end,
+                  std::vector<TrafficLine>& totals) const;
+
+    /* Mapping of the whole segment, or nullptr if it can't be mapped. */
+    const uint8_t* map(Segment& segment);
+
+    std::filesystem::path mDirectory;
+    bool mTemporary{false};
+
+    /* Application names by id, as written to the applications file. */
+    std::vector<std::string> mNames;
+    std::unordered_map<std::string, uint32_t> mIds;
+    std::size_t mNamesSize{0}; /* Bytes of the applications file. */
+
+    /* Segments by the start of their day. */
+    std::map<time_t, Segment> mSegments;
+
+    /* Segment being appended to, kept open between commits. */
+    int mWriteFd{-1};
+    time_t mWriteSegment{0};
+};
+
+} // namespace ntmd
\ No newline at end of file
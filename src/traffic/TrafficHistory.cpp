@@ -0,0 +1,179 @@
+#include "TrafficHistory.hpp"
+#include "util/Varint.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ntmd {
+
+using TrafficMap = std::unordered_map<std::string, TrafficLine>;
+
+TrafficHistory::TrafficHistory(std::size_t memoryLimit) : mMemoryLimit(memoryLimit) {}
+
+std::size_t TrafficHistory::blockMemory(const Block& block)
+{
+    return sizeof(Block) + block.data.capacity();
+}
+
+void TrafficHistory::record(const TrafficMap& traffic, time_t timestamp)
+{
+    if (mMemoryLimit == 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (!mRecording)
+    {
+        mRecording = true;
+        mCoveredFrom = timestamp + 1;
+    }
+    else if (timestamp <= mLastRecorded)
+    {
+        /* The clock went back, or two deposits landed on the same second. Intervals have to be
+         * appended in order, so leave everything up to here to the database. */
+        mCoveredFrom = std::max(mCoveredFrom, timestamp + 1);
+        return;
+    }
+    mLastRecorded = timestamp;
+
+    for (const auto& [name, line] : traffic)
+    {
+        Series& series = mSeries[name];
+        if (series.empty() || series.back().count == INTERVALS_PER_BLOCK)
+        {
+            if (!series.empty())
+            {
+                /* A full block never grows again. */
+                Block& full = series.back();
+                mMemory -= blockMemory(full);
+                full.data.shrink_to_fit();
+                mMemory += blockMemory(full);
+            }
+
+            series.emplace_back();
+            series.back().first = timestamp;
+            series.back().last = timestamp;
+            mMemory += blockMemory(series.back());
+        }
+
+        Block& block = series.back();
+        mMemory -= blockMemory(block);
+
+        /* The first interval of a block is encoded relative to its own timestamp, so it has a
+         * gap of 0. */
+        const time_t gap = timestamp - block.last;
+        util::putVarint(block.data, util::zigzag(gap - block.lastGap));
+        util::putVarint(block.data, line.bytesRx);
+        util::putVarint(block.data, line.bytesTx);
+        util::putVarint(block.data, static_cast<uint64_t>(line.pktRxCount));
+        util::putVarint(block.data, static_cast<uint64_t>(line.pktTxCount));
+
+        block.lastGap = gap;
+        block.last = timestamp;
+        block.count++;
+        block.total += line;
+
+        mMemory += blockMemory(block);
+    }
+
+    evict();
+}
+
+void TrafficHistory::evict()
+{
+    while (mMemory > mMemoryLimit)
+    {
+        /* The block whose newest interval is the oldest of any application. */
+        Series* oldest = nullptr;
+        for (auto& [name, series] : mSeries)
+        {
+            if (series.empty())
+                continue;
+
+            if (oldest == nullptr || series.front().last < oldest->front().last)
+                oldest = &series;
+        }
+
+        if (oldest == nullptr)
+            break;
+
+        /* Other applications may still have older intervals, but from here on they all do. */
+        mCoveredFrom = std::max(mCoveredFrom, oldest->front().last + 1);
+        mMemory -= blockMemory(oldest->front());
+        oldest->pop_front();
+    }
+
+    for (auto it = mSeries.begin(); it != mSeries.end();)
+    {
+        if (it->second.empty())
+            it = mSeries.erase(it);
+        else
+            ++it;
+    }
+}
+
+void TrafficHistory::sumBlock(const Block& block, time_t start, time_t end, TrafficLine& line)
+{
+    if (block.first >= start && block.last <= end)
+    {
+        line += block.total;
+        return;
+    }
+
+    const uint8_t* data = block.data.data();
+    time_t timestamp = block.first;
+    time_t gap = 0;
+    for (uint32_t i = 0; i < block.count; i++)
+    {
+        gap += util::unzigzag(util::getVarint(data));
+        timestamp += gap;
+
+        TrafficLine interval{};
+        interval.bytesRx = util::getVarint(data);
+        interval.bytesTx = util::getVarint(data);
+        interval.pktRxCount = static_cast<int>(util::getVarint(data));
+        interval.pktTxCount = static_cast<int>(util::getVarint(data));
+
+        if (timestamp > end)
+            return;
+
+        if (timestamp >= start)
+            line += interval;
+    }
+}
+
+bool TrafficHistory::fetch(time_t start, time_t end, TrafficMap& traffic) const
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (!mRecording || start < mCoveredFrom)
+        return false;
+
+    for (const auto& [name, series] : mSeries)
+    {
+        TrafficLine line{};
+
+        /* Blocks are in order, skip the ones that end before the range without decoding them. */
+        auto block = std::lower_bound(series.begin(), series.end(), start,
+                                      [](const Block& b, time_t t) { return b.last < t; });
+        for (; block != series.end() && block->first <= end; ++block)
+        {
+            sumBlock(*block, start, end, line);
+        }
+
+        if (!line.empty())
+            traffic[name] += line;
+    }
+
+    return true;
+}
+
+std::size_t TrafficHistory::memory() const
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mMemory;
+}
+
+} // namespace ntmd
\ No newline at end of file
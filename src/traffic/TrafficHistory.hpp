@@ -0,0 +1,89 @@
+#pragma once
+
+#include "TrafficStore.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ntmd {
+
+/* Compressed copy of the most recent intervals of traffic deposited into the database, so queries
+ * over the last few minutes or hours can be answered from memory without going through sqlite or
+ * waiting on the database writer.
+ * Every application's intervals are appended to a series of small blocks. Within a block each
+ * interval is stored as variable length integers: the change in the gap between timestamps, which
+ * is 0 for almost every interval, followed by the four counters. A typical interval takes around
+ * 10 bytes instead of 40. Blocks also keep their total so a query only decodes the blocks at the
+ * edges of its range.
+ * Once the blocks take more than the memory limit the oldest are dropped, across all
+ * applications. */
+class TrafficHistory
+{
+    using TrafficMap = std::unordered_map<std::string, TrafficLine>;
+
+  public:
+    /* A memory limit of 0 keeps no history. */
+    explicit TrafficHistory(std::size_t memoryLimit);
+    ~TrafficHistory() = default;
+
+    /* Append the traffic deposited for an interval. Timestamps are expected to only increase,
+     * an interval older than the last one recorded is dropped and everything up to it is left to
+     * the database. */
+    void record(const TrafficMap& traffic, time_t timestamp);
+
+    /* Total traffic of each application between two timestamps (inclusive), the same as the
+     * database would return for traffic deposited by this process. Returns false if some of the
+     * range might be missing from memory, the database has to be asked instead. */
+    bool fetch(time_t start, time_t end, TrafficMap& traffic) const;
+
+    /* Bytes used by the blocks of every application. */
+    std::size_t memory() const;
+
+  private:
+    /* Intervals are appended to a block until it holds this many. */
+    static constexpr uint32_t INTERVALS_PER_BLOCK = 64;
+
+    struct Block
+    {
+        time_t first{0};     /* Timestamp of the first interval, stored as is. */
+        time_t last{0};      /* Timestamp of the last interval. */
+        time_t lastGap{0};   /* Gap between the last two intervals, to encode the next one. */
+        uint32_t count{0};   /* Number of intervals in the block. */
+        TrafficLine total{}; /* Sum of every interval in the block. */
+        std::vector<uint8_t> data;
+    };
+
+    /* Blocks of a single application, oldest first. */
+    using Series = std::deque<Block>;
+
+    /* Bytes a block is accounted for. */
+    static std::size_t blockMemory(const Block& block);
+
+    /* Add the intervals of a block that fall between start and end to line. */
+    static void sumBlock(const Block& block, time_t start, time_t end, TrafficLine& line);
+
+    /* Drop the oldest blocks until the memory limit is met again. */
+    void evict();
+
+    mutable std::mutex mMutex;
+
+    std::unordered_map<std::string, Series> mSeries;
+
+    std::size_t mMemoryLimit;
+    std::size_t mMemory{0};
+
+    /* Every interval with a timestamp from here on is in memory. Nothing is until the first
+     * interval is recorded. Traffic deposited at the first timestamp could also have been
+     * deposited at the same second by a previous run, so coverage only starts after it. */
+    time_t mCoveredFrom{0};
+    time_t mLastRecorded{0};
+    bool mRecording{false};
+};
+
+} // namespace ntmd
\ No newline at end of file
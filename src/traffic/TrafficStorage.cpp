@@ -2,11 +2,14 @@
 
 #include "Daemon.hpp"
 #include "net/Packet.hpp"
+#include "proc/ApplicationIndex.hpp"
 #include "proc/ProcessIndex.hpp"
 #include "util/HumanReadable.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <limits>
 #include <mutex>
 #include <thread>
 
@@ -14,17 +17,49 @@ namespace ntmd {
 
 using TrafficMap = std::unordered_map<std::string, TrafficLine>;
 
-TrafficStorage::TrafficStorage(int interval, const DBController& db) : mDB(db), mInterval(interval)
+TrafficStorage::TrafficStorage(int interval, DBController& db, int shards, bool realtime,
+                               std::size_t historySize) :
+    mDB(db), mInterval(interval), mHistory(historySize)
 {
-    this->depositLoop();
+    for (int i = 0; i < std::max(shards, 1); i++)
+    {
+        mShards.push_back(std::make_unique<Shard>());
+    }
+
+    if (realtime)
+        this->depositLoop();
 }
 
-void TrafficStorage::add(const Process& process, const Packet& pkt)
+std::unique_lock<std::mutex> TrafficStorage::lockForAdd(Shard& shard)
 {
-    /* Get existing traffic line for application, or create an empty one */
-    TrafficLine& line = mApplicationTraffic[process.comm];
+    /* Only a busy shard is worth reading the clock for. */
+    std::unique_lock<std::mutex> lock(shard.mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        const auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        const auto end = std::chrono::steady_clock::now();
+
+        shard.latency.waits.record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+
+    shard.latency.adds++;
+    return lock;
+}
+
+void TrafficStorage::add(uint32_t app, const Packet& pkt, int shard)
+{
+    Shard& s = *mShards[shard];
+    std::unique_lock<std::mutex> lock = lockForAdd(s);
+    std::vector<TrafficLine>& traffic = *s.active;
+
+    /* Only grows the first time a new application is seen by this buffer. */
+    if (app >= traffic.size())
+        traffic.resize(app + 1);
+
+    TrafficLine& line = traffic[app];
 
-    std::unique_lock<std::mutex> lock(mMutex);
     if (pkt.direction == Direction::Incoming)
     {
         line.bytesRx += pkt.len;
@@ -37,31 +72,196 @@ void TrafficStorage::add(const Process& process, const Packet& pkt)
     }
 }
 
+void TrafficStorage::add(uint32_t app, const TrafficLine& traffic, int shard)
+{
+    Shard& s = *mShards[shard];
+    std::unique_lock<std::mutex> lock = lockForAdd(s);
+    std::vector<TrafficLine>& lines = *s.active;
+
+    if (app >= lines.size())
+        lines.resize(app + 1);
+
+    lines[app] += traffic;
+}
+
+int TrafficStorage::addDepositHook(DepositHook hook)
+{
+    std::unique_lock<std::mutex> lock(mHookMutex);
+    mDepositHooks[mNextHook] = std::move(hook);
+    return mNextHook++;
+}
+
+void TrafficStorage::removeDepositHook(int id)
+{
+    std::unique_lock<std::mutex> lock(mHookMutex);
+    mDepositHooks.erase(id);
+}
+
+int TrafficStorage::addDepositListener(DepositListener listener)
+{
+    std::unique_lock<std::mutex> lock(mListenerMutex);
+    mDepositListeners[mNextListener] = std::move(listener);
+    return mNextListener++;
+}
+
+void TrafficStorage::removeDepositListener(int id)
+{
+    std::unique_lock<std::mutex> lock(mListenerMutex);
+    mDepositListeners.erase(id);
+}
+
+uint64_t TrafficStorage::depositSequence() const
+{
+    return mDepositSequence.load();
+}
+
+int TrafficStorage::interval() const
+{
+    return mInterval;
+}
+
 std::pair<TrafficMap, int> TrafficStorage::getLiveSnapshot() const
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    return {mApplicationTraffic, mInterval};
+    return {collect(false), mInterval};
 }
 
-bool TrafficStorage::awaitSnapshot(std::mutex& mutex, TrafficMap& traffic, int& interval)
+TrafficMap TrafficStorage::collect(bool clear) const
 {
-    std::unique_lock<std::mutex> lock(mMutex);
+    TrafficMap traffic;
+    auto merge = [&traffic](const std::vector<TrafficLine>& lines) {
+        for (uint32_t app = 0; app < lines.size(); app++)
+        {
+            if (!lines[app].empty())
+                traffic[ApplicationIndex::instance().name(app)] += lines[app];
+        }
+    };
+
+    for (const auto& shard : mShards)
+    {
+        if (!clear)
+        {
+            std::vector<TrafficLine> lines;
+            {
+                std::unique_lock<std::mutex> lock(shard->mutex);
+                lines = *shard->active;
+            }
+
+            merge(lines);
+            continue;
+        }
+
+        /* Once swapped no capture thread can reach the retired buffer, it was cleared when it was
+         * last retired and is only written to again after the next swap. */
+        std::vector<TrafficLine>* retired;
+        {
+            std::unique_lock<std::mutex> lock(shard->mutex);
+            retired = shard->active;
+            shard->active = retired == &shard->buffers[0] ? &shard->buffers[1] : &shard->buffers[0];
+        }
 
-    /* TODO: Only one thread can be waiting (for now). */
-    if (mAPIWaiting)
+        merge(*retired);
+        std::fill(retired->begin(), retired->end(), TrafficLine());
+    }
+
+    return traffic;
+}
+
+TrafficMap TrafficStorage::fetchTrafficSince(time_t timestamp) const
+{
+    TrafficMap traffic;
+    if (mHistory.fetch(timestamp, std::numeric_limits<time_t>::max(), traffic))
+        return traffic;
+
+    return mDB.fetchTrafficSince(timestamp);
+}
+
+TrafficMap TrafficStorage::fetchTrafficBetween(time_t start, time_t end) const
+{
+    TrafficMap traffic;
+    if (mHistory.fetch(start, end, traffic))
+        return traffic;
+
+    return mDB.fetchTrafficBetween(start, end);
+}
+
+AddLatency TrafficStorage::addLatency() const
+{
+    AddLatency latency;
+    for (const auto& shard : mShards)
+    {
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        latency += shard->latency;
+    }
+
+    return latency;
+}
+
+bool TrafficStorage::advance(std::time_t now)
+{
+    if (mIntervalEnd == 0)
+        mIntervalEnd = now - now % mInterval + mInterval;
+
+    if (now < mIntervalEnd)
         return false;
 
-    mAPIWaiting = true;
-    apiMutex = &mutex;
-    apiTrafficMap = &traffic;
-    apiInterval = &interval;
+    deposit(mIntervalEnd);
 
-    /* Once we have pointers to the desired variables to place the live updated traffic data, lock
-     * the mutex so that the caller of this method can wait until we have set them. */
-    apiMutex->lock();
+    /* Jump straight to the interval containing now, there is nothing to deposit for the
+     * intervals in between. */
+    mIntervalEnd = now - now % mInterval + mInterval;
     return true;
 }
 
+void TrafficStorage::flush()
+{
+    if (mIntervalEnd != 0)
+        deposit(mIntervalEnd);
+}
+
+void TrafficStorage::deposit(std::time_t timestamp)
+{
+    {
+        std::unique_lock<std::mutex> lock(mHookMutex);
+        for (const auto& [id, hook] : mDepositHooks)
+        {
+            hook.request();
+        }
+
+        /* Waits share the deadline, so hooks that run out of time don't add up. */
+        const auto deadline = std::chrono::steady_clock::now() + DEPOSIT_HOOK_TIMEOUT;
+        for (const auto& [id, hook] : mDepositHooks)
+        {
+            hook.wait(deadline);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    /* Merge every capture worker's traffic for this interval. Never changed once built, so the
+     * database writer and every listener can share it. */
+    auto interval = std::make_shared<TrafficInterval>();
+    interval->traffic = collect(true);
+    interval->timestamp = timestamp;
+
+    /* Readers can see the traffic as soon as it is handed to the database, the sequence stays odd
+     * until the listeners have been told about it too. */
+    mDepositSequence++;
+    mDB.insertApplicationTraffic(interval);
+    mHistory.record(interval->traffic, timestamp);
+
+    {
+        const std::shared_ptr<const TrafficInterval> deposited = std::move(interval);
+
+        std::unique_lock<std::mutex> listenerLock(mListenerMutex);
+        for (const auto& [id, listener] : mDepositListeners)
+        {
+            listener(deposited);
+        }
+    }
+    mDepositSequence++;
+}
+
 void TrafficStorage::depositLoop()
 {
     std::thread loop([this] {
@@ -69,36 +269,7 @@ void TrafficStorage::depositLoop()
         {
             std::this_thread::sleep_for(std::chrono::seconds(mInterval));
 
-            std::unique_lock<std::mutex> lock(mMutex);
-
-            mDB.insertApplicationTraffic(mApplicationTraffic);
-
-            // TODO: multiple listeners?
-            /* If the APIController is hooked into the traffic storage and waiting to receive live
-             * traffic updates, set the api member variables with our internal traffic structures
-             * and let the API controller know it has received the updated traffic by unlocking
-             * their mutex.
-             */
-            if (mAPIWaiting)
-            {
-                if (apiMutex == nullptr || apiTrafficMap == nullptr || apiInterval == nullptr)
-                {
-                    std::cerr << ntmd::logdebug
-                              << "Live API hook variables were not set despite mAPIWaiting being "
-                                 "set true.\n";
-                    mAPIWaiting = false;
-                }
-                else
-                {
-                    /* These pointers become invalidated the moment the apiMutex is unlocked. */
-                    *apiTrafficMap = mApplicationTraffic;
-                    *apiInterval = mInterval;
-                    mAPIWaiting = false;
-                    apiMutex->unlock();
-                }
-            }
-
-            mApplicationTraffic.clear();
+            deposit(std::time(nullptr));
         }
     });
     loop.detach();
@@ -1,17 +1,43 @@
 #pragma once
 
 #include "DBController.hpp"
+#include "TrafficHistory.hpp"
 #include "net/Packet.hpp"
 #include "proc/ProcessIndex.hpp"
+#include "util/LatencyHistogram.hpp"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace ntmd {
 
+/* How long TrafficStorage::add had to wait for its shard. Adds that got the shard straight away are
+ * only counted, the ones that had to wait for a deposit or snapshot to let go of it are timed. */
+struct AddLatency
+{
+    uint64_t adds{0};
+    LatencyHistogram waits{};
+
+    AddLatency& operator+=(const AddLatency& other)
+    {
+        adds += other.adds;
+        waits += other.waits;
+        return *this;
+    }
+};
+
 /* In memory storage for network traffic monitored from all processes
  * since the last database deposit. The TrafficStorage is cleared on a
  * set interval after its data is sent to the database. */
@@ -20,45 +46,142 @@ class TrafficStorage
     using TrafficMap = std::unordered_map<std::string, TrafficLine>;
 
   public:
-    TrafficStorage(int interval, const DBController& db);
+    using DepositListener = std::function<void(const std::shared_ptr<const TrafficInterval>&)>;
+
+    /* Run right before every deposit in two steps, so that hooks which take a while overlap:
+     * every hook's request is called first, then every hook's wait, which should return by a
+     * deadline shared by all of them. */
+    struct DepositHook
+    {
+        std::function<void()> request;
+        std::function<void(std::chrono::steady_clock::time_point deadline)> wait;
+    };
+
+    /* Traffic is accumulated in one shard per capture worker so that workers never contend on
+     * the same lock, the shards are merged whenever the traffic is read.
+     * A storage that isn't realtime never deposits on its own, its clock is driven by advance.
+     * Up to historySize bytes of recently deposited traffic are also kept in memory to answer
+     * queries over recent ranges. */
+    TrafficStorage(int interval, DBController& db, int shards = 1, bool realtime = true,
+                   std::size_t historySize = 0);
     ~TrafficStorage() = default;
 
-    /* Adds the packet length (amount of bytes rx/tx) to
-     * the application's total traffic during this interval. */
-    void add(const Process& process, const Packet& pkt);
+    /* Adds the packet length (amount of bytes rx/tx) to the total traffic during this interval of
+     * the application with the given id in the ApplicationIndex, in the given shard. */
+    void add(uint32_t app, const Packet& pkt, int shard = 0);
+
+    /* Adds traffic already accumulated elsewhere to the application's total in the given shard. */
+    void add(uint32_t app, const TrafficLine& traffic, int shard = 0);
+
+    /* Register a hook to run before every deposit, used to credit traffic that is still waiting
+     * to be attributed to a process. Returns an id for removeDepositHook. */
+    int addDepositHook(DepositHook hook);
+
+    /* Once this returns the hook is not running and will never be called again. */
+    void removeDepositHook(int id);
+
+    /* Register a function to be called with every deposit right after it has been handed to the
+     * database. All listeners share the same immutable interval and may keep it as long as they
+     * like. Listeners run on the depositing thread so they should only hand the interval off.
+     * Returns an id for removeDepositListener. */
+    int addDepositListener(DepositListener listener);
+
+    /* Once this returns the listener is not running and will never be called again. */
+    void removeDepositListener(int id);
+
+    /* Number of deposits started and finished so far, odd while one is being made. A read that
+     * sees the same even sequence before and after it didn't overlap a deposit, and every deposit
+     * it includes has already been passed to the listeners. */
+    uint64_t depositSequence() const;
+
+    /* Seconds between deposits. */
+    int interval() const;
 
     /* Returns snapshot of whatever traffic data is stored in memory before database deposit.
      * Could be empty if called right after database deposit interval,
-     * use awaitSnapshot if this is a concern. */
+     * use a deposit listener if this is a concern. */
     std::pair<TrafficMap, int> getLiveSnapshot() const;
 
-    /* Method to synchronously set the live in-memory traffic to the given variables in a different
-     * thread. The given mutex must be unlocked, and the caller should immediately try to lock it
-     * after this method call. Once the caller has relocked their mutex the traffic and interval
-     * variables will be set. */
-    bool awaitSnapshot(std::mutex& mutex, TrafficMap& traffic, int& interval);
+    /* Move the clock of a storage that isn't realtime to the given time, depositing the traffic
+     * accumulated so far if an interval boundary was crossed. Used to bucket replayed traffic by
+     * the capture timestamps of the packets. Returns true if a deposit was made. */
+    bool advance(std::time_t now);
+
+    /* Deposit whatever traffic is left in the current interval of a storage that isn't
+     * realtime. */
+    void flush();
+
+    /* Fetch all deposited traffic monitored after the given timestamp. Served from the recent
+     * history in memory if it covers the range, otherwise from the database. */
+    TrafficMap fetchTrafficSince(time_t timestamp) const;
+
+    /* Fetch all deposited traffic monitored between two timestamps (inclusive), from memory
+     * if possible like fetchTrafficSince. */
+    TrafficMap fetchTrafficBetween(time_t start, time_t end) const;
+
+    /* Wait times of every add so far, across all shards. */
+    AddLatency addLatency() const;
 
   private:
+    /* Longest a deposit waits for all of its hooks together. */
+    static constexpr std::chrono::seconds DEPOSIT_HOOK_TIMEOUT{1};
+
+    /* Traffic accumulated by a single capture worker. Aligned so that shards written by different
+     * threads never share a cache line. */
+    struct alignas(64) Shard
+    {
+        /* Total traffic monitored for each application, indexed by the application's id in the
+         * ApplicationIndex. Applications without traffic this interval have an empty line.
+         * The current interval is counted in the active buffer while the other holds the last
+         * interval as it is being deposited. A deposit only holds the lock to swap the two, so
+         * capture threads are never held up by the database. */
+        std::array<std::vector<TrafficLine>, 2> buffers{};
+        std::vector<TrafficLine>* active{&buffers[0]};
+
+        AddLatency latency{};
+        std::mutex mutex;
+    };
+
+    /* Lock a shard for an add, timing how long it took if the shard was busy. */
+    static std::unique_lock<std::mutex> lockForAdd(Shard& shard);
+
     /* Display all applications and their accumulated traffic to stderr.
      * Primarily for debugging. */
     void depositLoop();
 
-    /* Map that stores the total traffic monitored for each application.
-     * The string key is the name of the application gathered from
-     * the process' comm name */
-    TrafficMap mApplicationTraffic{};
+    /* Deposit the traffic of every shard into the database under the given timestamp and pass it
+     * to the deposit listeners. */
+    void deposit(std::time_t timestamp);
+
+    /* Merge the traffic of every shard into a single map keyed by application name. Clearing
+     * retires each shard's active buffer, which must only happen from one thread at a time. */
+    TrafficMap collect(bool clear) const;
+
+    std::vector<std::unique_ptr<Shard>> mShards;
+
+    /* Held while hooks run so a hook can't be removed part way through a call. */
+    std::mutex mHookMutex;
+    std::map<int, DepositHook> mDepositHooks;
+    int mNextHook{0};
+
+    /* Held while listeners run, like mHookMutex. */
+    std::mutex mListenerMutex;
+    std::map<int, DepositListener> mDepositListeners;
+    int mNextListener{0};
+
+    std::atomic<uint64_t> mDepositSequence{0};
+
+    /* Serializes deposits with live snapshots. */
     mutable std::mutex mMutex;
 
-    const DBController& mDB;
+    DBController& mDB;
     int mInterval;
 
-    /* Live API Watchers */
-    /* We do not own these variables, they are borrowed from the API Controller
-     * that is watching this traffic storage for live in-memory traffic updates. */
-    bool mAPIWaiting{false};
-    std::mutex* apiMutex;
-    TrafficMap* apiTrafficMap;
-    int* apiInterval;
+    /* Recently deposited traffic, has its own lock so queries never wait on a deposit. */
+    TrafficHistory mHistory;
+
+    /* End of the current interval when the clock is driven by advance. */
+    std::time_t mIntervalEnd{0};
 };
 
 } // namespace ntmd
\ No newline at end of file
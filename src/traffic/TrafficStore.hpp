@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ntmd {
+
+struct TrafficLine
+{
+    uint64_t bytesRx{0}; /* Bytes received. */
+    uint64_t bytesTx{0}; /* Bytes transmitted. */
+    int pktRxCount{0};   /* Number of packets received. */
+    int pktTxCount{0};   /* Number of packets transmitted. */
+
+    bool empty() const
+    {
+        return bytesRx == 0 && bytesTx == 0 && pktRxCount == 0 && pktTxCount == 0;
+    }
+
+    bool operator==(const TrafficLine& other) const
+    {
+        return bytesRx == other.bytesRx && bytesTx == other.bytesTx &&
+               pktRxCount == other.pktRxCount && pktTxCount == other.pktTxCount;
+    }
+
+    bool operator!=(const TrafficLine& other) const { return !(*this == other); }
+
+    TrafficLine& operator+=(const TrafficLine& other)
+    {
+        bytesRx += other.bytesRx;
+        bytesTx += other.bytesTx;
+        pktRxCount += other.pktRxCount;
+        pktTxCount += other.pktTxCount;
+        return *this;
+    }
+};
+
+/* The traffic of every application over one interval, as deposited by TrafficStorage. */
+struct TrafficInterval
+{
+    std::unordered_map<std::string, TrafficLine> traffic;
+    time_t timestamp;
+};
+
+/* Storage engine that DBController keeps committed traffic in. A store is never used by more
+ * than one thread at a time, the controller serializes commits and reads with its commit mutex. */
+class TrafficStore
+{
+  public:
+    using TrafficMap = std::unordered_map<std::string, TrafficLine>;
+
+    virtual ~TrafficStore() = default;
+
+    /* Write every interval of the batch to disk, syncing it before returning. rows is set to the
+     * number of traffic lines written. Returns false if the batch could not be written, in which
+     * case none of it was and the same batch can be committed again. */
+    virtual bool commit(const std::vector<std::shared_ptr<const TrafficInterval>>& batch,
+                        uint64_t& rows) = 0;
+
+    /* Total traffic of each application between two timestamps (inclusive). */
+    virtual TrafficMap fetch(time_t start, time_t end) = 0;
+};
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ntmd {
+
+/* Open addressing hash map for small keys and values that are looked up on every packet.
+ * Entries live directly in one contiguous array instead of a node per entry, so a lookup touches
+ * one or two cache lines rather than chasing a bucket pointer to a heap allocated node.
+ * Collisions are resolved with robin hood linear probing: an entry being inserted takes the slot
+ * of any entry that is closer to its home slot than itself, which keeps every probe sequence
+ * short even at high load. Each slot's distance from its home is kept in a separate byte array so
+ * a miss can usually be decided without reading the entries themselves. Erasing shifts the
+ * following entries back instead of leaving tombstones.
+ * Inserting may move entries, so references into the map are only valid until the next insert.
+ * The key of an entry reached through an iterator must not be modified. */
+template <class K, class V, class Hash = std::hash<K>>
+class FlatHashMap
+{
+  public:
+    using value_type = std::pair<K, V>;
+
+    template <bool Const>
+    class Iterator
+    {
+        using Map = std::conditional_t<Const, const FlatHashMap, FlatHashMap>;
+        using Value = std::conditional_t<Const, const value_type, value_type>;
+
+      public:
+        Iterator(Map* map, std::size_t index) : mMap(map), mIndex(index) { skip(); }
+
+        Value& operator*() const { return mMap->mSlots[mIndex]; }
+        Value* operator->() const { return &mMap->mSlots[mIndex]; }
+
+        Iterator& operator++()
+        {
+            mIndex++;
+            skip();
+            return *this;
+        }
+
+        bool operator==(const Iterator& other) const { return mIndex == other.mIndex; }
+        bool operator!=(const Iterator& other) const { return mIndex != other.mIndex; }
+
+      private:
+        /* Move forward to the next occupied slot. */
+        void skip()
+        {
+            while (mIndex < mMap->mDistances.size() && mMap->mDistances[mIndex] == 0)
+                mIndex++;
+        }
+
+        Map* mMap;
+        std::size_t mIndex;
+    };
+
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    FlatHashMap() = default;
+    ~FlatHashMap() = default;
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, mSlots.size()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, mSlots.size()); }
+
+    iterator find(const K& key)
+    {
+        const std::size_t index = indexOf(key);
+        return index == NOT_FOUND ? end() : iterator(this, index);
+    }
+
+    const_iterator find(const K& key) const
+    {
+        const std::size_t index = indexOf(key);
+        return index == NOT_FOUND ? end() : const_iterator(this, index);
+    }
+
+    std::size_t count(const K& key) const { return indexOf(key) == NOT_FOUND ? 0 : 1; }
+
+    /* Returns the value of the key, inserting a default constructed one if it isn't in the map. */
+    V& operator[](const K& key)
+    {
+        std::size_t index = indexOf(key);
+        if (index != NOT_FOUND)
+            return mSlots[index].second;
+
+        if ((mSize + 1) * MAX_LOAD_DENOMINATOR > mSlots.size() * MAX_LOAD_NUMERATOR)
+            rehash(std::max(mSlots.size() * 2, MIN_CAPACITY));
+
+        place(value_type(key, V{}));
+        return mSlots[indexOf(key)].second;
+    }
+
+    /* Returns the number of entries removed, 0 or 1. */
+    std::size_t erase(const K& key)
+    {
+        std::size_t index = indexOf(key);
+        if (index == NOT_FOUND)
+            return 0;
+
+        /* Pull every following entry that isn't already in its home slot back by one so there is
+         * never a gap in the middle of a probe sequence. */
+        for (;;)
+        {
+            const std::size_t next = (index + 1) & mMask;
+            if (mDistances[next] <= 1)
+                break;
+
+            mSlots[index] = std::move(mSlots[next]);
+            mDistances[index] = mDistances[next] - 1;
+            index = next;
+        }
+
+        mDistances[index] = 0;
+        mSlots[index] = value_type();
+        mSize--;
+        return 1;
+    }
+
+    /* Removes every entry but keeps the allocated slots. */
+    void clear()
+    {
+        if (mSize == 0)
+            return;
+
+        std::fill(mDistances.begin(), mDistances.end(), 0);
+        std::fill(mSlots.begin(), mSlots.end(), value_type());
+        mSize = 0;
+    }
+
+    /* Allocate enough slots to hold count entries without growing. */
+    void reserve(std::size_t count)
+    {
+        std::size_t capacity = MIN_CAPACITY;
+        while (count * MAX_LOAD_DENOMINATOR > capacity * MAX_LOAD_NUMERATOR)
+            capacity *= 2;
+
+        if (capacity > mSlots.size())
+            rehash(capacity);
+    }
+
+    void swap(FlatHashMap& other)
+    {
+        mSlots.swap(other.mSlots);
+        mDistances.swap(other.mDistances);
+        std::swap(mSize, other.mSize);
+        std::swap(mMask, other.mMask);
+        std::swap(mShift, other.mShift);
+    }
+
+    std::size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+    std::size_t capacity() const { return mSlots.size(); }
+
+    /* Bytes allocated for the slots, not counting anything the keys or values allocate. */
+    std::size_t memory() const { return mSlots.size() * (sizeof(value_type) + 1); }
+
+  private:
+    static constexpr std::size_t NOT_FOUND = ~std::size_t(0);
+    static constexpr std::size_t MIN_CAPACITY = 16;
+
+    /* Grow once more than 7/8 of the slots are in use. */
+    static constexpr std::size_t MAX_LOAD_NUMERATOR = 7;
+    static constexpr std::size_t MAX_LOAD_DENOMINATOR = 8;
+
+    /* Distances are stored in a byte with 0 meaning an empty slot. A probe sequence this long
+     * means the hash is clustering badly, the table is grown so the keys are spread over more bits
+     * of their hashes. Keys with equal hashes are never spread, which is why keys chosen by
+     * someone else must be hashed with a key they don't know. */
+    static constexpr unsigned MAX_DISTANCE = 255;
+
+    /* Home slot of a key. The hash is multiplied by 2^64 / phi and the top bits are used so that
+     * even an identity hash, like std::hash of an integer, is spread over the whole table. */
+    std::size_t home(const K& key) const
+    {
+        return static_cast<std::size_t>(
+            (static_cast<uint64_t>(Hash()(key)) * 0x9e3779b97f4a7c15ULL) >> mShift);
+    }
+
+    std::size_t indexOf(const K& key) const
+    {
+        if (mSize == 0)
+            return NOT_FOUND;
+
+        std::size_t index = home(key);
+        for (unsigned distance = 1;; distance++)
+        {
+            /* Either an empty slot or an entry closer to home than the key would be, both mean
+             * the key would have been placed here. */
+            if (mDistances[index] < distance)
+                return NOT_FOUND;
+
+            if (mDistances[index] == distance && mSlots[index].first == key)
+                return index;
+
+            index = (index + 1) & mMask;
+        }
+    }
+
+    /* Insert an entry whose key isn't in the map yet, there must be a free slot. */
+    void place(value_type entry)
+    {
+        std::size_t index = home(entry.first);
+        for (unsigned distance = 1;; distance++)
+        {
+            if (mDistances[index] == 0)
+            {
+                mDistances[index] = static_cast<uint8_t>(distance);
+                mSlots[index] = std::move(entry);
+                mSize++;
+                return;
+            }
+
+            /* Take the slot from an entry that is closer to its home and carry on placing that
+             * entry instead. */
+            if (mDistances[index] < distance)
+            {
+                const unsigned displaced = mDistances[index];
+                mDistances[index] = static_cast<uint8_t>(distance);
+                std::swap(entry, mSlots[index]);
+                distance = displaced;
+            }
+
+            if (distance + 1 >= MAX_DISTANCE)
+            {
+                rehash(mSlots.size() * 2);
+                place(std::move(entry));
+                return;
+            }
+
+            index = (index + 1) & mMask;
+        }
+    }
+
+    void rehash(std::size_t capacity)
+    {
+        std::vector<value_type> slots(capacity);
+        std::vector<uint8_t> distances(capacity, 0);
+        slots.swap(mSlots);
+        distances.swap(mDistances);
+
+        mSize = 0;
+        mMask = capacity - 1;
+        mShift = 64;
+        for (std::size_t size = capacity; size > 1; size >>= 1)
+            mShift--;
+
+        for (std::size_t i = 0; i < slots.size(); i++)
+        {
+            if (distances[i] != 0)
+                place(std::move(slots[i]));
+        }
+    }
+
+    std::vector<value_type> mSlots;
+    std::vector<uint8_t> mDistances;
+
+    std::size_t mSize{0};
+    std::size_t mMask{0};
+    unsigned mShift{64};
+};
+
+} // namespace ntmd
\ No newline at end of file
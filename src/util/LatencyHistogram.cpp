@@ -0,0 +1,47 @@
+#include "LatencyHistogram.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace ntmd {
+
+void LatencyHistogram::record(uint64_t nanos)
+{
+    count++;
+    maxNanos = std::max(maxNanos, nanos);
+
+    int bucket = 0;
+    while (bucket < BUCKETS - 1 && nanos >= (2ULL << bucket))
+        bucket++;
+
+    buckets[bucket]++;
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const
+{
+    const uint64_t target = static_cast<uint64_t>(count * fraction);
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen > target)
+            return std::min<uint64_t>(maxNanos, 2ULL << i);
+    }
+
+    return maxNanos;
+}
+
+LatencyHistogram& LatencyHistogram::operator+=(const LatencyHistogram& other)
+{
+    count += other.count;
+    maxNanos = std::max(maxNanos, other.maxNanos);
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        buckets[i] += other.buckets[i];
+    }
+
+    return *this;
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace ntmd {
+
+/* Histogram of durations in nanoseconds with a bucket per power of two, cheap enough to record
+ * from hot paths and merge between threads. Not thread safe on its own. */
+struct LatencyHistogram
+{
+    static constexpr int BUCKETS = 40;
+
+    uint64_t count{0};
+    uint64_t maxNanos{0};
+
+    /* Bucket i counts durations under 2^(i + 1) nanoseconds. */
+    std::array<uint64_t, BUCKETS> buckets{};
+
+    void record(uint64_t nanos);
+
+    /* Upper bound of the bucket holding the given fraction of durations, e.g. 0.99. Never more
+     * than the longest duration recorded. */
+    uint64_t percentile(double fraction) const;
+
+    LatencyHistogram& operator+=(const LatencyHistogram& other);
+};
+
+} // namespace ntmd
\ No newline at end of file
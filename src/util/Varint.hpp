@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace ntmd::util {
+
+/* LEB128 style variable length integer, 7 bits per byte with the high bit set on every byte but
+ * the last. Values under 128 take a single byte. */
+inline void putVarint(std::vector<uint8_t>& data, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        data.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    data.push_back(static_cast<uint8_t>(value));
+}
+
+/* Reads a varint written by putVarint and moves data past it. The caller has to make sure the
+ * whole varint is readable. */
+inline uint64_t getVarint(const uint8_t*& data)
+{
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7)
+    {
+        const uint8_t byte = *data++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return value;
+    }
+}
+
+/* Map signed values to unsigned ones so small negative numbers also take a single byte. */
+inline uint64_t zigzag(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+} // namespace ntmd::util
\ No newline at end of file
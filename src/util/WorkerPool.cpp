@@ -0,0 +1,71 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <utility>
+
+namespace ntmd {
+
+WorkerPool::WorkerPool(int threads, std::size_t maxQueued) : mMaxQueued(maxQueued)
+{
+    for (int i = 0; i < std::max(threads, 1); i++)
+    {
+        mThreads.emplace_back([this] { this->run(); });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    this->stop();
+}
+
+bool WorkerPool::post(std::function<void()> job)
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mStopping || mJobs.size() >= mMaxQueued)
+            return false;
+
+        mJobs.push_back(std::move(job));
+    }
+
+    mPosted.notify_one();
+    return true;
+}
+
+void WorkerPool::stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+
+    mPosted.notify_all();
+    for (std::thread& thread : mThreads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+}
+
+void WorkerPool::run()
+{
+    while (true)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mPosted.wait(lock, [this] { return mStopping || !mJobs.empty(); });
+
+            if (mJobs.empty())
+                return;
+
+            job = std::move(mJobs.front());
+            mJobs.pop_front();
+        }
+
+        job();
+    }
+}
+
+} // namespace ntmd
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ntmd {
+
+/* Fixed number of threads running jobs in the order they were posted. The queue of jobs waiting
+ * for a thread is bounded so a burst of work is turned away instead of piling up. */
+class WorkerPool
+{
+  public:
+    WorkerPool(int threads, std::size_t maxQueued);
+
+    /* Runs the jobs still queued before returning. */
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /* Queue a job for the next free thread. Returns false without queueing it if maxQueued jobs
+     * are already waiting, or the pool has been stopped. */
+    bool post(std::function<void()> job);
+
+    /* Run the jobs still queued and join every thread, nothing can be posted afterwards. */
+    void stop();
+
+  private:
+    void run();
+
+    std::size_t mMaxQueued;
+
+    std::mutex mMutex;
+    std::condition_variable mPosted;
+    std::deque<std::function<void()>> mJobs;
+    bool mStopping{false};
+
+    std::vector<std::thread> mThreads;
+};
+
+} // namespace ntmd
\ No newline at end of file